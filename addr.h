@@ -63,7 +63,24 @@ static inline u8 dec_torus_ttl(u8 *addr)
 
 static inline void init_torus_ttl(u8 *addr)
 {
-	addr[0] | 0xf0;
+	addr[0] |= 0xf0;
+}
+
+/*
+ * The virtual channel of a unicast frame is the bit after the locally
+ * administered one in the first byte of its destination
+ */
+#define	TORUS_VCS	2
+#define	TORUS_VC_BIT	0x04
+
+static inline uint get_torus_vc(const u8 *addr)
+{
+	return (addr[0] & TORUS_VC_BIT) ? 1 : 0;
+}
+
+static inline void set_torus_vc(u8 *addr, uint vc)
+{
+	addr[0] = (addr[0] & ~TORUS_VC_BIT) | (vc ? TORUS_VC_BIT : 0);
 }
 
 static inline void random_torus_addr(struct net_device *dev)
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <torus.h>
+
+/*
+ * A port is the plus or minus port of dimension d if its peer has the
+ * toroid prefix and differs from this node only by one in dimension d.
+ * This must be called with priv->port_mutex.
+ */
+static void set_torus_coord_ports(struct torus *priv, struct torus_coord *c)
+{
+	struct	torus_ports *ports = torus_ports_locked(priv);
+	u8	*peer, *self = c->addr;
+	uint	first = TORUS_COORD_BYTE(c->dims, 0);
+	uint	d, diff, j, n, size;
+	int	coord;
+
+	memset(c->plus, 0, sizeof(c->plus));
+	memset(c->minus, 0, sizeof(c->minus));
+	for (j = 1; j < ports->n; j++) {
+		peer = ports->port[j].peer;
+		if (!ports->port[j].dev || is_zero_ether_addr(peer))
+			continue;
+		if (memcmp(peer + 1, self + 1, first - 1))
+			continue;
+		for (d = 0, n = 0, diff = 0; d < c->dims; d++) {
+			coord = get_torus_coord(c, peer, d);
+			if (coord < 0)
+				break;
+			if (coord != c->self[d]) {
+				diff = d;
+				n++;
+			}
+		}
+		if (d < c->dims || n != 1)
+			continue;
+		coord = get_torus_coord(c, peer, diff);
+		size = c->size[diff];
+		if (coord == (c->self[diff] + 1) % size && !c->plus[diff])
+			c->plus[diff] = j;
+		if (coord == (c->self[diff] + size - 1) % size &&
+		    !c->minus[diff])
+			c->minus[diff] = j;
+	}
+}
+
+/*
+ * Precompute the ports of each broadcast class: the way it continues
+ * around dimension k, then both ways around each later dimension.  A ring
+ * of two has no minus way.
+ */
+static void set_torus_coord_fanout(struct torus_coord *c)
+{
+	u8	*fan;
+	int	k, j;
+	uint	way, n;
+
+	for (k = -1; k < (int)c->dims; k++)
+		for (way = 0; way < TORUS_FANOUT_WAYS; way++) {
+			fan = c->fanout[TORUS_FANOUT(k, way)];
+			n = 0;
+			if (k >= 0 && way == 1 && c->plus[k])
+				fan[n++] = c->plus[k];
+			if (k >= 0 && way == 2 && c->minus[k])
+				fan[n++] = c->minus[k];
+			for (j = k + 1; j < c->dims; j++) {
+				if (c->plus[j])
+					fan[n++] = c->plus[j];
+				if (c->size[j] > 2 && c->minus[j])
+					fan[n++] = c->minus[j];
+			}
+			c->fanouts[TORUS_FANOUT(k, way)] = n;
+		}
+}
+
+/*
+ * set_torus_coord - set or, with zero dims, clear the toroid dimensions
+ * @priv:	torus node
+ * @dims:	number of dimensions
+ * @size:	size of each dimension
+ * @origin:	address byte of coordinate zero in each dimension
+ *
+ * The node's own address must be within the toroid and the plus and minus
+ * ports are found from the peer addresses.
+ */
+int set_torus_coord(struct torus *priv, uint dims, const u16 *size,
+		    const u8 *origin)
+{
+	struct	torus_coord *old, *c = NULL;
+	int	d, coord;
+
+	if (dims) {
+		retonerange(dims, 1, TORUS_MAX_DIMS, "dimensions");
+		for (d = 0; d < dims; d++)
+			retonerange(size[d], TORUS_MIN_SIZE, TORUS_MAX_SIZE,
+				    "dimension size");
+		c = kzalloc(sizeof(*c), GFP_KERNEL);
+		retonerr(c ? 0 : -ENOMEM, "alloc coord");
+		c->dims = dims;
+		memcpy(c->size, size, dims * sizeof(*size));
+		memcpy(c->origin, origin, dims * sizeof(*origin));
+	}
+	mutex_lock(&priv->port_mutex);
+	spin_lock(&priv->lock);
+	if (c) {
+		memcpy(c->addr, priv->dev->dev_addr, TORUS_ALEN);
+		reset_torus_ttl(c->addr);
+		for (d = 0; d < dims; d++) {
+			if (coord = get_torus_coord(c, c->addr, d), coord < 0) {
+				spin_unlock(&priv->lock);
+				mutex_unlock(&priv->port_mutex);
+				pr_torus_err("%pM outside of toroid", c->addr);
+				kfree(c);
+				return -ERANGE;
+			}
+			c->self[d] = coord;
+		}
+		set_torus_coord_ports(priv, c);
+		set_torus_coord_fanout(c);
+	}
+	old = priv->coord;
+	rcu_assign_pointer(priv->coord, c);
+	spin_unlock(&priv->lock);
+	mutex_unlock(&priv->port_mutex);
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
+/*
+ * update_torus_coord - find the plus and minus ports after a port change
+ */
+void update_torus_coord(struct torus *priv)
+{
+	struct	torus_coord *c;
+	u16	size[TORUS_MAX_DIMS];
+	u8	origin[TORUS_MAX_DIMS];
+	uint	dims = 0;
+
+	rcu_read_lock();
+	if (c = rcu_dereference(priv->coord), c != NULL) {
+		dims = c->dims;
+		memcpy(size, c->size, sizeof(size));
+		memcpy(origin, c->origin, sizeof(origin));
+	}
+	rcu_read_unlock();
+	if (dims)
+		set_torus_coord(priv, dims, size, origin);
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_COORD_H__
+#define __TORUS_COORD_H__
+
+#include <linux/kernel.h>
+#include <linux/rcupdate.h>
+#include <linux/torus.h>
+#include <addr.h>
+
+/*
+ * The nodes of a regular toroid have their coordinates in the address
+ * bytes before the last (which is left for clones); so, with D dimensions,
+ * dimension d is in byte TORUS_COORD_BYTE(D, d) and bytes 1 through
+ * TORUS_COORD_BYTE(D, 0) - 1 are the toroid's prefix; there are at most
+ * TORUS_MAX_DIMS of them.
+ */
+#define	TORUS_COORD_BYTE(dims,d)	(TORUS_ALEN - 1 - (dims) + (d))
+
+/*
+ * A broadcast travels a dimension ordered tree rooted at its source: the
+ * source sends both ways around the ring of dimension 0, every node of
+ * that ring then sends both ways around its ring of dimension 1, and so on.
+ * The plus way covers offsets 1 through size / 2 from the source and the
+ * minus way the rest.  A node's copies depend only on the last dimension
+ * the frame travelled, k, and whether it continues that way around k; so
+ * each of these classes has a precomputed fanout.
+ */
+#define	TORUS_FANOUT_WAYS	3	/* none, plus or minus */
+#define	TORUS_FANOUT_CLASSES	((TORUS_MAX_DIMS + 1) * TORUS_FANOUT_WAYS)
+#define	TORUS_FANOUT(k,way)	((((k) + 1) * TORUS_FANOUT_WAYS) + (way))
+
+struct	torus_coord {
+	struct	rcu_head rcu;
+	uint	dims;
+	/*
+	 * origin[d] is the address byte of coordinate 0 in dimension d and
+	 * self[d] is the coordinate of this node
+	 */
+	u16	size[TORUS_MAX_DIMS];
+	u8	origin[TORUS_MAX_DIMS];
+	u8	self[TORUS_MAX_DIMS];
+	/*
+	 * plus[d] and minus[d] are port indices toward coordinate
+	 * self[d] + 1 and self[d] - 1; 0 if there is no such port
+	 */
+	u8	plus[TORUS_MAX_DIMS];
+	u8	minus[TORUS_MAX_DIMS];
+	u8	addr[TORUS_ALEN];
+	/*
+	 * fanout[TORUS_FANOUT(k, way)] has the fanouts[] port indices that
+	 * get a copy of a broadcast in that class
+	 */
+	u8	fanouts[TORUS_FANOUT_CLASSES];
+	u8	fanout[TORUS_FANOUT_CLASSES][2 * TORUS_MAX_DIMS];
+};
+
+/*
+ * torus_pick scales a flow hash to one of n choices
+ */
+static inline uint torus_pick(u32 hash, uint n)
+{
+	return (uint)(((u64)hash * n) >> 32);
+}
+
+static inline int get_torus_coord(const struct torus_coord *c, const u8 *addr,
+				  uint d)
+{
+	uint	coord = (u8)(addr[TORUS_COORD_BYTE(c->dims, d)] - c->origin[d]);
+
+	return coord < c->size[d] ? coord : -1;
+}
+
+/*
+ * torus_coord_hops fills hop[2 * TORUS_MAX_DIMS] with the index of each
+ * port in a minimal direction toward addr within the first dimension that
+ * differs and returns their number; or 0 if addr isn't within the toroid,
+ * is this node, or there is no such port, in which case the caller falls
+ * back to the lookup tables.  Keeping to dimension order is what makes the
+ * dateline channels below deadlock free.
+ */
+static inline uint torus_coord_hops(const struct torus_coord *c, const u8 *addr,
+				    u8 *hop)
+{
+	uint	d, n = 0, first = TORUS_COORD_BYTE(c->dims, 0);
+	uint	plus, minus;
+	int	i, coord;
+
+	for (i = 1; i < first; i++)
+		if (addr[i] != c->addr[i])
+			return 0;
+	for (d = 0; d < c->dims; d++) {
+		coord = get_torus_coord(c, addr, d);
+		if (coord < 0)
+			return 0;
+		if (coord == c->self[d])
+			continue;
+		plus = coord > c->self[d]
+			? coord - c->self[d]
+			: coord + c->size[d] - c->self[d];
+		minus = c->size[d] - plus;
+		if (plus <= minus && c->plus[d])
+			hop[n++] = c->plus[d];
+		if (minus <= plus && c->minus[d])
+			hop[n++] = c->minus[d];
+		return n;
+	}
+	return 0;
+}
+
+/*
+ * torus_coord_dim returns the dimension of the ring on port i, or -1 if
+ * it isn't a port of the toroid
+ */
+static inline int torus_coord_dim(const struct torus_coord *c, uint i)
+{
+	uint	d;
+
+	for (d = 0; i && d < c->dims; d++)
+		if (c->plus[d] == i || c->minus[d] == i)
+			return d;
+	return -1;
+}
+
+/*
+ * A unicast frame goes around each ring on virtual channel 0 until it
+ * crosses the ring's dateline, the wrap link between coordinates size - 1
+ * and 0, then on channel 1; it's back on 0 as it turns to another ring.  So
+ * the dependencies of neither channel go all the way around a ring.
+ * torus_coord_vc returns the channel of a frame on vc, that last went
+ * around ring in, out port i within ring out.
+ */
+static inline uint torus_coord_vc(const struct torus_coord *c, int in,
+				  uint vc, uint i, int out)
+{
+	if (out < 0)
+		return vc;
+	if (out != in)
+		vc = 0;
+	if ((i == c->plus[out] && c->self[out] == c->size[out] - 1) ||
+	    (i == c->minus[out] && c->self[out] == 0))
+		vc = 1;
+	return vc;
+}
+
+/*
+ * torus_coord_fanout returns the class of a broadcast from src at this
+ * node, or -1 if src isn't within the toroid.
+ */
+static inline int torus_coord_fanout(const struct torus_coord *c,
+				     const u8 *src)
+{
+	uint	d, way = 0, first = TORUS_COORD_BYTE(c->dims, 0);
+	int	i, k = -1, coord, offset = 0;
+
+	for (i = 1; i < first; i++)
+		if (src[i] != c->addr[i])
+			return -1;
+	for (d = 0; d < c->dims; d++) {
+		coord = get_torus_coord(c, src, d);
+		if (coord < 0)
+			return -1;
+		if (coord != c->self[d]) {
+			k = d;
+			offset = (c->self[d] + c->size[d] - coord) %
+				c->size[d];
+		}
+	}
+	if (k >= 0) {
+		if (offset < c->size[k] / 2)
+			way = 1;
+		else if (offset > c->size[k] / 2 + 1)
+			way = 2;
+	}
+	return TORUS_FANOUT(k, way);
+}
+
+#endif	/* __TORUS_COORD_H__ */
@@ -20,6 +20,7 @@
 
 #include <linux/u64_stats_sync.h>
 #include <linux/percpu.h>
+#include <linux/cache.h>
 
 struct	percpu_counters {
 	u64	packets;
@@ -37,6 +38,51 @@ struct	counters {
 	struct	percpu_counters __percpu *percpu;
 };
 
+/*
+ * queue_counters are per cpu with an entry for each tx queue; since torus
+ * devices are LLTX, ndo_tx() may run on several cpus for the same queue
+ * so no cpu's entries are shared.
+ */
+struct	queue_counters {
+	struct	u64_stats_sync sync;
+	struct	{
+		u64	packets;
+		u64	bytes;
+		u64	drops;
+	} queue[0];
+};
+
+/*
+ * port_counters are per cpu with an entry for each port index to show
+ * how the transmits balance over the next hops and what each port receives.
+ */
+struct	port_counters {
+	struct	u64_stats_sync sync;
+	struct	{
+		u64	rx_packets;
+		u64	rx_bytes;
+		u64	tx_packets;
+		u64	tx_bytes;
+	} port[0];
+};
+
+/*
+ * drop_counters are per cpu with an entry for each reason to drop a frame
+ */
+enum {
+	TORUS_DROP_NO_ROUTE,
+	TORUS_DROP_TTL,
+	TORUS_DROP_CLONE,
+	TORUS_DROP_XMIT,
+	TORUS_DROP_BACKLOG,
+	TORUS_DROPS
+};
+
+struct	drop_counters {
+	u64	drop[TORUS_DROPS];
+	struct	u64_stats_sync sync;
+};
+
 static inline void alloc_percpu_counters(struct counters *p)
 {
 	p->packets = p->bytes = p->errors = p->drops = 0ULL;
@@ -70,6 +116,35 @@ static inline void count_packet(struct counters *p, uint bytes)
 	}
 }
 
+static inline void count_packets(struct counters *p, uint packets, u64 bytes)
+{
+	struct percpu_counters *this_cpu;
+
+	if (have_percpu_counters(p)) {
+		this_cpu = this_cpu_ptr(p->percpu);
+		u64_stats_update_begin(&this_cpu->sync);
+		this_cpu->packets += packets;
+		this_cpu->bytes += bytes;
+		u64_stats_update_end(&this_cpu->sync);
+	} else {
+		p->packets += packets;
+		p->bytes += bytes;
+	}
+}
+
+static inline void count_drops(struct counters *p, uint drops)
+{
+	struct percpu_counters *this_cpu;
+
+	if (have_percpu_counters(p)) {
+		this_cpu = this_cpu_ptr(p->percpu);
+		u64_stats_update_begin(&this_cpu->sync);
+		this_cpu->drops += drops;
+		u64_stats_update_end(&this_cpu->sync);
+	} else
+		p->drops += drops;
+}
+
 static inline void count_error(struct counters *p)
 {
 	struct percpu_counters *this_cpu;
@@ -127,4 +202,171 @@ static inline void accumulate_counters(struct counters *p)
 		}
 	}
 }
+
+static inline struct queue_counters __percpu *alloc_queue_counters(uint queues)
+{
+	return __alloc_percpu(sizeof(struct queue_counters) + queues *
+			      sizeof(((struct queue_counters *)0)->queue[0]),
+			      SMP_CACHE_BYTES);
+}
+
+static inline void count_queue_packet(struct queue_counters __percpu *q,
+				      uint i, uint bytes)
+{
+	struct queue_counters *this_cpu;
+
+	if (!q)
+		return;
+	this_cpu = this_cpu_ptr(q);
+	u64_stats_update_begin(&this_cpu->sync);
+	this_cpu->queue[i].packets++;
+	this_cpu->queue[i].bytes += bytes;
+	u64_stats_update_end(&this_cpu->sync);
+}
+
+static inline void count_queue_drop(struct queue_counters __percpu *q,
+				    uint i)
+{
+	struct queue_counters *this_cpu;
+
+	if (!q)
+		return;
+	this_cpu = this_cpu_ptr(q);
+	u64_stats_update_begin(&this_cpu->sync);
+	this_cpu->queue[i].drops++;
+	u64_stats_update_end(&this_cpu->sync);
+}
+
+/*
+ * get_queue_counters sums the cpus' packets, bytes and drops of queue i
+ */
+static inline void get_queue_counters(struct queue_counters __percpu *q,
+				      uint i, u64 *packets, u64 *bytes,
+				      u64 *drops)
+{
+	struct queue_counters *cpup;
+	u64 p, b, d;
+	uint start;
+	int cpu;
+
+	*packets = *bytes = *drops = 0ULL;
+	if (!q)
+		return;
+	for_each_possible_cpu(cpu) {
+		cpup = per_cpu_ptr(q, cpu);
+		do {
+			start = u64_stats_fetch_begin_bh(&cpup->sync);
+			p = cpup->queue[i].packets;
+			b = cpup->queue[i].bytes;
+			d = cpup->queue[i].drops;
+		} while (u64_stats_fetch_retry_bh(&cpup->sync, start));
+		*packets += p;
+		*bytes	 += b;
+		*drops	 += d;
+	}
+}
+
+static inline struct port_counters __percpu *alloc_port_counters(uint ports)
+{
+	return __alloc_percpu(sizeof(struct port_counters) + ports *
+			      sizeof(((struct port_counters *)0)->port[0]),
+			      SMP_CACHE_BYTES);
+}
+
+static inline void count_port_rx(struct port_counters __percpu *p, uint i,
+				 uint bytes)
+{
+	struct port_counters *this_cpu;
+
+	if (!p)
+		return;
+	this_cpu = this_cpu_ptr(p);
+	u64_stats_update_begin(&this_cpu->sync);
+	this_cpu->port[i].rx_packets++;
+	this_cpu->port[i].rx_bytes += bytes;
+	u64_stats_update_end(&this_cpu->sync);
+}
+
+static inline void count_port_tx(struct port_counters __percpu *p, uint i,
+				 uint bytes)
+{
+	struct port_counters *this_cpu;
+
+	if (!p)
+		return;
+	this_cpu = this_cpu_ptr(p);
+	u64_stats_update_begin(&this_cpu->sync);
+	this_cpu->port[i].tx_packets++;
+	this_cpu->port[i].tx_bytes += bytes;
+	u64_stats_update_end(&this_cpu->sync);
+}
+
+/*
+ * get_port_counters sums the cpus' rx_packets, rx_bytes, tx_packets and
+ * tx_bytes of port i to v[4]
+ */
+static inline void get_port_counters(struct port_counters __percpu *p, uint i,
+				     u64 *v)
+{
+	struct port_counters *cpup;
+	u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+	uint start;
+	int cpu;
+
+	v[0] = v[1] = v[2] = v[3] = 0ULL;
+	if (!p)
+		return;
+	for_each_possible_cpu(cpu) {
+		cpup = per_cpu_ptr(p, cpu);
+		do {
+			start	   = u64_stats_fetch_begin_bh(&cpup->sync);
+			rx_packets = cpup->port[i].rx_packets;
+			rx_bytes   = cpup->port[i].rx_bytes;
+			tx_packets = cpup->port[i].tx_packets;
+			tx_bytes   = cpup->port[i].tx_bytes;
+		} while (u64_stats_fetch_retry_bh(&cpup->sync, start));
+		v[0] += rx_packets;
+		v[1] += rx_bytes;
+		v[2] += tx_packets;
+		v[3] += tx_bytes;
+	}
+}
+
+static inline void count_drop_reason(struct drop_counters __percpu *p,
+				     uint reason, uint drops)
+{
+	struct drop_counters *this_cpu;
+
+	if (!p)
+		return;
+	this_cpu = this_cpu_ptr(p);
+	u64_stats_update_begin(&this_cpu->sync);
+	this_cpu->drop[reason] += drops;
+	u64_stats_update_end(&this_cpu->sync);
+}
+
+/*
+ * get_drop_counters sums the cpus' drops of each reason to v[TORUS_DROPS]
+ */
+static inline void get_drop_counters(struct drop_counters __percpu *p, u64 *v)
+{
+	struct drop_counters *cpup;
+	u64 drop[TORUS_DROPS];
+	uint start;
+	int cpu, i;
+
+	for (i = 0; i < TORUS_DROPS; i++)
+		v[i] = 0ULL;
+	if (!p)
+		return;
+	for_each_possible_cpu(cpu) {
+		cpup = per_cpu_ptr(p, cpu);
+		do {
+			start = u64_stats_fetch_begin_bh(&cpup->sync);
+			memcpy(drop, cpup->drop, sizeof(drop));
+		} while (u64_stats_fetch_retry_bh(&cpup->sync, start));
+		for (i = 0; i < TORUS_DROPS; i++)
+			v[i] += drop[i];
+	}
+}
 #endif /* __COUNTERS_H__ */
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <torus.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+/*
+ * Each torus device has a directory of the same name in debugfs/torus;
+ * debugfs is optional so these fail quietly.  The files have the ifindex
+ * of their device rather than the device, which may be gone by the time
+ * an open file is used, and each read or write finds it again.
+ */
+static struct dentry *torus_debugfs;
+
+static int open_latency(struct inode *, struct file *);
+static int show_latency(struct seq_file *, void *);
+static ssize_t read_timed(struct file *, char __user *, size_t, loff_t *);
+static ssize_t write_timed(struct file *, const char __user *, size_t,
+			   loff_t *);
+
+static const struct file_operations latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= open_latency,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const struct file_operations timed_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= read_timed,
+	.write		= write_timed,
+	.llseek		= default_llseek,
+};
+
+int register_torus_debugfs(void)
+{
+	torus_debugfs = debugfs_create_dir(TORUS, NULL);
+	if (IS_ERR_OR_NULL(torus_debugfs))
+		torus_debugfs = NULL;
+	return 0;
+}
+
+void unregister_torus_debugfs(void)
+{
+	debugfs_remove_recursive(torus_debugfs);
+	torus_debugfs = NULL;
+}
+
+void create_torus_debugfs(struct net_device *dev)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	dentry *d;
+
+	if (!torus_debugfs)
+		return;
+	d = debugfs_create_dir(dev->name, torus_debugfs);
+	if (IS_ERR_OR_NULL(d))
+		return;
+	debugfs_create_file("timed", S_IWUSR | S_IRUGO, d,
+			    (void *)(long)dev->ifindex, &timed_fops);
+	debugfs_create_file("latency", S_IRUGO, d,
+			    (void *)(long)dev->ifindex, &latency_fops);
+	ACCESS_ONCE(priv->debugfs) = d;
+}
+
+void remove_torus_debugfs(struct net_device *dev)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	dentry *d = priv->debugfs;
+
+	/* an open file no longer finds dev once its directory isn't dev's */
+	ACCESS_ONCE(priv->debugfs) = NULL;
+	debugfs_remove_recursive(d);
+}
+
+/*
+ * torus_debugfs_dev returns the device of file's ifindex in whatever
+ * name-space, so long as file is still in its directory; the caller must
+ * hold rcu_read_lock()
+ */
+static struct net_device *torus_debugfs_dev(struct file *file)
+{
+	struct	dentry *d = file->f_path.dentry;
+	long	ifindex = (long)d->d_inode->i_private;
+	struct	net_device *dev;
+	struct	net *net;
+
+	for_each_net_rcu(net) {
+		dev = dev_get_by_index_rcu(net, ifindex);
+		if (is_torus(dev) &&
+		    ACCESS_ONCE(((struct torus *)netdev_priv(dev))->debugfs) ==
+		    d->d_parent)
+			return dev;
+	}
+	return NULL;
+}
+
+static int open_latency(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_latency, file);
+}
+
+static void show_histogram(struct seq_file *s, const char *name, int i,
+			   const u64 *v)
+{
+	int	b;
+
+	if (i < 0)
+		seq_printf(s, "%s", name);
+	else
+		seq_printf(s, "%s%d", name, i);
+	for (b = 0; b < TORUS_LATENCY_BUCKETS; b++)
+		seq_printf(s, " %llu", v[b]);
+	seq_putc(s, '\n');
+}
+
+/*
+ * latency has a line of TORUS_LATENCY_BUCKETS counts for each histogram,
+ * where bucket b is 2^b nanoseconds and up; the port lines are only of
+ * those ports with a count.
+ */
+static int show_latency(struct seq_file *s, void *unused)
+{
+	struct	net_device *dev;
+	struct	torus_latency __percpu *p;
+	u64	v[TORUS_LATENCY_BUCKETS];
+	int	i, b;
+
+	rcu_read_lock();
+	if (dev = torus_debugfs_dev(s->private), !dev) {
+		rcu_read_unlock();
+		return -ENODEV;
+	}
+	p = ACCESS_ONCE(((struct torus *)netdev_priv(dev))->latency);
+	smp_rmb();
+	get_torus_latency(p, offsetof(struct torus_latency, e2e), v);
+	show_histogram(s, "e2e", -1, v);
+	get_torus_latency(p, offsetof(struct torus_latency, fwd), v);
+	show_histogram(s, "fwd", -1, v);
+	for (i = 1; i < torus_latency_ports(p); i++) {
+		get_torus_latency(p, offsetof(struct torus_latency, port) +
+				  i * sizeof(((struct torus_latency *)0)->
+					     port[0]), v);
+		for (b = 0; b < TORUS_LATENCY_BUCKETS && !v[b]; b++)
+			;
+		if (b < TORUS_LATENCY_BUCKETS)
+			show_histogram(s, "port", i, v);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static ssize_t read_timed(struct file *file, char __user *ubuf, size_t count,
+			  loff_t *ppos)
+{
+	struct	net_device *dev;
+	char	buf[3];
+
+	rcu_read_lock();
+	if (dev = torus_debugfs_dev(file), !dev) {
+		rcu_read_unlock();
+		return -ENODEV;
+	}
+	buf[0] = ACCESS_ONCE(((struct torus *)netdev_priv(dev))->timed)
+		? '1' : '0';
+	rcu_read_unlock();
+	buf[1] = '\n';
+	buf[2] = '\0';
+	return simple_read_from_buffer(ubuf, count, ppos, buf, 2);
+}
+
+/*
+ * Setting timed clears the histograms then starts counting; they're
+ * allocated the first time, and again if the ports have since outgrown
+ * them, with the old freed once no frame can be counting in them.
+ */
+static ssize_t write_timed(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct	net_device *dev;
+	struct	torus *priv;
+	struct	torus_latency __percpu *p, *old = NULL;
+	char	buf[8];
+	bool	b;
+	uint	n;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	retonerr(strtobool(buf, &b), "invalid timed");
+	/* with rtnl, the device can't be unregistered once found */
+	rtnl_lock();
+	rcu_read_lock();
+	dev = torus_debugfs_dev(file);
+	rcu_read_unlock();
+	if (!dev) {
+		rtnl_unlock();
+		return -ENODEV;
+	}
+	priv = netdev_priv(dev);
+	if (b && !priv->timed) {
+		p = priv->latency;
+		n = min_t(uint, nr_torus_ports(priv), TORUS_LATENCY_PORTS);
+		if (!p || torus_latency_ports(p) < n) {
+			old = p;
+			if (p = alloc_torus_latency(n), !p) {
+				rtnl_unlock();
+				return -ENOMEM;
+			}
+		}
+		reset_torus_latency(p);
+		ACCESS_ONCE(priv->latency) = p;
+		smp_wmb();
+	}
+	ACCESS_ONCE(priv->timed) = b;
+	if (old) {
+		synchronize_net();
+		free_percpu(old);
+	}
+	rtnl_unlock();
+	return count;
+}
@@ -45,8 +45,69 @@ static void this_get_drvinfo(struct net_device *dev,
 	strlcpy(info->fw_version, "N/A", sizeof(info->fw_version));
 }
 
+static const char drop_stats[TORUS_DROPS][ETH_GSTRING_LEN] = {
+	[TORUS_DROP_NO_ROUTE]	= "drop_no_route",
+	[TORUS_DROP_TTL]	= "drop_ttl",
+	[TORUS_DROP_CLONE]	= "drop_clone",
+	[TORUS_DROP_XMIT]	= "drop_xmit",
+	[TORUS_DROP_BACKLOG]	= "drop_backlog",
+};
+
+static const char *port_stats[] = {
+	"rx_packets", "rx_bytes", "tx_packets", "tx_bytes",
+};
+
+#define	PORT_STATS	ARRAY_SIZE(port_stats)
+
+/*
+ * The drop reasons are followed by the stats of each port after port[0];
+ * rtnl keeps the number of ports from changing between these calls.
+ */
+static int this_get_sset_count(struct net_device *dev, int sset)
+{
+	struct	torus *priv = netdev_priv(dev);
+
+	if (sset != ETH_SS_STATS)
+		return -EOPNOTSUPP;
+	return TORUS_DROPS + ((nr_torus_ports(priv) - 1) * PORT_STATS);
+}
+
+static void this_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	struct	torus *priv = netdev_priv(dev);
+	int	i, j, n = nr_torus_ports(priv);
+
+	if (sset != ETH_SS_STATS)
+		return;
+	memcpy(data, drop_stats, sizeof(drop_stats));
+	data += sizeof(drop_stats);
+	for (i = 1; i < n; i++)
+		for (j = 0; j < PORT_STATS; j++) {
+			snprintf(data, ETH_GSTRING_LEN, "port%d_%s", i,
+				 port_stats[j]);
+			data += ETH_GSTRING_LEN;
+		}
+}
+
+static void this_get_ethtool_stats(struct net_device *dev,
+				   struct ethtool_stats *stats, u64 *data)
+{
+	struct	torus *priv = netdev_priv(dev);
+	int	i, n = nr_torus_ports(priv);
+
+	get_drop_counters(priv->drop, data);
+	data += TORUS_DROPS;
+	for (i = 1; i < n; i++) {
+		get_torus_path(priv, i, data);
+		data += PORT_STATS;
+	}
+}
+
 const struct ethtool_ops torus_ethtool = {
 	.get_settings		= this_get_settings,
 	.get_drvinfo		= this_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
+	.get_sset_count		= this_get_sset_count,
+	.get_strings		= this_get_strings,
+	.get_ethtool_stats	= this_get_ethtool_stats,
 };
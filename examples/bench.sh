@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# bench.sh - time the creation and destruction of virtual toroids
+#
+# For each SIZE[xSIZE...] argument, this adds a virtual toroid then deletes
+# it and prints the number of nodes with the milliseconds of each.
+#
+# Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along
+#   with this program; if not, write to the Free Software Foundation, Inc.,
+#   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+prog=${0##*/}
+ip=${IP:-ip}
+name=tb0
+
+usage () {
+	cat <<-EOF
+	Usage: $prog [ --no-sysfs ] [ SIZE[xSIZE...] ... ]
+
+	default: 8x8 16x16 32x32 16x16x16
+	EOF
+}
+
+now_ms () {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-h | --help)
+			usage
+			exit 0
+			;;
+		--no-sysfs)
+			echo 0 >/sys/module/torus/parameters/node_sysfs
+			trap \
+			'echo 1 >/sys/module/torus/parameters/node_sysfs' \
+			EXIT
+			;;
+		*)	break;;
+	esac
+	shift
+done
+
+[ $# -eq 0 ] && set -- 8x8 16x16 32x32 16x16x16
+
+printf "%-12s %8s %10s %10s\n" SIZE NODES CREATE_MS DESTROY_MS
+for size in $@ ; do
+	declare -i nodes=1
+	for d in ${size//x/ } ; do
+		nodes=$(( nodes * d ))
+	done
+	start=$(now_ms)
+	$ip link add name $name type torus $size || exit 1
+	created=$(now_ms)
+	$ip link del $name || exit 1
+	destroyed=$(now_ms)
+	printf "%-12s %8d %10d %10d\n" $size $nodes \
+		$(( created - start )) $(( destroyed - created ))
+done
@@ -0,0 +1,97 @@
+#!/bin/bash
+
+# broadcast.sh - check that a broadcast reaches every node of a toroid
+#
+# This adds a virtual toroid of SIZE (default 4x4) named tb0, pings the
+# IPv4 broadcast of its first node COUNT times, then compares the received
+# packets of every other node with COUNT before deleting the toroid.  IPv6
+# is disabled on the nodes so that its multicasts don't add to the counts.
+#
+# Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along
+#   with this program; if not, write to the Free Software Foundation, Inc.,
+#   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ip () {
+	PATH=.:$PATH command ip $@
+}
+
+prog=${0##*/}
+name=tb0
+declare -i count=3
+
+usage () {
+	cat <<-EOF
+	Usage: $prog [ --count COUNT ] [ SIZE[xSIZE...] ]
+
+	default: 4x4
+	EOF
+}
+
+rx_packets () {
+	cat /sys/class/net/$1/statistics/rx_packets
+}
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-h | --help)
+			usage
+			exit 0
+			;;
+		--count)
+			count=$2
+			shift
+			;;
+		*)	break;;
+	esac
+	shift
+done
+
+size=${1:-4x4}
+declare -i nodes=1
+for d in ${size//x/ } ; do
+	nodes=$(( nodes * d ))
+done
+
+ip link add name $name type torus $size || exit 1
+trap "ip link del $name" EXIT
+
+declare -a node=( $name )
+for (( i = 1; i < nodes; i++ )) ; do
+	node[$i]=$name.$i
+done
+for te in ${node[@]} ; do
+	sysctl -q -w net.ipv6.conf.${te}.disable_ipv6=1
+	ip link set dev $te up
+done
+ip addr add 10.47.0.1/16 broadcast 10.47.255.255 dev $name
+
+declare -a before
+for (( i = 1; i < nodes; i++ )) ; do
+	before[$i]=$(rx_packets ${node[$i]})
+done
+ping -q -b -c $count -i 0.2 -w 2 -I $name 10.47.255.255 >/dev/null 2>&1
+
+declare -i missed=0
+for (( i = 1; i < nodes; i++ )) ; do
+	rx=$(( $(rx_packets ${node[$i]}) - before[$i] ))
+	if [ $rx -lt $count ] ; then
+		echo ${node[$i]}: received $rx of $count
+		missed+=1
+	fi
+done
+if [ $missed -gt 0 ] ; then
+	echo $prog: $missed of $(( nodes - 1 )) nodes missed the broadcast
+	exit 1
+fi
+echo $prog: $(( nodes - 1 )) nodes received $count broadcasts
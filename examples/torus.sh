@@ -67,7 +67,7 @@ show () {	# show [NETNS/]DEVICE ATTRIBUTE[:INDEX]
 	fi
 }
 
-start () {	# start [name NAME ][ MASTER ][ ROWSxCOLS ]
+start () {	# start [name NAME ][ MASTER ][ SIZE[xSIZE...] ]
 	if [ "$1" = "name" ] ; then
 		name="name $2"
 		shift 2
@@ -139,7 +139,7 @@ usage () {
 	fi
 	cat <<-EOF
 	Usage:	$prog [ --dry-run ] show DEVICE ATTRIBUTE[:ENTRY]
-	...	$prog [ --dry-run ] start [ name NAME ][ MASTER ][ ROWSxCOLS ]
+	...	$prog [ --dry-run ] start [ name NAME ][ MASTER ][ SIZE[xSIZE...] ]
 	...	$prog [ --dry-run ] stop [ PATTERN ]
 	...	$prog [ --dry-run ] store DEVICE ATTRIBUTE[:ENTRY] < VALUE | - >
 	EOF
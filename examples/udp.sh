@@ -0,0 +1,92 @@
+#!/bin/bash
+
+# udp.sh - peer two torus nodes over a routed underlay with torus_udp ports
+#
+# "start" makes name-spaces tu0 and tu1 joined by a veth underlay of
+# 10.47.1.0/24 and 10.47.2.0/24 routed through a third, tur, then gives
+# each a torus node, te0, with a torus_udp port to the other and an IPv6
+# address of NET; "ping" pings the second node from the first and "stop"
+# removes the lot.
+#
+# Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along
+#   with this program; if not, write to the Free Software Foundation, Inc.,
+#   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ip () {
+	PATH=.:$PATH command ip $@
+}
+
+prog=${0##*/}
+net="fd4d:ead4:3895:c142"
+
+usage () {
+	cat <<-EOF
+	Usage: $prog [ --net NET ] start | ping | stop
+	EOF
+}
+
+start () {
+	ip netns add tur
+	ip netns exec tur sysctl -q -w net.ipv4.ip_forward=1
+	for i in 0 1 ; do
+		ip netns add tu$i
+		ip link add u$i type veth peer name r$i
+		ip link set dev u$i netns tu$i
+		ip link set dev r$i netns tur
+		ip netns exec tur ip addr add 10.47.$((i + 1)).1/24 dev r$i
+		ip netns exec tur ip link set dev r$i up
+		ip netns exec tu$i ip addr add 10.47.$((i + 1)).2/24 dev u$i
+		ip netns exec tu$i ip link set dev u$i up
+		ip netns exec tu$i ip route add 10.47.0.0/16 via \
+			10.47.$((i + 1)).1
+	done
+	for i in 0 1 ; do
+		ip netns exec tu$i ip link add te0 \
+			address 02:00:00:00:00:0$((i + 1)) type torus
+		ip netns exec tu$i ip link add tp0 type torus_udp \
+			remote 10.47.$((2 - i)).2 local 10.47.$((i + 1)).2
+		ip netns exec tu$i ip link set dev tp0 master te0
+		ip netns exec tu$i ip link set dev tp0 up
+		ip netns exec tu$i ip -6 addr add ${net}::$((i + 1))/64 dev te0
+		ip netns exec tu$i ip link set dev te0 up
+	done
+}
+
+stop () {
+	for ns in tu0 tu1 tur ; do
+		ip netns del $ns
+	done
+}
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-h | --help)
+			usage
+			exit 0
+			;;
+		--net)	net=$2
+			shift
+			;;
+		start)	start
+			;;
+		ping)	ip netns exec tu0 ping6 -c 3 ${net}::2
+			;;
+		stop)	stop
+			;;
+		*)	usage
+			exit 1
+			;;
+	esac
+	shift
+done
@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# unicast.sh - check that unicast frames cross a toroid between two hosts
+#
+# This adds a virtual toroid of SIZE (default 4x4) named tb0, moves its
+# nodes 1 and 1 + NODES/2, at least two hops apart, to the name-spaces tu1
+# and tu2 with the addresses 10.47.0.1 and 10.47.0.2, then pings the second
+# from the first COUNT times before deleting the lot.  The replies only
+# arrive if each node delivers the frames to its host with their TTL and
+# virtual channel bits cleared.
+#
+# Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along
+#   with this program; if not, write to the Free Software Foundation, Inc.,
+#   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ip () {
+	PATH=.:$PATH command ip $@
+}
+
+prog=${0##*/}
+name=tb0
+declare -i count=3
+
+usage () {
+	cat <<-EOF
+	Usage: $prog [ --count COUNT ] [ SIZE[xSIZE...] ]
+
+	default: 4x4
+	EOF
+}
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-h | --help)
+			usage
+			exit 0
+			;;
+		--count)
+			count=$2
+			shift
+			;;
+		*)	break;;
+	esac
+	shift
+done
+
+size=${1:-4x4}
+declare -i nodes=1
+for d in ${size//x/ } ; do
+	nodes=$(( nodes * d ))
+done
+if [ $nodes -lt 4 ] ; then
+	echo $prog: $size has too few nodes >&2
+	exit 1
+fi
+
+ip link add name $name type torus $size || exit 1
+trap "ip netns del tu1; ip netns del tu2; ip link del $name" EXIT
+
+declare -a node=( $name.1 $name.$(( 1 + nodes / 2 )) )
+for i in 1 2 ; do
+	te=${node[$(( i - 1 ))]}
+	ip netns add tu$i
+	ip link set dev $te netns tu$i
+	ip netns exec tu$i sysctl -q -w net.ipv6.conf.${te}.disable_ipv6=1
+	ip netns exec tu$i ip addr add 10.47.0.$i/16 dev $te
+	ip netns exec tu$i ip link set dev $te up
+done
+for te in $name $(ls /sys/class/net | grep "^$name\.") ; do
+	ip link set dev $te up
+done
+
+if ! ip netns exec tu1 ping -q -c $count -i 0.2 -w 5 10.47.0.2 \
+	>/dev/null 2>&1 ; then
+	echo $prog: ${node[0]} failed to ping ${node[1]}
+	exit 1
+fi
+echo $prog: ${node[0]} pinged ${node[1]} $count times
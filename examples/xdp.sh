@@ -0,0 +1,134 @@
+#!/bin/bash
+#
+# xdp.sh - exercise XDP transit forwarding over veth pairs
+#
+# This makes a line of three nodes, ta - tb - tc, each in its own
+# name-space and peered with veth pairs.  The torus module targets kernels
+# older than XDP, so the nodes here are just their veth ports with torus
+# addresses, and xdp_torus_load reads each node's ports and lookup tables
+# from files under $dir rather than sysfs.  tb is the transit node between
+# ta and tc.  Use `check` to ping tc from ta and show the XDP counters of
+# tb, whose redirect count should then be non-zero.  This needs a kernel
+# with XDP redirect to veth, 4.19 or later; or 4.14 with -S.
+#
+# Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License along
+#   with this program; if not, write to the Free Software Foundation, Inc.,
+#   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+prog=${0##*/}
+op=usage
+mode=
+dir=/tmp/$prog
+net="fd4d:ead4:3895:c142"
+declare -A id=( [ta]=1 [tb]=2 [tc]=3 )
+declare -A port=( [ta]="ab" [tb]="ba bc" [tc]="cb" )
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-S)	mode=-S
+			;;
+		start | stop | check)
+			op=$1
+			;;
+		*)	op=usage
+			;;
+	esac
+	shift
+done
+
+# lladdr NODE [TTL], with TTL as set by init_torus_ttl() for the source
+lladdr () {
+	printf "%x2:00:00:00:%02x:00" ${2:-0} ${id[$1]}
+}
+
+# tables NODE [DEST PORT]..., write the ports and lu1...lu5 of NODE with
+# DEST's byte 4 routed to its PORT
+tables () {
+	declare -r node=$1
+	declare -a lu4
+	declare -i i
+	shift
+	mkdir -p $dir/$node
+	( echo $node ; for p in ${port[$node]} ; do echo $p ; done ) \
+		> $dir/$node/ports
+	for (( i = 0; i < 256; i++ )) ; do
+		lu4[$i]=0
+	done
+	while [ $# -gt 1 ] ; do
+		lu4[${id[$1]}]=$2
+		shift 2
+	done
+	for i in 1 2 3 5 ; do
+		yes 0 | head -256 > $dir/$node/lu$i
+	done
+	printf "%s\n" ${lu4[@]} > $dir/$node/lu4
+}
+
+load () {
+	ip netns exec $1 ./xdp_torus_load $mode -d $dir/$1 load $1
+}
+
+start () {
+	for te in ta tb tc ; do
+		ip netns add $te
+	done
+	ip link add ab netns ta type veth peer name ba netns tb
+	ip link add bc netns tb type veth peer name cb netns tc
+	ip netns exec ta ip link set dev ab address $(lladdr ta)
+	ip netns exec tc ip link set dev cb address $(lladdr tc)
+	# port 1 of ta and tc, ports 1 and 2 of tb
+	tables ta
+	tables tb ta 1 tc 2
+	tables tc
+	for te in ta tb tc ; do
+		for p in ${port[$te]} ; do
+			ip netns exec $te ip link set dev $p up
+		done
+	done
+	for te in ta tc ; do
+		p=${port[$te]}
+		ip netns exec $te ip -6 addr add ${net}::${id[$te]}/64 dev $p \
+			nodad
+	done
+	ip netns exec ta ip -6 neigh add ${net}::${id[tc]} \
+		lladdr $(lladdr tc 15) dev ab
+	ip netns exec tc ip -6 neigh add ${net}::${id[ta]} \
+		lladdr $(lladdr ta 15) dev cb
+	for te in ta tb tc ; do
+		load $te
+	done
+}
+
+stop () {
+	for te in ta tb tc ; do
+		ip netns exec $te ./xdp_torus_load -d $dir/$te unload $te
+		ip netns del $te
+	done
+	rm -rf $dir
+}
+
+check () {
+	ip netns exec ta ping6 -c 3 ${net}::${id[tc]}
+	ip netns exec tb ./xdp_torus_load show tb
+}
+
+usage () {
+	cat <<-EOF
+	Usage:	$prog [ -S ] start
+	...	$prog check
+	...	$prog stop
+	EOF
+}
+
+eval $op
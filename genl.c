@@ -0,0 +1,722 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <net/genetlink.h>
+#include <torus.h>
+
+#define	TORUS_GENL_PORTS_SZ	\
+	(TORUS_PORT_MAX * sizeof(struct torus_genl_port))
+#define	TORUS_GENL_ROUTES_SZ	\
+	(TORUS_RT_MAX * sizeof(struct torus_genl_route))
+#define	TORUS_GENL_BINDINGS_SZ	\
+	(TORUS_PROXY_MAX * sizeof(struct torus_genl_binding))
+#define	TORUS_GENL_LABELS_SZ	\
+	(TORUS_LABEL_MAX * sizeof(struct torus_genl_label))
+
+typedef int (*torus_genl_fill_t)(struct sk_buff *, struct net_device *,
+				 u32, u32, u32, int);
+
+static struct genl_family torus_genl = {
+	.id	 = GENL_ID_GENERATE,
+	.name	 = TORUS_GENL_NAME,
+	.version = TORUS_GENL_VERSION,
+	.maxattr = TORUS_GENL_LAST_ATTR,
+	.netnsok = true,
+};
+
+static struct genl_multicast_group torus_genl_peers = {
+	.name	 = TORUS_GENL_PEERS_GROUP,
+};
+
+static const struct nla_policy torus_genl_policy[TORUS_GENL_POLICIES] = {
+	[TORUS_GENL_IFINDEX_ATTR] = { .type = NLA_U32 },
+	[TORUS_GENL_GEN_ATTR]	  = { .type = NLA_U64 },
+	[TORUS_GENL_TBLS_ATTR]	  = { .type = NLA_U32 },
+	[TORUS_GENL_LU_ATTR]	  = { .type = NLA_BINARY, .len = TORUS_LU_SZ },
+	[TORUS_GENL_DELTA_ATTR]	  = { .type = NLA_BINARY },
+	[TORUS_GENL_MP_ATTR]	  = { .type = NLA_BINARY },
+	[TORUS_GENL_ROUTES_ATTR]  = { .type = NLA_BINARY,
+				      .len = TORUS_GENL_ROUTES_SZ },
+	[TORUS_GENL_BINDINGS_ATTR] = { .type = NLA_BINARY,
+				       .len = TORUS_GENL_BINDINGS_SZ },
+	[TORUS_GENL_LABELS_ATTR]  = { .type = NLA_BINARY,
+				      .len = TORUS_GENL_LABELS_SZ },
+};
+
+/*
+ * returns the held torus device of the IFINDEX attribute
+ */
+static struct net_device *torus_genl_dev(struct genl_info *info)
+{
+	struct	net_device *dev;
+
+	if (!info->attrs[TORUS_GENL_IFINDEX_ATTR])
+		return ERR_PTR(-EINVAL);
+	dev = dev_get_by_index(genl_info_net(info),
+			       nla_get_u32(info->attrs[TORUS_GENL_IFINDEX_ATTR]));
+	if (!dev)
+		return ERR_PTR(-ENODEV);
+	if (!is_torus(dev)) {
+		dev_put(dev);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+	return dev;
+}
+
+static int torus_genl_fill_lu(struct sk_buff *skb, struct net_device *dev,
+			      u32 tbls, u32 portid, u32 seq, int flags)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_genl_mp *mp;
+	struct	torus_lu *lu;
+	struct	nlattr *nla;
+	void	*hdr;
+	u8	*p;
+	u64	gen;
+	int	i, j, n;
+
+	hdr = genlmsg_put(skb, portid, seq, &torus_genl, flags,
+			  TORUS_CMD_GET_LU);
+	if (!hdr)
+		return -EMSGSIZE;
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex) ||
+	    nla_put_u32(skb, TORUS_GENL_TBLS_ATTR, tbls))
+		goto nla_put_failure;
+	nla = nla_reserve(skb, TORUS_GENL_LU_ATTR,
+			  hweight32(tbls) * TORUS_LU_TBL_ENTRIES);
+	if (!nla)
+		goto nla_put_failure;
+	p = nla_data(nla);
+	rcu_read_lock();
+	lu = rcu_dereference(priv->lu);
+	for (i = 0; i < TORUS_LU_TBLS; i++)
+		if (tbls & (1 << i)) {
+			memcpy(p, lu->tbl[i], TORUS_LU_TBL_ENTRIES);
+			p += TORUS_LU_TBL_ENTRIES;
+		}
+	gen = lu->gen;
+	for (i = 0, n = 0; i < TORUS_LU_TBLS; i++)
+		for (j = 0; (tbls & (1 << i)) && j < TORUS_LU_TBL_ENTRIES; j++)
+			if (lu->mp[i][j])
+				n++;
+	nla = n ? nla_reserve(skb, TORUS_GENL_MP_ATTR, n * sizeof(*mp)) : NULL;
+	for (i = 0, mp = nla ? nla_data(nla) : NULL; mp && i < TORUS_LU_TBLS;
+	     i++)
+		for (j = 0; (tbls & (1 << i)) && j < TORUS_LU_TBL_ENTRIES; j++)
+			if (lu->mp[i][j]) {
+				memset(mp, 0, sizeof(*mp));
+				mp->tbl = i;
+				mp->entry = j;
+				mp->n = lu->nhg[lu->mp[i][j]].n;
+				memcpy(mp->port, lu->nhg[lu->mp[i][j]].port,
+				       mp->n);
+				mp++;
+			}
+	rcu_read_unlock();
+	if ((n && !nla) || nla_put_u64(skb, TORUS_GENL_GEN_ATTR, gen))
+		goto nla_put_failure;
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int torus_genl_fill_ports(struct sk_buff *skb, struct net_device *dev,
+				 u32 UNUSED unused, u32 portid, u32 seq,
+				 int flags)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_genl_port *tgp;
+	struct	torus_ports *ports;
+	struct	nlattr *nla;
+	void	*hdr;
+	int	i;
+
+	hdr = genlmsg_put(skb, portid, seq, &torus_genl, flags,
+			  TORUS_CMD_GET_PORTS);
+	if (!hdr)
+		return -EMSGSIZE;
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex))
+		goto nla_put_failure;
+	/* the mutex keeps the peers consistent with their ports */
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	nla = nla_reserve(skb, TORUS_GENL_PORTS_ATTR, ports->n * sizeof(*tgp));
+	if (!nla) {
+		mutex_unlock(&priv->port_mutex);
+		goto nla_put_failure;
+	}
+	tgp = nla_data(nla);
+	for (i = 0; i < ports->n; i++, tgp++) {
+		memset(tgp, 0, sizeof(*tgp));
+		if (!ports->port[i].dev)
+			continue;
+		tgp->ifindex = ports->port[i].dev->ifindex;
+		memcpy(tgp->peer, ports->port[i].peer, TORUS_ALEN);
+	}
+	mutex_unlock(&priv->port_mutex);
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int torus_genl_fill_routes(struct sk_buff *skb, struct net_device *dev,
+				  u32 UNUSED unused, u32 portid, u32 seq,
+				  int flags)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_rt *rt;
+	void	*hdr;
+	int	err;
+
+	hdr = genlmsg_put(skb, portid, seq, &torus_genl, flags,
+			  TORUS_CMD_GET_ROUTES);
+	if (!hdr)
+		return -EMSGSIZE;
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex))
+		goto nla_put_failure;
+	rcu_read_lock();
+	rt = rcu_dereference(priv->rt);
+	err = nla_put(skb, TORUS_GENL_ROUTES_ATTR,
+		      rt ? rt->routes * sizeof(*rt->route) : 0,
+		      rt ? rt->route : NULL);
+	rcu_read_unlock();
+	if (err)
+		goto nla_put_failure;
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int torus_genl_fill_bindings(struct sk_buff *skb, struct net_device *dev,
+				    u32 UNUSED unused, u32 portid, u32 seq,
+				    int flags)
+{
+	struct	torus_genl_binding *b;
+	void	*hdr;
+	uint	n;
+
+	b = kmalloc(TORUS_GENL_BINDINGS_SZ, GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	n = get_torus_bindings(netdev_priv(dev), b, TORUS_PROXY_MAX);
+	hdr = genlmsg_put(skb, portid, seq, &torus_genl, flags,
+			  TORUS_CMD_GET_BINDINGS);
+	if (!hdr) {
+		kfree(b);
+		return -EMSGSIZE;
+	}
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex) ||
+	    nla_put(skb, TORUS_GENL_BINDINGS_ATTR, n * sizeof(*b), b)) {
+		kfree(b);
+		genlmsg_cancel(skb, hdr);
+		return -EMSGSIZE;
+	}
+	kfree(b);
+	return genlmsg_end(skb, hdr);
+}
+
+static int torus_genl_get(struct genl_info *info, torus_genl_fill_t fill,
+			  size_t size, u32 tbls)
+{
+	struct	net_device *dev;
+	struct	sk_buff *msg;
+	int	err;
+
+	dev = torus_genl_dev(info);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	msg = genlmsg_new(size, GFP_KERNEL);
+	if (!msg) {
+		dev_put(dev);
+		return -ENOMEM;
+	}
+	err = fill(msg, dev, tbls, info->snd_portid, info->snd_seq, 0);
+	dev_put(dev);
+	if (err < 0) {
+		nlmsg_free(msg);
+		return err;
+	}
+	return genlmsg_reply(msg, info);
+}
+
+/*
+ * One message per torus device of the name-space; cb->args[0] is the
+ * number of devices already sent.  The walk holds rtnl rather than RCU
+ * since the fill functions take the port mutex and allocate.  A device
+ * whose message doesn't fit even an empty skb ends the dump with the
+ * error rather than with nothing.
+ */
+static int torus_genl_dump(struct sk_buff *skb, struct netlink_callback *cb,
+			   torus_genl_fill_t fill)
+{
+	struct	net *net = sock_net(skb->sk);
+	struct	net_device *dev;
+	int	idx = 0, err = 0;
+
+	rtnl_lock();
+	for_each_netdev(net, dev) {
+		if (!is_torus(dev))
+			continue;
+		if (idx < cb->args[0]) {
+			idx++;
+			continue;
+		}
+		err = fill(skb, dev, TORUS_GENL_ALL_TBLS,
+			   NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			   NLM_F_MULTI);
+		if (err < 0)
+			break;
+		idx++;
+	}
+	rtnl_unlock();
+	cb->args[0] = idx;
+	return err < 0 && !skb->len ? err : skb->len;
+}
+
+static int torus_genl_get_lu(struct sk_buff UNUSED *skb,
+			     struct genl_info *info)
+{
+	u32	tbls = TORUS_GENL_ALL_TBLS;
+
+	if (info->attrs[TORUS_GENL_TBLS_ATTR])
+		tbls &= nla_get_u32(info->attrs[TORUS_GENL_TBLS_ATTR]);
+	return torus_genl_get(info, torus_genl_fill_lu,
+			      nla_total_size(TORUS_LU_SZ) +
+			      nla_total_size(TORUS_LU_SZ *
+					     sizeof(struct torus_genl_mp)) +
+			      NLMSG_GOODSIZE / 8, tbls);
+}
+
+static int torus_genl_dump_lu(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	return torus_genl_dump(skb, cb, torus_genl_fill_lu);
+}
+
+static int torus_genl_get_ports(struct sk_buff UNUSED *skb,
+				struct genl_info *info)
+{
+	return torus_genl_get(info, torus_genl_fill_ports,
+			      nla_total_size(TORUS_GENL_PORTS_SZ) +
+			      NLMSG_GOODSIZE / 8, 0);
+}
+
+static int torus_genl_fill_labels(struct sk_buff *skb, struct net_device *dev,
+				  u32 UNUSED unused, u32 portid, u32 seq,
+				  int flags)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_labels *labels;
+	void	*hdr;
+	int	err;
+
+	hdr = genlmsg_put(skb, portid, seq, &torus_genl, flags,
+			  TORUS_CMD_GET_LABELS);
+	if (!hdr)
+		return -EMSGSIZE;
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex))
+		goto nla_put_failure;
+	rcu_read_lock();
+	labels = rcu_dereference(priv->labels);
+	err = nla_put(skb, TORUS_GENL_LABELS_ATTR,
+		      labels ? labels->n * sizeof(*labels->label) : 0,
+		      labels ? labels->label : NULL);
+	rcu_read_unlock();
+	if (err)
+		goto nla_put_failure;
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int torus_genl_dump_ports(struct sk_buff *skb,
+				 struct netlink_callback *cb)
+{
+	return torus_genl_dump(skb, cb, torus_genl_fill_ports);
+}
+
+static int torus_genl_get_routes(struct sk_buff UNUSED *skb,
+				 struct genl_info *info)
+{
+	return torus_genl_get(info, torus_genl_fill_routes,
+			      nla_total_size(TORUS_GENL_ROUTES_SZ) +
+			      NLMSG_GOODSIZE / 8, 0);
+}
+
+/*
+ * ADD_ROUTES and DEL_ROUTES rebuild the route trie of a device from a
+ * copy of its routes with the changes of this request
+ */
+static int torus_genl_set_routes(struct sk_buff UNUSED *skb,
+				 struct genl_info *info)
+{
+	struct	nlattr *routes_attr = info->attrs[TORUS_GENL_ROUTES_ATTR];
+	struct	torus_genl_route *r = NULL;
+	struct	net_device *dev;
+	bool	del = info->genlhdr->cmd == TORUS_CMD_DEL_ROUTES;
+	int	n = 0, err;
+
+	if (routes_attr) {
+		if (nla_len(routes_attr) % sizeof(*r))
+			return -EINVAL;
+		r = nla_data(routes_attr);
+		n = nla_len(routes_attr) / sizeof(*r);
+	}
+	if (!del && !n)
+		return -EINVAL;
+	dev = torus_genl_dev(info);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	rtnl_lock();
+	err = set_torus_routes(netdev_priv(dev), r, n, del);
+	rtnl_unlock();
+	dev_put(dev);
+	return err;
+}
+
+static int torus_genl_get_bindings(struct sk_buff UNUSED *skb,
+				   struct genl_info *info)
+{
+	return torus_genl_get(info, torus_genl_fill_bindings,
+			      nla_total_size(TORUS_GENL_BINDINGS_SZ) +
+			      NLMSG_GOODSIZE / 8, 0);
+}
+
+static int torus_genl_set_bindings(struct sk_buff UNUSED *skb,
+				   struct genl_info *info)
+{
+	struct	nlattr *bindings_attr = info->attrs[TORUS_GENL_BINDINGS_ATTR];
+	struct	torus_genl_binding *b = NULL;
+	struct	net_device *dev;
+	bool	del = info->genlhdr->cmd == TORUS_CMD_DEL_BINDINGS;
+	int	n = 0, err;
+
+	if (bindings_attr) {
+		if (nla_len(bindings_attr) % sizeof(*b))
+			return -EINVAL;
+		b = nla_data(bindings_attr);
+		n = nla_len(bindings_attr) / sizeof(*b);
+	}
+	if (!del && !n)
+		return -EINVAL;
+	dev = torus_genl_dev(info);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	err = set_torus_bindings(netdev_priv(dev), b, n, del);
+	dev_put(dev);
+	return err;
+}
+
+static int torus_genl_get_labels(struct sk_buff UNUSED *skb,
+				 struct genl_info *info)
+{
+	return torus_genl_get(info, torus_genl_fill_labels,
+			      nla_total_size(TORUS_GENL_LABELS_SZ) +
+			      NLMSG_GOODSIZE / 8, 0);
+}
+
+/*
+ * ADD_LABELS and DEL_LABELS rebuild the label table of a device from a
+ * copy of its labels with the changes of this request
+ */
+static int torus_genl_set_labels(struct sk_buff UNUSED *skb,
+				 struct genl_info *info)
+{
+	struct	nlattr *labels_attr = info->attrs[TORUS_GENL_LABELS_ATTR];
+	struct	torus_genl_label *l = NULL;
+	struct	net_device *dev;
+	bool	del = info->genlhdr->cmd == TORUS_CMD_DEL_LABELS;
+	int	n = 0, err;
+
+	if (labels_attr) {
+		if (nla_len(labels_attr) % sizeof(*l))
+			return -EINVAL;
+		l = nla_data(labels_attr);
+		n = nla_len(labels_attr) / sizeof(*l);
+	}
+	if (!del && !n)
+		return -EINVAL;
+	dev = torus_genl_dev(info);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	rtnl_lock();
+	err = set_torus_labels(netdev_priv(dev), l, n, del);
+	rtnl_unlock();
+	dev_put(dev);
+	return err;
+}
+
+/*
+ * Replace the LU tables then apply the DELTA entries to a copy of the
+ * live set and publish the lot as one generation.  Only the entries that
+ * the request writes are checked against the ports; those it leaves may
+ * still name a port since removed.
+ */
+static int torus_genl_set_lu(struct sk_buff UNUSED *skb,
+			     struct genl_info *info)
+{
+	struct	nlattr *lu_attr = info->attrs[TORUS_GENL_LU_ATTR];
+	struct	nlattr *delta_attr = info->attrs[TORUS_GENL_DELTA_ATTR];
+	struct	nlattr *gen_attr = info->attrs[TORUS_GENL_GEN_ATTR];
+	struct	nlattr *mp_attr = info->attrs[TORUS_GENL_MP_ATTR];
+	struct	torus_genl_delta *delta = NULL;
+	struct	torus_genl_mp *mp = NULL;
+	struct	net_device *dev;
+	struct	torus *priv;
+	struct	torus_lu *lu;
+	struct	sk_buff *msg;
+	void	*hdr;
+	u8	*p = NULL;
+	u32	tbls = 0;
+	u64	gen;
+	u32	ifindex;
+	uint	nports;
+	int	i, j, n = 0, nmp = 0, err;
+
+	if (lu_attr) {
+		tbls = TORUS_GENL_ALL_TBLS;
+		if (info->attrs[TORUS_GENL_TBLS_ATTR])
+			tbls &= nla_get_u32(info->attrs[TORUS_GENL_TBLS_ATTR]);
+		if (nla_len(lu_attr) != hweight32(tbls) * TORUS_LU_TBL_ENTRIES)
+			return -EINVAL;
+		p = nla_data(lu_attr);
+	}
+	if (delta_attr) {
+		if (nla_len(delta_attr) % sizeof(*delta))
+			return -EINVAL;
+		delta = nla_data(delta_attr);
+		n = nla_len(delta_attr) / sizeof(*delta);
+		for (i = 0; i < n; i++)
+			if (delta[i].tbl >= TORUS_LU_TBLS)
+				return -ERANGE;
+	}
+	if (mp_attr) {
+		if (nla_len(mp_attr) % sizeof(*mp))
+			return -EINVAL;
+		mp = nla_data(mp_attr);
+		nmp = nla_len(mp_attr) / sizeof(*mp);
+		for (i = 0; i < nmp; i++)
+			if (mp[i].tbl >= TORUS_LU_TBLS ||
+			    mp[i].n > TORUS_NHG_PORTS)
+				return -ERANGE;
+	}
+	dev = torus_genl_dev(info);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	priv = netdev_priv(dev);
+	nports = nr_torus_ports(priv);
+	err = -ERANGE;
+	for (i = 0; p && i < hweight32(tbls) * TORUS_LU_TBL_ENTRIES; i++)
+		if (p[i] >= nports)
+			goto err_msg;
+	for (i = 0; i < n; i++)
+		if (delta[i].port >= nports)
+			goto err_msg;
+	msg = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!msg) {
+		err = -ENOMEM;
+		goto err_msg;
+	}
+	lu = begin_torus_lu(priv);
+	if (!lu) {
+		err = -ENOMEM;
+		goto err_lu;
+	}
+	if (gen_attr && nla_get_u64(gen_attr) != lu->gen) {
+		err = -EAGAIN;
+		goto err_abort;
+	}
+	for (i = 0; i < TORUS_LU_TBLS; i++)
+		if (tbls & (1 << i)) {
+			memcpy(lu->tbl[i], p, TORUS_LU_TBL_ENTRIES);
+			memset(lu->mp[i], 0, TORUS_LU_TBL_ENTRIES);
+			memset(lu->alt[i], 0, TORUS_LU_TBL_ENTRIES);
+			p += TORUS_LU_TBL_ENTRIES;
+		}
+	for (i = 0; i < n; i++) {
+		lu->tbl[delta[i].tbl][delta[i].entry] = delta[i].port;
+		lu->mp[delta[i].tbl][delta[i].entry] = 0;
+		lu->alt[delta[i].tbl][delta[i].entry] = 0;
+	}
+	for (i = 0; i < nmp; i++) {
+		for (j = 0; j < mp[i].n; j++)
+			if (mp[i].port[j] >= nports) {
+				err = -ERANGE;
+				goto err_abort;
+			}
+		err = set_torus_mp(lu, mp[i].tbl, mp[i].entry, mp[i].port,
+				   mp[i].n);
+		if (err < 0)
+			goto err_abort;
+	}
+	gen = commit_torus_lu(priv, lu);
+	ifindex = dev->ifindex;
+	dev_put(dev);
+	hdr = genlmsg_put_reply(msg, info, &torus_genl, 0, TORUS_CMD_SET_LU);
+	if (!hdr ||
+	    nla_put_u32(msg, TORUS_GENL_IFINDEX_ATTR, ifindex) ||
+	    nla_put_u64(msg, TORUS_GENL_GEN_ATTR, gen)) {
+		nlmsg_free(msg);
+		return -EMSGSIZE;
+	}
+	genlmsg_end(msg, hdr);
+	return genlmsg_reply(msg, info);
+
+err_abort:
+	abort_torus_lu(priv, lu);
+err_lu:
+	nlmsg_free(msg);
+err_msg:
+	dev_put(dev);
+	return err;
+}
+
+static struct genl_ops torus_genl_ops[] = {
+	{
+		.cmd	= TORUS_CMD_GET_LU,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_get_lu,
+		.dumpit	= torus_genl_dump_lu,
+	},
+	{
+		.cmd	= TORUS_CMD_SET_LU,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_lu,
+	},
+	{
+		.cmd	= TORUS_CMD_GET_PORTS,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_get_ports,
+		.dumpit	= torus_genl_dump_ports,
+	},
+	{
+		.cmd	= TORUS_CMD_ADD_ROUTES,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_routes,
+	},
+	{
+		.cmd	= TORUS_CMD_DEL_ROUTES,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_routes,
+	},
+	{
+		.cmd	= TORUS_CMD_GET_ROUTES,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_get_routes,
+	},
+	{
+		.cmd	= TORUS_CMD_ADD_BINDINGS,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_bindings,
+	},
+	{
+		.cmd	= TORUS_CMD_DEL_BINDINGS,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_bindings,
+	},
+	{
+		.cmd	= TORUS_CMD_GET_BINDINGS,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_get_bindings,
+	},
+	{
+		.cmd	= TORUS_CMD_ADD_LABELS,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_labels,
+	},
+	{
+		.cmd	= TORUS_CMD_DEL_LABELS,
+		.flags	= GENL_ADMIN_PERM,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_set_labels,
+	},
+	{
+		.cmd	= TORUS_CMD_GET_LABELS,
+		.policy	= torus_genl_policy,
+		.doit	= torus_genl_get_labels,
+	},
+};
+
+/*
+ * notify_torus_peer tells the "peers" group of the neighbor found or lost
+ * on a port of dev
+ */
+void notify_torus_peer(struct net_device *dev, uint port, const u8 *peer,
+		       bool up)
+{
+	struct	sk_buff *skb;
+	void	*hdr;
+
+	skb = genlmsg_new(2 * nla_total_size(sizeof(u32)) +
+			  nla_total_size(TORUS_ALEN) +
+			  nla_total_size(sizeof(u8)), GFP_KERNEL);
+	if (!skb)
+		return;
+	hdr = genlmsg_put(skb, 0, 0, &torus_genl, 0, TORUS_CMD_PEER);
+	if (!hdr)
+		goto nla_put_failure;
+	if (nla_put_u32(skb, TORUS_GENL_IFINDEX_ATTR, dev->ifindex) ||
+	    nla_put_u32(skb, TORUS_GENL_PORT_ATTR, port) ||
+	    nla_put(skb, TORUS_GENL_PEER_ATTR, TORUS_ALEN, peer) ||
+	    nla_put_u8(skb, TORUS_GENL_UP_ATTR, up))
+		goto nla_put_failure;
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast_netns(dev_net(dev), skb, 0, torus_genl_peers.id,
+				GFP_KERNEL);
+	return;
+
+nla_put_failure:
+	nlmsg_free(skb);
+}
+
+int register_torus_genl(void)
+{
+	int	err;
+
+	BUILD_BUG_ON(TORUS_GENL_TBLS != TORUS_LU_TBLS);
+	BUILD_BUG_ON(TORUS_GENL_TBL_ENTRIES != TORUS_LU_TBL_ENTRIES);
+	BUILD_BUG_ON(TORUS_GENL_MP_PORTS != TORUS_NHG_PORTS);
+	BUILD_BUG_ON(TORUS_GENL_ROUTES_MAX != TORUS_RT_MAX);
+	BUILD_BUG_ON(TORUS_GENL_BINDINGS_MAX != TORUS_PROXY_MAX);
+	BUILD_BUG_ON(TORUS_GENL_LABELS_MAX != TORUS_LABEL_MAX);
+	err = genl_register_family_with_ops(&torus_genl, torus_genl_ops,
+					    ARRAY_SIZE(torus_genl_ops));
+	if (err < 0)
+		return err;
+	err = genl_register_mc_group(&torus_genl, &torus_genl_peers);
+	if (err < 0)
+		genl_unregister_family(&torus_genl);
+	return err;
+}
+
+void unregister_torus_genl(void)
+{
+	genl_unregister_family(&torus_genl);
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <torus.h>
+#include <linux/pkt_sched.h>
+
+static void torus_hello_timer(unsigned long);
+static void torus_hello_work(struct work_struct *);
+
+int alloc_torus_hello(struct net_device *dev)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_neighbors *h;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	retonerr(h ? 0 : -ENOMEM, "alloc %s hello", dev->name);
+	h->neighbor = kcalloc(TORUS_PORT_CHUNK, sizeof(h->neighbor[0]),
+			      GFP_KERNEL);
+	if (!h->neighbor) {
+		kfree(h);
+		retonerr(-ENOMEM, "alloc %s neighbors", dev->name);
+	}
+	h->n = TORUS_PORT_CHUNK;
+	spin_lock_init(&h->lock);
+	setup_timer(&h->timer, torus_hello_timer, (ulong)dev);
+	INIT_WORK(&h->work, torus_hello_work);
+	h->dev = dev;
+	h->interval = TORUS_HELLO_MS;
+	priv->hello = h;
+	return 0;
+}
+
+void free_torus_hello(struct torus *priv)
+{
+	if (priv->hello)
+		kfree(priv->hello->neighbor);
+	kfree(priv->hello);
+	priv->hello = NULL;
+}
+
+/*
+ * grow_torus_neighbors makes room for the neighbors of n port records
+ * before add_torus_port() grows the records to that
+ */
+int grow_torus_neighbors(struct torus *priv, uint n)
+{
+	struct	torus_neighbors *h = priv->hello;
+	struct	torus_neighbor *neighbor, *old;
+
+	if (!h || n <= ACCESS_ONCE(h->n))
+		return 0;
+	neighbor = kcalloc(n, sizeof(*neighbor), GFP_KERNEL);
+	if (!neighbor)
+		return -ENOMEM;
+	spin_lock_bh(&h->lock);
+	old = h->neighbor;
+	memcpy(neighbor, old, h->n * sizeof(*neighbor));
+	h->neighbor = neighbor;
+	h->n = n;
+	spin_unlock_bh(&h->lock);
+	kfree(old);
+	return 0;
+}
+
+void start_torus_hello(struct torus *priv)
+{
+	struct	torus_neighbors *h = priv->hello;
+
+	if (h && ACCESS_ONCE(h->interval))
+		mod_timer(&h->timer, jiffies);
+}
+
+void stop_torus_hello(struct torus *priv)
+{
+	struct	torus_neighbors *h = priv->hello;
+
+	if (!h)
+		return;
+	del_timer_sync(&h->timer);
+	cancel_work_sync(&h->work);
+}
+
+/*
+ * reset_torus_neighbor forgets the peer of a new port i and starts timing
+ * its convergence
+ */
+void reset_torus_neighbor(struct torus *priv, int i)
+{
+	struct	torus_neighbors *h = priv->hello;
+	struct	torus_neighbor *n;
+
+	if (!h || i <= 0)
+		return;
+	spin_lock_bh(&h->lock);
+	if (i < h->n) {
+		n = &h->neighbor[i];
+		memset(n, 0, sizeof(*n));
+		n->added = torus_now();
+	}
+	spin_unlock_bh(&h->lock);
+}
+
+/*
+ * new_torus_hello_skb returns a broadcast frame from dev through port with
+ * room for len bytes of hello or LSA after its header
+ */
+struct sk_buff *new_torus_hello_skb(struct net_device *dev,
+				    struct net_device *port, uint len)
+{
+	struct	sk_buff *skb;
+	struct	ethhdr *e;
+	int	reserve = LL_RESERVED_SPACE(port);
+
+	skb = alloc_skb(reserve + ETH_HLEN + len, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, reserve);
+	skb_reset_mac_header(skb);
+	e = (struct ethhdr *)skb_put(skb, ETH_HLEN);
+	memset(e->h_dest, 0xff, ETH_ALEN);
+	memcpy(e->h_source, dev->dev_addr, ETH_ALEN);
+	e->h_proto = htons(TORUS_HELLO_PROTO);
+	skb_put(skb, len);
+	skb->protocol = htons(TORUS_HELLO_PROTO);
+	skb->priority = TC_PRIO_CONTROL;
+	skb->dev = port;
+	return skb;
+}
+
+static void send_torus_hello(struct net_device *dev, struct net_device *port,
+			     int i, uint interval, u32 seq)
+{
+	struct	sk_buff *skb;
+	struct	torus_hello *hello;
+
+	skb = new_torus_hello_skb(dev, port, sizeof(*hello));
+	if (!skb)
+		return;
+	hello = (struct torus_hello *)(skb->data + ETH_HLEN);
+	memset(hello, 0, sizeof(*hello));
+	hello->version = TORUS_HELLO_VERSION;
+	hello->type = TORUS_HELLO_TYPE;
+	hello->port = i;
+	hello->interval = htons(interval);
+	hello->seq = htonl(seq);
+	if (is_torus(port))
+		dev_forward_skb(port, skb);
+	else
+		dev_queue_xmit(skb);
+}
+
+/*
+ * Every interval, note the peers that have gone quiet then send a hello
+ * through each port; both only look as far as the port records go.
+ */
+static void torus_hello_timer(ulong data)
+{
+	struct	net_device *dev = (struct net_device *)data;
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_neighbors *h = priv->hello;
+	struct	torus_neighbor *n;
+	struct	torus_ports *ports;
+	struct	net_device *port;
+	uint	interval = ACCESS_ONCE(h->interval);
+	bool	pending = false;
+	u32	seq;
+	int	i;
+
+	if (!interval || !netif_running(dev))
+		return;
+	rcu_read_lock();
+	ports = rcu_dereference(priv->port);
+	spin_lock(&h->lock);
+	for (i = 1; i < min(ports->n, h->n); i++) {
+		n = &h->neighbor[i];
+		if (n->up && !n->pending && torus_neighbor_dead(n))
+			n->pending = pending = true;
+	}
+	seq = h->seq++;
+	spin_unlock(&h->lock);
+	if (pending)
+		schedule_work(&h->work);
+	for (i = 1; i < ports->n; i++)
+		if (port = torus_port_dev(ports, i), port)
+			send_torus_hello(dev, port, i, interval, seq);
+	rcu_read_unlock();
+	mod_timer(&h->timer, jiffies + msecs_to_jiffies(interval));
+}
+
+/*
+ * ndo_rx() gives hellos to recv_torus_hello() to note the peer of the
+ * receiving port.  A hello from a nested or virtual torus port arrives on
+ * dev itself, so its port is the one of the sending device.  LSAs share
+ * the protocol and go on to recv_torus_lsa().
+ */
+void recv_torus_hello(struct torus *priv, struct net_device *dev,
+		      struct sk_buff *skb)
+{
+	struct	torus_neighbors *h = priv->hello;
+	struct	ethhdr *e = eth_hdr(skb);
+	struct	torus_hello *hello;
+	struct	torus_neighbor *n;
+	struct	torus_ports *ports;
+	struct	net_device *port;
+	bool	pending = false;
+	int	i;
+
+	if (!h || !pskb_may_pull(skb, sizeof(*hello)))
+		return;
+	hello = (struct torus_hello *)skb->data;
+	if (hello->version != TORUS_HELLO_VERSION)
+		return;
+	if (hello->type == TORUS_LSA_TYPE) {
+		recv_torus_lsa(priv, dev, skb);
+		return;
+	}
+	if (hello->type != TORUS_HELLO_TYPE || !hello->interval)
+		return;
+	if (skb->dev != dev)
+		i = (long)rcu_dereference(skb->dev->rx_handler_data);
+	else {
+		ports = rcu_dereference(priv->port);
+		for (i = ports->n - 1; i > 0; i--)
+			if (port = torus_port_dev(ports, i), is_torus(port) &&
+			    ether_addr_equal(port->dev_addr, e->h_source))
+				break;
+	}
+	if (i <= 0)
+		return;
+	spin_lock(&h->lock);
+	if (i >= h->n) {
+		spin_unlock(&h->lock);
+		return;
+	}
+	n = &h->neighbor[i];
+	n->heard = jiffies;
+	n->interval = msecs_to_jiffies(ntohs(hello->interval)) ? : 1;
+	if (!n->up || !ether_addr_equal(n->addr, e->h_source)) {
+		memcpy(n->addr, e->h_source, TORUS_ALEN);
+		if (!n->pending)
+			n->pending = pending = true;
+	}
+	spin_unlock(&h->lock);
+	if (pending)
+		schedule_work(&h->work);
+}
+
+/*
+ * Set the peer of port i and route to it by the first byte of its address
+ * unlike this node's; or clear the peer of a lost neighbor.
+ */
+static void publish_torus_neighbor(struct torus *priv, int i, const u8 *addr,
+				   bool up)
+{
+	struct	net_device *dev = priv->dev;
+	struct	torus_ports *ports;
+	struct	torus_lu *lu;
+	u8	*peer;
+	int	k;
+
+	mutex_lock(&priv->port_mutex);
+	if (lu = begin_torus_lu(priv), !lu) {
+		mutex_unlock(&priv->port_mutex);
+		pr_torus_err("%s: no memory for lookup tables", dev->name);
+		return;
+	}
+	ports = torus_ports_locked(priv);
+	if (i >= ports->n || !ports->port[i].dev) {
+		abort_torus_lu(priv, lu);
+		mutex_unlock(&priv->port_mutex);
+		return;
+	}
+	peer = ports->port[i].peer;
+	if (!up) {
+		memset(peer, 0, TORUS_ALEN);
+		abort_torus_lu(priv, lu);
+	} else {
+		memcpy(peer, addr, TORUS_ALEN);
+		for (k = 1; k < TORUS_ALEN; k++)
+			if (addr[k] != dev->dev_addr[k])
+				break;
+		if (k < TORUS_ALEN) {
+			TORUS_LU(lu, addr, k - 1) = i;
+			TORUS_MP(lu, addr, k - 1) = 0;
+			TORUS_ALT(lu, addr, k - 1) = 0;
+		}
+		commit_torus_lu(priv, lu);
+	}
+	mutex_unlock(&priv->port_mutex);
+	update_torus_coord(priv);
+	notify_torus_peer(dev, i, addr, up);
+}
+
+static void torus_hello_work(struct work_struct *work)
+{
+	struct	torus_neighbors *h = container_of(work, struct torus_neighbors,
+						  work);
+	struct	torus *priv = netdev_priv(h->dev);
+	struct	torus_neighbor *n;
+	u8	addr[TORUS_ALEN];
+	bool	up, published = false;
+	u64	ns;
+	uint	i, nports = nr_torus_ports(priv);
+
+	for (i = 1; i < nports; i++) {
+		spin_lock_bh(&h->lock);
+		if (i >= h->n || !h->neighbor[i].pending) {
+			spin_unlock_bh(&h->lock);
+			continue;
+		}
+		n = &h->neighbor[i];
+		n->pending = false;
+		up = n->heard && !torus_neighbor_dead(n);
+		n->up = up;
+		memcpy(addr, n->addr, TORUS_ALEN);
+		if (up && n->added) {
+			ns = torus_now() - n->added;
+			n->added = 0;
+			h->converged++;
+			h->latest = ns;
+			h->total += ns;
+			if (ns > h->longest)
+				h->longest = ns;
+		}
+		spin_unlock_bh(&h->lock);
+		publish_torus_neighbor(priv, i, addr, up);
+		published = true;
+	}
+	if (published)
+		originate_torus_lsa(priv);
+}
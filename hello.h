@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_HELLO_H__
+#define __TORUS_HELLO_H__
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/torus.h>
+#include <addr.h>
+
+/*
+ * The receive hook and timer only note what they hear, or stop hearing,
+ * as pending; the work then publishes the peer[] and lookup table changes
+ * and notifications since those may sleep.
+ */
+struct	torus_neighbor {
+	/*
+	 * addr is of the last hello heard, at jiffy heard, from a peer
+	 * sending every interval jiffies
+	 */
+	u8		addr[TORUS_ALEN];
+	bool		up;
+	bool		pending;
+	ulong		heard;
+	ulong		interval;
+	/*
+	 * added is the time of the port's add, until it converges
+	 */
+	u64		added;
+};
+
+struct	torus_neighbors {
+	struct	net_device *dev;
+	spinlock_t	lock;
+	struct	timer_list timer;
+	struct	work_struct work;
+	/*
+	 * interval is in milliseconds, 0 disables the hellos
+	 */
+	uint		interval;
+	u32		seq;
+	/*
+	 * converged counts the ports that have learned their first peer;
+	 * latest, longest and total are the nanoseconds from their add
+	 */
+	u64		converged;
+	u64		latest;
+	u64		longest;
+	u64		total;
+	/*
+	 * neighbor[] has an entry for each of n port records, it grows with
+	 * them and is only replaced with lock held
+	 */
+	uint		n;
+	struct	torus_neighbor	*neighbor;
+};
+
+static inline bool is_torus_hello(const struct sk_buff *skb)
+{
+	return skb->protocol == htons(TORUS_HELLO_PROTO);
+}
+
+static inline bool torus_neighbor_dead(const struct torus_neighbor *n)
+{
+	return time_after(jiffies, n->heard + TORUS_HELLO_DEAD * n->interval);
+}
+
+#endif	/* __TORUS_HELLO_H__ */
@@ -10,6 +10,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <net/if.h>
 #include <utils.h>
@@ -17,32 +18,66 @@
 #include <linux/torus.h>
 
 #define	USAGE								\
-	"Usage:	... torus [ MASTER ] [ ROWSxCOLS ]\n"			\
+	"Usage:	... torus [ MASTER ] [ SIZE[xSIZE...] ] [ queues QUEUES ]\n"\
 	"\n"								\
-	"ROWS 	:= %d..%d\n"						\
-	"COLS 	:= %d..%d\n"						\
-	, TORUS_MIN_ROWS, TORUS_MAX_ROWS				\
-	, TORUS_MIN_COLS, TORUS_MAX_COLS
+	"SIZE	:= %d..%d, of up to %d dimensions and %d nodes\n"	\
+	"QUEUES	:= %d..%d, default: one per online cpu\n"		\
+	, TORUS_MIN_SIZE, TORUS_MAX_SIZE				\
+	, TORUS_MAX_DIMS, TORUS_MAX_NODES				\
+	, TORUS_MIN_QUEUES, TORUS_MAX_QUEUES
 
 #define	MAXLEN	1024
 
+/*
+ * parse_torus_dims returns the number of dimensions of a SIZExSIZE...
+ * argument, with their sizes in size[]; or 0 if arg isn't one.
+ */
+static int parse_torus_dims(const char *arg, __u16 *size)
+{
+	unsigned long nodes = 1, u;
+	const char *s = arg;
+	char	*end;
+	int	dims = 0;
+
+	if (!strchr(arg, 'x'))
+		return 0;
+	do {
+		if (dims == TORUS_MAX_DIMS)
+			invarg("too many dimensions", arg);
+		u = strtoul(s, &end, 10);
+		if (end == s || (*end && *end != 'x') ||
+		    u < TORUS_MIN_SIZE || u > TORUS_MAX_SIZE)
+			invarg("out of range", arg);
+		size[dims++] = u;
+		nodes *= u;
+		s = end + 1;
+	} while (*end);
+	if (nodes > TORUS_MAX_NODES)
+		invarg("too many nodes", arg);
+	return dims;
+}
+
 static int parse_torus(struct link_util *lu, int argc, char **argv,
 		       struct nlmsghdr *hdr)
 {
-	__u32 rows = 0, cols = 0;
+	__u32 queues = 0;
+	__u16 size[TORUS_MAX_DIMS];
 	const char *master = NULL;
+	int dims = 0;
 
 	while (argc) {
 		if (!strcmp(*argv, "help")) {
 			fprintf(stdout, USAGE);
 			return -1;
 		}
-		if (sscanf(*argv, "%ux%u", &rows, &cols) == 2) {
-			if (rows < TORUS_MIN_ROWS ||
-			    rows > TORUS_MAX_ROWS ||
-			    cols < TORUS_MIN_COLS ||
-			    cols > TORUS_MAX_COLS)
+		if (!strcmp(*argv, "queues")) {
+			NEXT_ARG();
+			if (get_u32(&queues, *argv, 0) ||
+			    queues < TORUS_MIN_QUEUES ||
+			    queues > TORUS_MAX_QUEUES)
 				invarg("out of range", *argv);
+		} else if (strchr(*argv, 'x')) {
+			dims = parse_torus_dims(*argv, size);
 		} else
 			master = *argv;
 		argv++, --argc;
@@ -50,10 +85,14 @@ static int parse_torus(struct link_util *lu, int argc, char **argv,
 	addattr32(hdr, MAXLEN, TORUS_VERSION_ATTR, TORUS_VERSION);
 	if (master)
 		addattrstrz(hdr, MAXLEN, TORUS_MASTER_ATTR, master);
-	if (rows) {
-		addattr32(hdr, MAXLEN, TORUS_ROWS_ATTR, rows);
-		addattr32(hdr, MAXLEN, TORUS_COLS_ATTR, cols);
-	}
+	if (dims == 2) {
+		addattr32(hdr, MAXLEN, TORUS_ROWS_ATTR, size[0]);
+		addattr32(hdr, MAXLEN, TORUS_COLS_ATTR, size[1]);
+	} else if (dims)
+		addattr_l(hdr, MAXLEN, TORUS_DIMS_ATTR, size,
+			  dims * sizeof(*size));
+	if (queues)
+		addattr32(hdr, MAXLEN, TORUS_QUEUES_ATTR, queues);
 	return 0;
 }
 
@@ -61,3 +100,58 @@ struct link_util torus_link_util = {
 	.id = "torus",
 	.parse_opt = parse_torus
 };
+
+#define	UDP_USAGE							\
+	"Usage:	... torus_udp remote ADDR [ local ADDR ] [ port PORT ]\n"\
+	"		[ ttl TTL ]\n"					\
+	"\n"								\
+	"PORT	:= default: %d, the same at both ends\n"		\
+	"TTL	:= 1..255, default: the system's\n"			\
+	, TORUS_UDP_PORT
+
+static int parse_torus_udp(struct link_util *lu, int argc, char **argv,
+			   struct nlmsghdr *hdr)
+{
+	__u32 local = 0, remote = 0;
+	__u16 port = 0;
+	__u8 ttl = 0;
+
+	while (argc) {
+		if (!strcmp(*argv, "help")) {
+			fprintf(stdout, UDP_USAGE);
+			return -1;
+		}
+		if (!strcmp(*argv, "remote")) {
+			NEXT_ARG();
+			remote = get_addr32(*argv);
+		} else if (!strcmp(*argv, "local")) {
+			NEXT_ARG();
+			local = get_addr32(*argv);
+		} else if (!strcmp(*argv, "port")) {
+			NEXT_ARG();
+			if (get_u16(&port, *argv, 0) || !port)
+				invarg("out of range", *argv);
+		} else if (!strcmp(*argv, "ttl")) {
+			NEXT_ARG();
+			if (get_u8(&ttl, *argv, 0) || !ttl)
+				invarg("out of range", *argv);
+		} else
+			invarg("unknown", *argv);
+		argv++, --argc;
+	}
+	if (!remote)
+		missarg("remote");
+	addattr32(hdr, MAXLEN, TORUS_UDP_REMOTE_ATTR, remote);
+	if (local)
+		addattr32(hdr, MAXLEN, TORUS_UDP_LOCAL_ATTR, local);
+	if (port)
+		addattr16(hdr, MAXLEN, TORUS_UDP_PORT_ATTR, port);
+	if (ttl)
+		addattr8(hdr, MAXLEN, TORUS_UDP_TTL_ATTR, ttl);
+	return 0;
+}
+
+struct link_util torus_udp_link_util = {
+	.id = "torus_udp",
+	.parse_opt = parse_torus_udp
+};
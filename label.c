@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <linux/log2.h>
+#include <torus.h>
+
+static int check_torus_label(const struct torus_genl_label *l, bool del)
+{
+	if (l->label >> (32 - TORUS_LABEL_SHIFT))
+		return -EINVAL;
+	if (del)
+		return 0;
+	if (l->action == TORUS_GENL_LABEL_SWAP)
+		return l->port && !(l->out >> (32 - TORUS_LABEL_SHIFT))
+			? 0 : -EINVAL;
+	return l->action == TORUS_GENL_LABEL_POP ? 0 : -EINVAL;
+}
+
+/*
+ * new_torus_labels returns the hash table of the n labels of l
+ */
+static struct torus_labels *new_torus_labels(const struct torus_genl_label *l,
+					     uint n)
+{
+	struct	torus_labels *labels;
+	struct	torus_label_entry *e;
+	uint	bits = order_base_2(2 * n), mask = (1 << bits) - 1;
+	uint	i, j;
+
+	labels = kzalloc(sizeof(*labels) + (sizeof(*e) << bits) +
+			 (n * sizeof(*l)), GFP_KERNEL);
+	if (!labels)
+		return NULL;
+	labels->bits = bits;
+	labels->n = n;
+	labels->label = (struct torus_genl_label *)&labels->tbl[mask + 1];
+	memcpy(labels->label, l, n * sizeof(*l));
+	for (i = 0; i < n; i++) {
+		j = hash_32(l[i].label, bits);
+		while (labels->tbl[j].action)
+			j = (j + 1) & mask;
+		e = &labels->tbl[j];
+		e->label = l[i].label;
+		e->out = l[i].out;
+		e->port = l[i].port;
+		e->action = l[i].action;
+	}
+	return labels;
+}
+
+/*
+ * set_torus_labels adds, replaces or, with del, removes the n labels of l;
+ * del without any removes them all.  This must be called with rtnl held.
+ */
+int set_torus_labels(struct torus *priv, const struct torus_genl_label *l,
+		     uint n, bool del)
+{
+	struct	torus_labels *old, *labels = NULL;
+	struct	torus_genl_label *label;
+	uint	i, j, count = 0;
+	int	err;
+
+	label = kmalloc(TORUS_LABEL_MAX * sizeof(*label), GFP_KERNEL);
+	retonerr(label ? 0 : -ENOMEM, "alloc labels");
+	old = rtnl_dereference(priv->labels);
+	if (old && (n || !del)) {
+		count = old->n;
+		memcpy(label, old->label, count * sizeof(*label));
+	}
+	for (i = 0; i < n; i++) {
+		if (err = check_torus_label(&l[i], del), err < 0)
+			goto out;
+		for (j = 0; j < count && label[j].label != l[i].label; j++)
+			;
+		if (del) {
+			if (j < count)
+				label[j] = label[--count];
+		} else if (j < count)
+			label[j] = l[i];
+		else if (count < TORUS_LABEL_MAX)
+			label[count++] = l[i];
+		else {
+			err = -ENOSPC;
+			goto out;
+		}
+	}
+	if (count && (labels = new_torus_labels(label, count), !labels)) {
+		err = -ENOMEM;
+		goto out;
+	}
+	rcu_assign_pointer(priv->labels, labels);
+	if (old)
+		kfree_rcu(old, rcu);
+	err = 0;
+out:
+	kfree(label);
+	return err;
+}
+
+/*
+ * torus_label_hop returns the device of port i of a switched frame after
+ * addressing it to the peer on that port, if known
+ */
+static struct net_device *torus_label_hop(struct torus *priv,
+					  const struct torus_ports *ports,
+					  struct sk_buff *skb, uint i)
+{
+	struct	net_device *port = torus_port_dev(ports, i);
+
+	if (!port)
+		return NULL;
+	if (!is_zero_ether_addr(ports->port[i].peer))
+		memcpy(eth_hdr(skb)->h_dest, ports->port[i].peer, ETH_ALEN);
+	count_torus_path_tx(priv, i, skb->len);
+	return port;
+}
+
+/*
+ * switch_torus_label swaps or pops the top label of the MPLS frame in skb,
+ * with data at its label stack after the ethernet header, and returns the
+ * device of the out port; or that of the node itself once it pops the last
+ * label, to deliver the IP frame to its host.  Otherwise it returns NULL
+ * with the drop reason.  This must be called within rcu_read_lock().
+ */
+struct net_device *switch_torus_label(struct torus *priv, struct sk_buff *skb,
+				      uint *reason)
+{
+	const	struct torus_label_entry *e;
+	struct	torus_labels *labels = rcu_dereference(priv->labels);
+	struct	torus_ports *ports = rcu_dereference(priv->port);
+	__be32	*h;
+	__be16	proto;
+	u32	v, ttl;
+	int	pops;
+
+	*reason = TORUS_DROP_NO_ROUTE;
+	if (!labels || skb_cow(skb, 0))
+		return NULL;
+	for (pops = 0; pops < TORUS_LABEL_POPS; pops++) {
+		if (!pskb_may_pull(skb, sizeof(*h)))
+			return NULL;
+		h = (__be32 *)skb->data;
+		v = ntohl(*h);
+		if (e = lookup_torus_label(labels, v >> TORUS_LABEL_SHIFT), !e)
+			return NULL;
+		if (ttl = v & TORUS_LABEL_TTL, ttl <= 1) {
+			*reason = TORUS_DROP_TTL;
+			return NULL;
+		}
+		if (e->action == TORUS_GENL_LABEL_SWAP) {
+			*h = htonl((e->out << TORUS_LABEL_SHIFT) |
+				   (v & (TORUS_LABEL_TC | TORUS_LABEL_BOS)) |
+				   (ttl - 1));
+			return torus_label_hop(priv, ports, skb, e->port);
+		}
+		/* pop the label from under the ethernet header */
+		memmove(skb->data - ETH_HLEN + sizeof(*h),
+			skb->data - ETH_HLEN, ETH_HLEN);
+		__skb_pull(skb, sizeof(*h));
+		skb_set_mac_header(skb, -ETH_HLEN);
+		skb_reset_network_header(skb);
+		if (v & TORUS_LABEL_BOS) {
+			if (!pskb_may_pull(skb, 1))
+				return NULL;
+			if (skb->data[0] >> 4 == 4)
+				proto = htons(ETH_P_IP);
+			else if (skb->data[0] >> 4 == 6)
+				proto = htons(ETH_P_IPV6);
+			else
+				return NULL;
+			eth_hdr(skb)->h_proto = skb->protocol = proto;
+			if (e->port)
+				return torus_label_hop(priv, ports, skb,
+						       e->port);
+			memcpy(eth_hdr(skb)->h_dest, priv->dev->dev_addr,
+			       ETH_ALEN);
+			skb->pkt_type = PACKET_HOST;
+			return priv->dev;
+		}
+		/* the next label carries on the TTL */
+		if (!pskb_may_pull(skb, sizeof(*h)))
+			return NULL;
+		h = (__be32 *)skb->data;
+		*h = htonl((ntohl(*h) & ~TORUS_LABEL_TTL) | (ttl - 1));
+		if (e->port)
+			return torus_label_hop(priv, ports, skb, e->port);
+	}
+	return NULL;
+}
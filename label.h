@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __TORUS_LABEL_H__
+#define __TORUS_LABEL_H__
+
+#include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/torus.h>
+
+#define	TORUS_LABEL_MAX		1024
+/*
+ * the most labels that a node pops from one frame before it forwards it
+ */
+#define	TORUS_LABEL_POPS	4
+/*
+ * a label stack entry is LABEL:20 TC:3 S:1 TTL:8 in network byte order
+ */
+#define	TORUS_LABEL_SHIFT	12
+#define	TORUS_LABEL_TC		0xe00
+#define	TORUS_LABEL_BOS		0x100
+#define	TORUS_LABEL_TTL		0xff
+
+/*
+ * An entry is empty without an action; several fit a cache line.
+ */
+struct	torus_label_entry {
+	u32	label;
+	u32	out;
+	u8	port;
+	u8	action;
+};
+
+/*
+ * The label table is an open addressed hash of twice as many entries as
+ * labels or more, so an exact match probes few and always ends at an empty
+ * entry.  Like the route trie, it's rebuilt whole from the labels with
+ * each change then replaces the old; label points past tbl[] to these.
+ */
+struct	torus_labels {
+	struct	rcu_head	rcu;
+	uint			bits;
+	uint			n;
+	struct	torus_genl_label *label;
+	struct	torus_label_entry tbl[0];
+};
+
+static inline const struct torus_label_entry *
+lookup_torus_label(const struct torus_labels *labels, u32 label)
+{
+	const	struct torus_label_entry *e;
+	uint	mask = (1 << labels->bits) - 1;
+	uint	i;
+
+	for (i = hash_32(label, labels->bits); ; i = (i + 1) & mask) {
+		e = &labels->tbl[i];
+		if (!e->action || e->label == label)
+			return e->action ? e : NULL;
+	}
+}
+
+#endif	/* __TORUS_LABEL_H__ */
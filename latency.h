@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_LATENCY_H__
+#define __TORUS_LATENCY_H__
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+
+/*
+ * Bucket b of a latency histogram counts the frames that took 2^b through
+ * 2^(b+1) - 1 nanoseconds, the last bucket counts everything longer.
+ */
+#define	TORUS_LATENCY_BUCKETS	32
+
+/*
+ * fwd has the time from ndo_rx() to dev_queue_xmit() or dev_forward_skb()
+ * of all transit frames and port[i] that of those sent through port i;
+ * e2e has the time from ndo_tx() at the source to delivery by this node.
+ * Each cpu increments its own so the writes need neither lock nor sync.
+ * There are histograms for the first ports of port[], each cpu's copy of
+ * ports has the same number.
+ */
+struct	torus_latency {
+	uint	ports;
+	ulong	e2e[TORUS_LATENCY_BUCKETS];
+	ulong	fwd[TORUS_LATENCY_BUCKETS];
+	ulong	port[0][TORUS_LATENCY_BUCKETS];
+};
+
+/*
+ * A frame carries its time stamps at the end of skb->cb, clear of the
+ * qdisc_skb_cb at the front; rx is when this node received it and src when
+ * the source node sent it.  Either is 0 if unknown.  src only survives
+ * within one kernel, i.e. through nested torus ports, so a frame from any
+ * other port has it reset.  Likewise, in is the index of the physical port
+ * that received the frame, or 0, and dim the dimension of its last hop
+ * within one kernel, or -1; these find the virtual channel of its next.
+ */
+struct	torus_skb_cb {
+	u8	in;
+	s8	dim;
+	u64	rx;
+	u64	src;
+} __packed;
+
+#define	TORUS_SKB_CB(skb)						\
+	((struct torus_skb_cb *)((skb)->cb + sizeof((skb)->cb) -	\
+				 sizeof(struct torus_skb_cb)))
+
+static inline u64 torus_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+/*
+ * torus_port_index returns the index of port in the port[] of dev; the
+ * rx_handler_data of a physical port is its index and port[0] is dev
+ * itself.  A nested torus port has no such index so it's -1.
+ */
+static inline int torus_port_index(const struct net_device *dev,
+				   const struct net_device *port)
+{
+	if (port == dev)
+		return 0;
+	if (!port || port->netdev_ops == dev->netdev_ops)
+		return -1;
+	return (long)rcu_dereference_check(port->rx_handler_data,
+					   rcu_read_lock_bh_held());
+}
+
+/*
+ * A per cpu allocation is at most PCPU_MIN_UNIT_SIZE, so there are only
+ * histograms for the first TORUS_LATENCY_PORTS ports
+ */
+#define	TORUS_LATENCY_PORTS						\
+	((PCPU_MIN_UNIT_SIZE - sizeof(struct torus_latency)) /		\
+	 sizeof(((struct torus_latency *)0)->port[0]))
+
+static inline struct torus_latency __percpu *alloc_torus_latency(uint ports)
+{
+	struct	torus_latency __percpu *p;
+	int	cpu;
+
+	ports = min_t(uint, ports, TORUS_LATENCY_PORTS);
+	p = __alloc_percpu(sizeof(struct torus_latency) + ports *
+			   sizeof(((struct torus_latency *)0)->port[0]),
+			   SMP_CACHE_BYTES);
+	if (p)
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(p, cpu)->ports = ports;
+	return p;
+}
+
+static inline uint torus_latency_ports(struct torus_latency __percpu *p)
+{
+	return p ? per_cpu_ptr(p, raw_smp_processor_id())->ports : 0;
+}
+
+/*
+ * reset_torus_latency clears all of the histograms
+ */
+static inline void reset_torus_latency(struct torus_latency __percpu *p)
+{
+	struct	torus_latency *h;
+	int	cpu;
+
+	for_each_possible_cpu(cpu) {
+		h = per_cpu_ptr(p, cpu);
+		memset(h->e2e, 0, sizeof(*h) -
+		       offsetof(struct torus_latency, e2e) +
+		       h->ports * sizeof(h->port[0]));
+	}
+}
+
+static inline uint torus_latency_bucket(u64 since, u64 now)
+{
+	u64	ns = now > since ? now - since : 0;
+
+	return ns ? min_t(uint, fls64(ns) - 1, TORUS_LATENCY_BUCKETS - 1) : 0;
+}
+
+/*
+ * count_torus_fwd adds the time since the receipt of a transit frame to
+ * the histograms of all ports and of port i, if it has one
+ */
+static inline void count_torus_fwd(struct torus_latency __percpu *p,
+				   int i, u64 since)
+{
+	uint	b;
+
+	if (!p || !since)
+		return;
+	b = torus_latency_bucket(since, torus_now());
+	this_cpu_inc(p->fwd[b]);
+	if (i > 0 && i < this_cpu_read(p->ports))
+		this_cpu_inc(p->port[i][b]);
+}
+
+static inline void count_torus_e2e(struct torus_latency __percpu *p,
+				   u64 since)
+{
+	if (!p || !since)
+		return;
+	this_cpu_inc(p->e2e[torus_latency_bucket(since, torus_now())]);
+}
+
+/*
+ * get_torus_latency sums the cpus' buckets of the histogram at offset
+ * into struct torus_latency to v[TORUS_LATENCY_BUCKETS]
+ */
+static inline void get_torus_latency(struct torus_latency __percpu *p,
+				     size_t offset, u64 *v)
+{
+	const	ulong *h;
+	int	cpu, b;
+
+	for (b = 0; b < TORUS_LATENCY_BUCKETS; b++)
+		v[b] = 0ULL;
+	if (!p)
+		return;
+	for_each_possible_cpu(cpu) {
+		h = (const ulong *)((const u8 *)per_cpu_ptr(p, cpu) + offset);
+		for (b = 0; b < TORUS_LATENCY_BUCKETS; b++)
+			v[b] += ACCESS_ONCE(h[b]);
+	}
+}
+
+#endif	/* __TORUS_LATENCY_H__ */
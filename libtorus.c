@@ -0,0 +1,509 @@
+/*
+ * libtorus.c	binary access to torus forwarding state
+ *
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <libtorus.h>
+
+#define	LIBTORUS_BUFSZ	(32 * 1024)
+#define	NLA_SPACE(len)	NLA_ALIGN(NLA_HDRLEN + (len))
+#define	LIBTORUS_MAXATTR \
+	(TORUS_GENL_POLICIES > CTRL_ATTR_MAX + 1 ? \
+	 TORUS_GENL_POLICIES : CTRL_ATTR_MAX + 1)
+
+typedef int (*libtorus_reply_fn)(struct nlmsghdr *, struct nlattr **, void *);
+
+static struct nlmsghdr *new_req(unsigned short family, int cmd, int flags,
+				size_t attrs)
+{
+	struct	nlmsghdr *n;
+	struct	genlmsghdr *g;
+	size_t	sz = NLMSG_SPACE(GENL_HDRLEN) + attrs;
+
+	if (n = calloc(1, sz), !n)
+		return NULL;
+	n->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	n->nlmsg_type = family;
+	n->nlmsg_flags = NLM_F_REQUEST | flags;
+	g = NLMSG_DATA(n);
+	g->cmd = cmd;
+	g->version = family == GENL_ID_CTRL ? 1 : TORUS_GENL_VERSION;
+	return n;
+}
+
+/*
+ * new_req() must have reserved NLA_SPACE(len) for each attribute
+ */
+static void add_attr(struct nlmsghdr *n, int type, const void *data, int len)
+{
+	struct	nlattr *nla;
+
+	nla = (struct nlattr *)((char *)n + NLMSG_ALIGN(n->nlmsg_len));
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((char *)nla + NLA_HDRLEN, data, len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static void *attr_data(struct nlattr *nla)
+{
+	return (char *)nla + NLA_HDRLEN;
+}
+
+static int attr_len(struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static void parse_attrs(struct nlmsghdr *n, struct nlattr **tb)
+{
+	struct	nlattr *nla;
+	int	len, type;
+
+	memset(tb, 0, LIBTORUS_MAXATTR * sizeof(*tb));
+	nla = (struct nlattr *)((char *)NLMSG_DATA(n) + GENL_HDRLEN);
+	len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+	       nla->nla_len <= len) {
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type < LIBTORUS_MAXATTR)
+			tb[type] = nla;
+		len -= NLA_ALIGN(nla->nla_len);
+		nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+	}
+}
+
+/*
+ * Send the request then pass each reply to fn until the end of a dump,
+ * a single reply, or an error.  fn returns non-zero to stop early.
+ */
+static int talk(struct libtorus *t, struct nlmsghdr *req, libtorus_reply_fn fn,
+		void *arg)
+{
+	struct	nlattr *tb[LIBTORUS_MAXATTR];
+	struct	nlmsghdr *n;
+	char	*buf;
+	int	len, err = 0, done = 0;
+
+	req->nlmsg_seq = ++t->seq;
+	if (send(t->fd, req, req->nlmsg_len, 0) < 0)
+		return -errno;
+	if (buf = malloc(LIBTORUS_BUFSZ), !buf)
+		return -ENOMEM;
+	while (!done) {
+		len = recv(t->fd, buf, LIBTORUS_BUFSZ, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		for (n = (struct nlmsghdr *)buf; !done && NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq != t->seq)
+				continue;
+			if (n->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+			} else if (n->nlmsg_type == NLMSG_ERROR) {
+				err = ((struct nlmsgerr *)NLMSG_DATA(n))->error;
+				done = 1;
+			} else {
+				parse_attrs(n, tb);
+				err = fn ? fn(n, tb, arg) : 0;
+				if (err || !(n->nlmsg_flags & NLM_F_MULTI))
+					done = 1;
+				if (err > 0)
+					err = 0;
+			}
+		}
+	}
+	free(buf);
+	return err;
+}
+
+static int family_reply(struct nlmsghdr *n, struct nlattr **tb, void *arg)
+{
+	if (!tb[CTRL_ATTR_FAMILY_ID])
+		return -ENOENT;
+	*(unsigned short *)arg = *(unsigned short *)
+		attr_data(tb[CTRL_ATTR_FAMILY_ID]);
+	return 0;
+}
+
+int libtorus_open(struct libtorus *t)
+{
+	struct	sockaddr_nl sa;
+	struct	nlmsghdr *req;
+	int	err;
+
+	memset(t, 0, sizeof(*t));
+	if (t->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC), t->fd < 0)
+		return -errno;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind(t->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err = -errno;
+		goto err_bind;
+	}
+	req = new_req(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0,
+		      NLA_SPACE(sizeof(TORUS_GENL_NAME)));
+	if (!req) {
+		err = -ENOMEM;
+		goto err_bind;
+	}
+	add_attr(req, CTRL_ATTR_FAMILY_NAME, TORUS_GENL_NAME,
+		 sizeof(TORUS_GENL_NAME));
+	err = talk(t, req, family_reply, &t->family);
+	free(req);
+	if (err)
+		goto err_bind;
+	return 0;
+
+err_bind:
+	close(t->fd);
+	t->fd = -1;
+	return err;
+}
+
+void libtorus_close(struct libtorus *t)
+{
+	if (t->fd >= 0)
+		close(t->fd);
+	t->fd = -1;
+}
+
+struct	lu_arg {
+	unsigned	tbls;
+	unsigned char	*lu;
+	unsigned long long *gen;
+	libtorus_lu_cb	cb;
+	void		*arg;
+};
+
+static int lu_reply(struct nlmsghdr *n, struct nlattr **tb, void *arg)
+{
+	struct	lu_arg *a = arg;
+	int	ifindex;
+
+	if (!tb[TORUS_GENL_IFINDEX_ATTR] || !tb[TORUS_GENL_LU_ATTR] ||
+	    !tb[TORUS_GENL_GEN_ATTR])
+		return -EPROTO;
+	ifindex = *(unsigned *)attr_data(tb[TORUS_GENL_IFINDEX_ATTR]);
+	if (a->cb)
+		return a->cb(ifindex, *(unsigned long long *)
+			     attr_data(tb[TORUS_GENL_GEN_ATTR]),
+			     attr_data(tb[TORUS_GENL_LU_ATTR]), a->arg);
+	if (attr_len(tb[TORUS_GENL_LU_ATTR]) !=
+	    __builtin_popcount(a->tbls) * TORUS_GENL_TBL_ENTRIES)
+		return -EPROTO;
+	memcpy(a->lu, attr_data(tb[TORUS_GENL_LU_ATTR]),
+	       attr_len(tb[TORUS_GENL_LU_ATTR]));
+	if (a->gen)
+		*a->gen = *(unsigned long long *)
+			attr_data(tb[TORUS_GENL_GEN_ATTR]);
+	return 0;
+}
+
+int libtorus_get_lu(struct libtorus *t, int ifindex, unsigned tbls,
+		    unsigned char *lu, unsigned long long *gen)
+{
+	struct	lu_arg a = { .lu = lu, .gen = gen };
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err;
+
+	a.tbls = tbls &= TORUS_GENL_ALL_TBLS;
+	req = new_req(t->family, TORUS_CMD_GET_LU, 0, 2 * NLA_SPACE(4));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	add_attr(req, TORUS_GENL_TBLS_ATTR, &tbls, sizeof(tbls));
+	err = talk(t, req, lu_reply, &a);
+	free(req);
+	return err;
+}
+
+static int gen_reply(struct nlmsghdr *n, struct nlattr **tb, void *arg)
+{
+	if (arg && tb[TORUS_GENL_GEN_ATTR])
+		*(unsigned long long *)arg = *(unsigned long long *)
+			attr_data(tb[TORUS_GENL_GEN_ATTR]);
+	return 0;
+}
+
+int libtorus_set_lu(struct libtorus *t, int ifindex, unsigned tbls,
+		    const unsigned char *lu,
+		    const struct torus_genl_delta *delta, int n,
+		    unsigned long long *gen)
+{
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err, lusz;
+
+	tbls &= TORUS_GENL_ALL_TBLS;
+	lusz = lu ? __builtin_popcount(tbls) * TORUS_GENL_TBL_ENTRIES : 0;
+	req = new_req(t->family, TORUS_CMD_SET_LU, 0,
+		      2 * NLA_SPACE(4) + NLA_SPACE(8) + NLA_SPACE(lusz) +
+		      NLA_SPACE(n * sizeof(*delta)));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	if (gen && *gen != ~0ULL)
+		add_attr(req, TORUS_GENL_GEN_ATTR, gen, sizeof(*gen));
+	if (lusz) {
+		add_attr(req, TORUS_GENL_TBLS_ATTR, &tbls, sizeof(tbls));
+		add_attr(req, TORUS_GENL_LU_ATTR, lu, lusz);
+	}
+	if (n > 0)
+		add_attr(req, TORUS_GENL_DELTA_ATTR, delta, n * sizeof(*delta));
+	err = talk(t, req, gen_reply, gen);
+	free(req);
+	return err;
+}
+
+int libtorus_set_mp(struct libtorus *t, int ifindex,
+		    const struct torus_genl_mp *mp, int n,
+		    unsigned long long *gen)
+{
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err;
+
+	req = new_req(t->family, TORUS_CMD_SET_LU, 0,
+		      NLA_SPACE(4) + NLA_SPACE(8) + NLA_SPACE(n * sizeof(*mp)));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	if (gen && *gen != ~0ULL)
+		add_attr(req, TORUS_GENL_GEN_ATTR, gen, sizeof(*gen));
+	add_attr(req, TORUS_GENL_MP_ATTR, mp, n * sizeof(*mp));
+	err = talk(t, req, gen_reply, gen);
+	free(req);
+	return err;
+}
+
+struct	ports_arg {
+	struct	torus_genl_port *ports;
+	int	max;
+	libtorus_ports_cb cb;
+	void	*arg;
+};
+
+static int ports_reply(struct nlmsghdr *n, struct nlattr **tb, void *arg)
+{
+	struct	ports_arg *a = arg;
+	int	ports;
+
+	if (!tb[TORUS_GENL_IFINDEX_ATTR] || !tb[TORUS_GENL_PORTS_ATTR])
+		return -EPROTO;
+	ports = attr_len(tb[TORUS_GENL_PORTS_ATTR]) /
+		sizeof(struct torus_genl_port);
+	if (a->cb)
+		return a->cb(*(unsigned *)
+			     attr_data(tb[TORUS_GENL_IFINDEX_ATTR]),
+			     attr_data(tb[TORUS_GENL_PORTS_ATTR]), ports,
+			     a->arg);
+	if (ports > a->max)
+		ports = a->max;
+	memcpy(a->ports, attr_data(tb[TORUS_GENL_PORTS_ATTR]),
+	       ports * sizeof(struct torus_genl_port));
+	a->max = ports;
+	return 0;
+}
+
+int libtorus_get_ports(struct libtorus *t, int ifindex,
+		       struct torus_genl_port *ports, int max)
+{
+	struct	ports_arg a = { .ports = ports, .max = max };
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err;
+
+	req = new_req(t->family, TORUS_CMD_GET_PORTS, 0, NLA_SPACE(4));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	err = talk(t, req, ports_reply, &a);
+	free(req);
+	return err ? err : a.max;
+}
+
+/*
+ * set_elems sends cmd with the n elements of size sz in attribute attr;
+ * there's no reply but the ack
+ */
+static int set_elems(struct libtorus *t, int cmd, int attr, int ifindex,
+		     const void *elems, size_t sz, int n)
+{
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err;
+
+	req = new_req(t->family, cmd, NLM_F_ACK,
+		      NLA_SPACE(4) + NLA_SPACE(n * sz));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	if (n > 0)
+		add_attr(req, attr, elems, n * sz);
+	err = talk(t, req, NULL, NULL);
+	free(req);
+	return err;
+}
+
+struct	elems_arg {
+	int	attr;
+	size_t	sz;
+	void	*elems;
+	int	max;
+};
+
+static int elems_reply(struct nlmsghdr *n, struct nlattr **tb, void *arg)
+{
+	struct	elems_arg *a = arg;
+	int	elems;
+
+	if (!tb[a->attr])
+		return -EPROTO;
+	elems = attr_len(tb[a->attr]) / a->sz;
+	if (elems > a->max)
+		elems = a->max;
+	memcpy(a->elems, attr_data(tb[a->attr]), elems * a->sz);
+	a->max = elems;
+	return 0;
+}
+
+/*
+ * get_elems returns the number of elements of size sz, from attribute attr
+ * of the reply to cmd, copied to elems[max]
+ */
+static int get_elems(struct libtorus *t, int cmd, int attr, int ifindex,
+		     void *elems, size_t sz, int max)
+{
+	struct	elems_arg a = {
+		.attr = attr, .sz = sz, .elems = elems, .max = max
+	};
+	struct	nlmsghdr *req;
+	unsigned u = ifindex;
+	int	err;
+
+	req = new_req(t->family, cmd, 0, NLA_SPACE(4));
+	if (!req)
+		return -ENOMEM;
+	add_attr(req, TORUS_GENL_IFINDEX_ATTR, &u, sizeof(u));
+	err = talk(t, req, elems_reply, &a);
+	free(req);
+	return err ? err : a.max;
+}
+
+int libtorus_add_routes(struct libtorus *t, int ifindex,
+			const struct torus_genl_route *routes, int n)
+{
+	return set_elems(t, TORUS_CMD_ADD_ROUTES, TORUS_GENL_ROUTES_ATTR,
+			 ifindex, routes, sizeof(*routes), n);
+}
+
+int libtorus_del_routes(struct libtorus *t, int ifindex,
+			const struct torus_genl_route *routes, int n)
+{
+	return set_elems(t, TORUS_CMD_DEL_ROUTES, TORUS_GENL_ROUTES_ATTR,
+			 ifindex, routes, sizeof(*routes), n);
+}
+
+int libtorus_get_routes(struct libtorus *t, int ifindex,
+			struct torus_genl_route *routes, int max)
+{
+	return get_elems(t, TORUS_CMD_GET_ROUTES, TORUS_GENL_ROUTES_ATTR,
+			 ifindex, routes, sizeof(*routes), max);
+}
+
+int libtorus_add_bindings(struct libtorus *t, int ifindex,
+			  const struct torus_genl_binding *bindings, int n)
+{
+	return set_elems(t, TORUS_CMD_ADD_BINDINGS, TORUS_GENL_BINDINGS_ATTR,
+			 ifindex, bindings, sizeof(*bindings), n);
+}
+
+int libtorus_del_bindings(struct libtorus *t, int ifindex,
+			  const struct torus_genl_binding *bindings, int n)
+{
+	return set_elems(t, TORUS_CMD_DEL_BINDINGS, TORUS_GENL_BINDINGS_ATTR,
+			 ifindex, bindings, sizeof(*bindings), n);
+}
+
+int libtorus_get_bindings(struct libtorus *t, int ifindex,
+			  struct torus_genl_binding *bindings, int max)
+{
+	return get_elems(t, TORUS_CMD_GET_BINDINGS, TORUS_GENL_BINDINGS_ATTR,
+			 ifindex, bindings, sizeof(*bindings), max);
+}
+
+int libtorus_add_labels(struct libtorus *t, int ifindex,
+			const struct torus_genl_label *labels, int n)
+{
+	return set_elems(t, TORUS_CMD_ADD_LABELS, TORUS_GENL_LABELS_ATTR,
+			 ifindex, labels, sizeof(*labels), n);
+}
+
+int libtorus_del_labels(struct libtorus *t, int ifindex,
+			const struct torus_genl_label *labels, int n)
+{
+	return set_elems(t, TORUS_CMD_DEL_LABELS, TORUS_GENL_LABELS_ATTR,
+			 ifindex, labels, sizeof(*labels), n);
+}
+
+int libtorus_get_labels(struct libtorus *t, int ifindex,
+			struct torus_genl_label *labels, int max)
+{
+	return get_elems(t, TORUS_CMD_GET_LABELS, TORUS_GENL_LABELS_ATTR,
+			 ifindex, labels, sizeof(*labels), max);
+}
+
+int libtorus_dump_lu(struct libtorus *t, libtorus_lu_cb cb, void *arg)
+{
+	struct	lu_arg a = { .cb = cb, .arg = arg };
+	struct	nlmsghdr *req;
+	int	err;
+
+	req = new_req(t->family, TORUS_CMD_GET_LU, NLM_F_DUMP, 0);
+	if (!req)
+		return -ENOMEM;
+	err = talk(t, req, lu_reply, &a);
+	free(req);
+	return err;
+}
+
+int libtorus_dump_ports(struct libtorus *t, libtorus_ports_cb cb, void *arg)
+{
+	struct	ports_arg a = { .cb = cb, .arg = arg };
+	struct	nlmsghdr *req;
+	int	err;
+
+	req = new_req(t->family, TORUS_CMD_GET_PORTS, NLM_F_DUMP, 0);
+	if (!req)
+		return -ENOMEM;
+	err = talk(t, req, ports_reply, &a);
+	free(req);
+	return err;
+}
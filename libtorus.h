@@ -0,0 +1,134 @@
+/*
+ * libtorus.h	binary access to torus forwarding state
+ *
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __LIBTORUS_H__
+#define __LIBTORUS_H__
+
+#include <linux/torus.h>
+
+#define	LIBTORUS_LU_SZ	(TORUS_GENL_TBLS * TORUS_GENL_TBL_ENTRIES)
+
+/*
+ * A libtorus handle is a generic netlink socket bound to the "torus"
+ * family; each call below is one request and its reply.
+ */
+struct	libtorus {
+	int		fd;
+	unsigned short	family;
+	unsigned int	seq;
+};
+
+/*
+ * The dump callbacks get each torus device of the name-space in turn,
+ * a non-zero return stops the dump.
+ */
+typedef int (*libtorus_lu_cb)(int ifindex, unsigned long long gen,
+			      const unsigned char *lu, void *arg);
+typedef int (*libtorus_ports_cb)(int ifindex,
+				 const struct torus_genl_port *ports,
+				 int n, void *arg);
+
+/*
+ * These return 0 or a negative errno
+ */
+extern int  libtorus_open(struct libtorus *t);
+extern void libtorus_close(struct libtorus *t);
+
+/*
+ * lu has TORUS_GENL_TBL_ENTRIES for each bit of tbls, in ascending order
+ */
+extern int  libtorus_get_lu(struct libtorus *t, int ifindex, unsigned tbls,
+			    unsigned char *lu, unsigned long long *gen);
+
+/*
+ * Replace the tbls of lu, if any, then apply the n delta entries, all as
+ * one new generation returned through gen.  If gen is non-NULL on entry
+ * and *gen isn't ~0ULL, this fails with -EAGAIN unless *gen is still the
+ * current generation.
+ */
+extern int  libtorus_set_lu(struct libtorus *t, int ifindex, unsigned tbls,
+			    const unsigned char *lu,
+			    const struct torus_genl_delta *delta, int n,
+			    unsigned long long *gen);
+
+/*
+ * Have the flow hash pick among the next hops of each of the n mp entries,
+ * as one new generation like libtorus_set_lu()
+ */
+extern int  libtorus_set_mp(struct libtorus *t, int ifindex,
+			    const struct torus_genl_mp *mp, int n,
+			    unsigned long long *gen);
+
+/*
+ * returns the number of ports copied to ports[max]
+ */
+extern int  libtorus_get_ports(struct libtorus *t, int ifindex,
+			       struct torus_genl_port *ports, int max);
+
+/*
+ * Add or replace the n routes; or delete them, or all with n of 0
+ */
+extern int  libtorus_add_routes(struct libtorus *t, int ifindex,
+				const struct torus_genl_route *routes, int n);
+extern int  libtorus_del_routes(struct libtorus *t, int ifindex,
+				const struct torus_genl_route *routes, int n);
+
+/*
+ * returns the number of routes copied to routes[max]
+ */
+extern int  libtorus_get_routes(struct libtorus *t, int ifindex,
+				struct torus_genl_route *routes, int max);
+
+/*
+ * Add or replace the n IP to torus address bindings of the proxy; or
+ * delete them, or all with n of 0
+ */
+extern int  libtorus_add_bindings(struct libtorus *t, int ifindex,
+				  const struct torus_genl_binding *bindings,
+				  int n);
+extern int  libtorus_del_bindings(struct libtorus *t, int ifindex,
+				  const struct torus_genl_binding *bindings,
+				  int n);
+
+/*
+ * returns the number of bindings copied to bindings[max]
+ */
+extern int  libtorus_get_bindings(struct libtorus *t, int ifindex,
+				  struct torus_genl_binding *bindings, int max);
+
+/*
+ * Add or replace the n MPLS labels; or delete them, or all with n of 0
+ */
+extern int  libtorus_add_labels(struct libtorus *t, int ifindex,
+				const struct torus_genl_label *labels, int n);
+extern int  libtorus_del_labels(struct libtorus *t, int ifindex,
+				const struct torus_genl_label *labels, int n);
+
+/*
+ * returns the number of labels copied to labels[max]
+ */
+extern int  libtorus_get_labels(struct libtorus *t, int ifindex,
+				struct torus_genl_label *labels, int max);
+
+extern int  libtorus_dump_lu(struct libtorus *t, libtorus_lu_cb cb,
+			     void *arg);
+extern int  libtorus_dump_ports(struct libtorus *t, libtorus_ports_cb cb,
+				void *arg);
+
+#endif /* __LIBTORUS_H__ */
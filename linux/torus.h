@@ -7,12 +7,18 @@
 #define	TORUS_VERSION		2
 #define	TORUS_MIN_VERSION	2
 #define	TORUS_MAX_VERSION	TORUS_VERSION
-#define	TORUS_MIN_ROWS		2
-#define	TORUS_MAX_ROWS		8
-#define	TORUS_MIN_COLS		2
-#define	TORUS_MAX_COLS		8
+#define	TORUS_MAX_DIMS		4	/* address bytes 1 through 4 */
+#define	TORUS_MIN_SIZE		2
+#define	TORUS_MAX_SIZE		256
+#define	TORUS_MAX_NODES		65536
+#define	TORUS_MIN_ROWS		TORUS_MIN_SIZE
+#define	TORUS_MAX_ROWS		TORUS_MAX_SIZE
+#define	TORUS_MIN_COLS		TORUS_MIN_SIZE
+#define	TORUS_MAX_COLS		TORUS_MAX_SIZE
 #define	TORUS_MIN_MTU		64
 #define	TORUS_MAX_MTU		9000
+#define	TORUS_MIN_QUEUES	1
+#define	TORUS_MAX_QUEUES	256
 
 enum {
 	__TORUS_FIRST_ATTR,
@@ -20,9 +26,253 @@ enum {
 	TORUS_ROWS_ATTR,
 	TORUS_COLS_ATTR,
 	TORUS_MASTER_ATTR,
+	TORUS_QUEUES_ATTR,
+	/*
+	 * DIMS is an array of the u16 size of each dimension of a virtual
+	 * toroid, e.g. 16x16x16, of at most TORUS_MAX_NODES; it supersedes
+	 * the ROWS and COLS of two.
+	 */
+	TORUS_DIMS_ATTR,
 	__TORUS_LAST_ATTR
 #define	TORUS_LAST_ATTR		(__TORUS_LAST_ATTR - 1)
 #define TORUS_POLICIES		__TORUS_LAST_ATTR
 };
 
+/*
+ * A "torus_udp" device is a port that carries the frames of its torus
+ * master in UDP over IPv4 to the peer node at REMOTE, so that the toroid
+ * may span a routed network.  Both ends use the same destination PORT and
+ * the source port follows the flow hash of each frame for ECMP of the
+ * underlay.  LOCAL is the outer source address, if any, and TTL that of
+ * the outer header, 0 for the default.
+ */
+#define	TORUS_UDP		"torus_udp"
+#define	TORUS_UDP_PORT		7471
+
+enum {
+	__TORUS_UDP_FIRST_ATTR,
+	TORUS_UDP_LOCAL_ATTR,		/* be32 */
+	TORUS_UDP_REMOTE_ATTR,		/* be32 */
+	TORUS_UDP_PORT_ATTR,		/* u16 */
+	TORUS_UDP_TTL_ATTR,		/* u8 */
+	__TORUS_UDP_LAST_ATTR
+#define	TORUS_UDP_LAST_ATTR	(__TORUS_UDP_LAST_ATTR - 1)
+#define	TORUS_UDP_POLICIES	__TORUS_UDP_LAST_ATTR
+};
+
+/*
+ * The "torus" generic netlink family reads and programs the forwarding
+ * state of a torus device in binary rather than through sysfs text.
+ *
+ * TORUS_CMD_GET_LU	IFINDEX [ TBLS ] -> IFINDEX GEN TBLS LU [ MP ]
+ *			or dump every torus device of the name-space
+ * TORUS_CMD_SET_LU	IFINDEX [ GEN ] [ TBLS LU ] [ DELTA ] [ MP ] -> GEN
+ * TORUS_CMD_GET_PORTS	IFINDEX -> IFINDEX PORTS
+ *			or dump every torus device of the name-space
+ * TORUS_CMD_PEER	IFINDEX PORT PEER UP
+ *			multicast to the "peers" group as the hello
+ *			protocol finds or loses the neighbor on a port
+ * TORUS_CMD_ADD_ROUTES	IFINDEX ROUTES
+ * TORUS_CMD_DEL_ROUTES	IFINDEX [ ROUTES ]
+ * TORUS_CMD_GET_ROUTES	IFINDEX -> IFINDEX ROUTES
+ * TORUS_CMD_ADD_BINDINGS	IFINDEX BINDINGS
+ * TORUS_CMD_DEL_BINDINGS	IFINDEX [ BINDINGS ]
+ * TORUS_CMD_GET_BINDINGS	IFINDEX -> IFINDEX BINDINGS
+ * TORUS_CMD_ADD_LABELS	IFINDEX LABELS
+ * TORUS_CMD_DEL_LABELS	IFINDEX [ LABELS ]
+ * TORUS_CMD_GET_LABELS	IFINDEX -> IFINDEX LABELS
+ *
+ * TBLS is a bit mask of the lookup tables in LU, each of
+ * TORUS_GENL_TBL_ENTRIES port indexes, in ascending order; without TBLS,
+ * GET_LU returns them all.  SET_LU replaces the LU tables then applies
+ * the DELTA then the multipath MP entries, all in one generation; LU and
+ * DELTA entries replace any multipath entry.  With GEN, SET_LU fails with
+ * EAGAIN unless that is still the current generation.
+ *
+ * ROUTES map the IPv4 and IPv6 destinations of host sourced frames sent
+ * to the router address to the torus address of their longest matching
+ * prefix.  ADD_ROUTES adds or replaces those of the same prefix and
+ * DEL_ROUTES removes them, or all without ROUTES; a device has at most
+ * TORUS_GENL_ROUTES_MAX.
+ *
+ * BINDINGS are the torus addresses of IPv4 and IPv6 hosts with which the
+ * device answers the ARP requests and neighbor solicitations of its own
+ * host rather than flooding them; it also learns those of the ARP and ND
+ * frames that it delivers.  ADD_BINDINGS adds or replaces those of the same
+ * address, DEL_BINDINGS removes them, or all without BINDINGS; a device
+ * has at most TORUS_GENL_BINDINGS_MAX.
+ *
+ * LABELS switch MPLS frames, sent by the host or received from a port, by
+ * their top label instead of their destination address.  SWAP replaces
+ * the label and forwards the frame to port; POP removes it then forwards
+ * the frame to port, or with port 0 delivers the IP frame under the last
+ * label to the host or switches by the next one.  Each decrements the TTL
+ * of the label.  ADD_LABELS adds or replaces those of the same label and
+ * DEL_LABELS removes them, or all without LABELS; a device has at most
+ * TORUS_GENL_LABELS_MAX.
+ */
+#define	TORUS_GENL_NAME		TORUS
+#define	TORUS_GENL_VERSION	1
+#define	TORUS_GENL_TBLS		5
+#define	TORUS_GENL_TBL_ENTRIES	256
+#define	TORUS_GENL_ALL_TBLS	((1 << TORUS_GENL_TBLS) - 1)
+#define	TORUS_GENL_MP_PORTS	8
+#define	TORUS_GENL_PEERS_GROUP	"peers"
+#define	TORUS_GENL_ROUTES_MAX	1024
+#define	TORUS_GENL_BINDINGS_MAX	1024
+#define	TORUS_GENL_LABELS_MAX	1024
+#define	TORUS_GENL_LABEL_SWAP	1
+#define	TORUS_GENL_LABEL_POP	2
+
+/*
+ * Each torus node sends a hello on each of its ports every interval; a
+ * node then learns the address of the peer on each port and loses it
+ * after TORUS_HELLO_DEAD of the peer's intervals without a hello.  The
+ * nodes of a virtual toroid know their peers from the start so they only
+ * send every TORUS_HELLO_VIRTUAL_MS.
+ */
+#define	TORUS_HELLO_PROTO	0x88b5	/* ETH_P_802_EX1 */
+#define	TORUS_HELLO_VERSION	1
+#define	TORUS_HELLO_MS		10
+#define	TORUS_HELLO_VIRTUAL_MS	1000
+#define	TORUS_HELLO_DEAD	3
+
+/*
+ * The hello and link state frames follow an ethernet header from the
+ * node's address to the broadcast address; all of their multibyte fields
+ * are in network byte order.
+ */
+#define	TORUS_HELLO_TYPE	0
+#define	TORUS_LSA_TYPE		1
+
+/*
+ * port is the sender's index of the port and interval is in milliseconds
+ */
+struct	torus_hello {
+	unsigned char	version;
+	unsigned char	type;
+	unsigned short	interval;
+	unsigned int	seq;
+	unsigned char	port;
+	unsigned char	pad[3];
+};
+
+/*
+ * A link state advertisement has the n peers heard by the origin node;
+ * each node floods those newer than what it has then computes its lookup
+ * tables from the whole set.  The origin refreshes its own every
+ * TORUS_LSA_REFRESH_MS and the others forget it after TORUS_LSA_MAX_AGE
+ * of those.
+ */
+#define	TORUS_LSA_REFRESH_MS	10000
+#define	TORUS_LSA_MAX_AGE	4
+
+struct	torus_lsa {
+	unsigned char	version;
+	unsigned char	type;
+	unsigned short	n;
+	unsigned int	seq;
+	unsigned char	origin[6];
+	unsigned char	pad[2];
+	unsigned char	peer[0][6];
+};
+
+enum {
+	__TORUS_FIRST_CMD,
+	TORUS_CMD_GET_LU,
+	TORUS_CMD_SET_LU,
+	TORUS_CMD_GET_PORTS,
+	TORUS_CMD_PEER,
+	TORUS_CMD_ADD_ROUTES,
+	TORUS_CMD_DEL_ROUTES,
+	TORUS_CMD_GET_ROUTES,
+	TORUS_CMD_ADD_BINDINGS,
+	TORUS_CMD_DEL_BINDINGS,
+	TORUS_CMD_GET_BINDINGS,
+	TORUS_CMD_ADD_LABELS,
+	TORUS_CMD_DEL_LABELS,
+	TORUS_CMD_GET_LABELS,
+	__TORUS_LAST_CMD
+#define	TORUS_LAST_CMD		(__TORUS_LAST_CMD - 1)
+};
+
+enum {
+	__TORUS_GENL_FIRST_ATTR,
+	TORUS_GENL_IFINDEX_ATTR,	/* u32 */
+	TORUS_GENL_GEN_ATTR,		/* u64 */
+	TORUS_GENL_TBLS_ATTR,		/* u32 */
+	TORUS_GENL_LU_ATTR,		/* u8[TBL_ENTRIES] per TBLS bit */
+	TORUS_GENL_DELTA_ATTR,		/* struct torus_genl_delta[] */
+	TORUS_GENL_PORTS_ATTR,		/* struct torus_genl_port[] */
+	TORUS_GENL_MP_ATTR,		/* struct torus_genl_mp[] */
+	TORUS_GENL_PORT_ATTR,		/* u32 */
+	TORUS_GENL_PEER_ATTR,		/* u8[6] */
+	TORUS_GENL_UP_ATTR,		/* u8 */
+	TORUS_GENL_ROUTES_ATTR,		/* struct torus_genl_route[] */
+	TORUS_GENL_BINDINGS_ATTR,	/* struct torus_genl_binding[] */
+	TORUS_GENL_LABELS_ATTR,		/* struct torus_genl_label[] */
+	__TORUS_GENL_LAST_ATTR
+#define	TORUS_GENL_LAST_ATTR	(__TORUS_GENL_LAST_ATTR - 1)
+#define TORUS_GENL_POLICIES	__TORUS_GENL_LAST_ATTR
+};
+
+struct	torus_genl_delta {
+	unsigned char	tbl;
+	unsigned char	entry;
+	unsigned char	port;
+};
+
+/*
+ * the flow hash picks among the first n of port[] for this entry
+ */
+struct	torus_genl_mp {
+	unsigned char	tbl;
+	unsigned char	entry;
+	unsigned char	n;
+	unsigned char	port[TORUS_GENL_MP_PORTS];
+};
+
+/*
+ * ifindex is 0 for an empty port; port 0 is the device itself
+ */
+struct	torus_genl_port {
+	unsigned int	ifindex;
+	unsigned char	peer[6];
+	unsigned char	pad[2];
+};
+
+/*
+ * family is AF_INET or AF_INET6 and prefix, in network byte order, has
+ * plen significant bits; addr is the torus address of the destinations
+ */
+struct	torus_genl_route {
+	unsigned char	family;
+	unsigned char	plen;
+	unsigned char	addr[6];
+	unsigned char	prefix[16];
+};
+
+/*
+ * family is AF_INET or AF_INET6 and ip, in network byte order, has the
+ * host's address; learned is set for those learned from ARP or ND
+ */
+struct	torus_genl_binding {
+	unsigned char	family;
+	unsigned char	learned;
+	unsigned char	addr[6];
+	unsigned char	ip[16];
+};
+
+/*
+ * label is the 20 bit MPLS label to switch, out its replacement with
+ * SWAP, and port an index of the device's ports
+ */
+struct	torus_genl_label {
+	unsigned int	label;
+	unsigned int	out;
+	unsigned char	action;
+	unsigned char	port;
+	unsigned char	pad[2];
+};
+
 #endif /* __LINUX_TORUS_H__ */
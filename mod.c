@@ -21,9 +21,35 @@
 #include <torus.h>
 #include <counters.h>
 
+/*
+ * Flip the liveness of dev in the ports of its master and, if it's a torus
+ * itself, in those of its nested torus ports that have it as a port too.
+ * rtnl keeps the ports from changing while their mutex is taken for each.
+ */
+static void this_net_device_live(struct net_device *dev)
+{
+	struct	torus *priv;
+	struct	torus_ports *ports;
+	struct	net_device *port;
+	int	i;
+
+	if (is_torus(dev->master))
+		update_torus_port_live(netdev_priv(dev->master), dev);
+	if (!is_torus(dev))
+		return;
+	priv = netdev_priv(dev);
+	ports = rtnl_dereference(priv->port);
+	for (i = 1; i < ports->n; i++)
+		if (port = ports->port[i].dev,
+		    port != dev->master && is_torus(port))
+			update_torus_port_live(netdev_priv(port), dev);
+}
+
 /*
  * Catch the unregister of non-TORUS (i.e. normal) interfaces
- * to remove from the master's dev table.
+ * to remove from the master's dev table; the up, down and carrier
+ * changes of all ports; and the register and unregister of torus devices,
+ * including moves between name-spaces, to add and remove their debugfs.
  */
 static int this_net_device_handler(struct notifier_block UNUSED *unused,
 				   unsigned long event,
@@ -31,10 +57,25 @@ static int this_net_device_handler(struct notifier_block UNUSED *unused,
 {
 	struct	net_device *dev = (struct net_device *) ptr;
 
-	if (event != NETDEV_UNREGISTER)
+	switch (event) {
+	case NETDEV_UP:
+	case NETDEV_DOWN:
+	case NETDEV_CHANGE:
+		this_net_device_live(dev);
 		return NOTIFY_DONE;
-	if (is_torus(dev))	/* handled in rtnl.c:this_dellink() */
+	case NETDEV_REGISTER:
+		if (is_torus(dev))
+			create_torus_debugfs(dev);
 		return NOTIFY_DONE;
+	case NETDEV_UNREGISTER:
+		break;
+	default:
+		return NOTIFY_DONE;
+	}
+	if (is_torus(dev)) {	/* otherwise handled by rto_dellink() */
+		remove_torus_debugfs(dev);
+		return NOTIFY_DONE;
+	}
 	if (!dev->master)
 		return NOTIFY_DONE;
 	if (!is_torus(dev->master))
@@ -47,11 +88,57 @@ static struct notifier_block this_notifier_block __read_mostly = {
 	.notifier_call = this_net_device_handler,
 };
 
+/*
+ * kmalloc doesn't promise the cache-line alignment of the lookup tables
+ */
+struct kmem_cache *torus_lu_cache;
+
 
 static int __init this_init( void )
 {
-	retonerr(rtnl_link_register(&torus_rtnl),
-		 "register %s module\n", torus_rtnl.kind);
+	int	err;
+
+	torus_lu_cache = kmem_cache_create("torus_lu", sizeof(struct torus_lu),
+					   0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!torus_lu_cache) {
+		pr_torus_err("create %s lookup table cache", torus_rtnl.kind);
+		return -ENOMEM;
+	}
+	register_torus_debugfs();
+	err = register_torus_spf();
+	if (err < 0) {
+		pr_torus_err("register %s link state", torus_rtnl.kind);
+		unregister_torus_debugfs();
+		kmem_cache_destroy(torus_lu_cache);
+		return err;
+	}
+	err = rtnl_link_register(&torus_rtnl);
+	if (err < 0) {
+		pr_torus_err("register %s module", torus_rtnl.kind);
+		unregister_torus_spf();
+		unregister_torus_debugfs();
+		kmem_cache_destroy(torus_lu_cache);
+		return err;
+	}
+	err = register_torus_genl();
+	if (err < 0) {
+		pr_torus_err("register %s genetlink", TORUS_GENL_NAME);
+		rtnl_link_unregister(&torus_rtnl);
+		unregister_torus_spf();
+		unregister_torus_debugfs();
+		kmem_cache_destroy(torus_lu_cache);
+		return err;
+	}
+	err = rtnl_link_register(&torus_udp_rtnl);
+	if (err < 0) {
+		pr_torus_err("register %s module", torus_udp_rtnl.kind);
+		unregister_torus_genl();
+		rtnl_link_unregister(&torus_rtnl);
+		unregister_torus_spf();
+		unregister_torus_debugfs();
+		kmem_cache_destroy(torus_lu_cache);
+		return err;
+	}
 	register_netdevice_notifier(&this_notifier_block);
 	return 0;
 }
@@ -59,7 +146,14 @@ static int __init this_init( void )
 static void __exit this_exit( void )
 {
 	unregister_netdevice_notifier(&this_notifier_block);
+	rtnl_link_unregister(&torus_udp_rtnl);
+	unregister_torus_genl();
 	rtnl_link_unregister(&torus_rtnl);
+	unregister_torus_spf();
+	unregister_torus_debugfs();
+	/* wait for the lookup tables freed after a grace period */
+	rcu_barrier();
+	kmem_cache_destroy(torus_lu_cache);
 }
 
 module_init(this_init);
@@ -71,3 +165,4 @@ MODULE_AUTHOR("Eliot Dresselhaus");
 MODULE_LICENSE("GPL v2");
 MODULE_VERSION(TORUS_VERSION_STRING);
 MODULE_ALIAS_RTNL_LINK(TORUS);
+MODULE_ALIAS_RTNL_LINK(TORUS_UDP);
@@ -21,9 +21,12 @@
 #include <linux/ethtool.h>
 #include <linux/etherdevice.h>
 #include <linux/torus.h>
+#define	CREATE_TRACE_POINTS
 #include <torus.h>
 
 static rx_handler_result_t ndo_rx(struct sk_buff **pskb);
+static int ndo_poll(struct napi_struct *napi, int budget);
+static bool ndo_forward(struct torus *, struct net_device *, struct sk_buff *);
 
 static inline int register_ndo_rx(struct net_device *dev,
 				  void *data)
@@ -31,64 +34,262 @@ static inline int register_ndo_rx(struct net_device *dev,
 	return netdev_rx_handler_register(dev, ndo_rx, data);
 }
 
-static inline void ndo_trace(const char *name, const char *xx, uint len,
-			     struct ethhdr *e)
+/*
+ * free_ndo_init frees as much as ndo_init() allocated, for its own errors
+ * and for ndo_uninit() if register_netdevice() then failed; otherwise the
+ * destructor frees these.
+ */
+static void free_ndo_init(struct net_device *dev)
 {
-	pr_torus_devel("%s %s %d bytes: %pM %pM %04x...", name, xx, len,
-		       e->h_dest, e->h_source, ntohs(e->h_proto));
-}
+	struct	torus *priv = netdev_priv(dev);
+	int	cpu;
 
-static inline void ndo_rx_trace(struct sk_buff *skb)
-{
-	ndo_trace(skb->dev->name, "RX", skb->len, eth_hdr(skb));
+	if (rtnl_dereference(dev->rx_handler) == ndo_rx)
+		netdev_rx_handler_unregister(dev);
+	free_torus_proxy(priv);
+	free_torus_hello(priv);
+	if (priv->burst) {
+		for_each_possible_cpu(cpu) {
+			netif_napi_del(&per_cpu_ptr(priv->burst, cpu)->napi);
+			skb_queue_purge(&per_cpu_ptr(priv->burst, cpu)->q);
+		}
+		free_percpu(priv->burst);
+		priv->burst = NULL;
+	}
+	if (priv->queue) {
+		free_percpu(priv->queue);
+		priv->queue = NULL;
+	}
+	free_torus(priv);
+	RCU_INIT_POINTER(priv->port, NULL);
+	RCU_INIT_POINTER(priv->lu, NULL);
+	free_torus_counters(priv);
 }
 
-static inline void ndo_tx_trace(struct sk_buff *skb)
+static int ndo_init(struct net_device *dev)
 {
-	ndo_trace(skb->dev->name, "TX", skb->len, (struct ethhdr *)skb->data);
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_ports *ports;
+	int	err;
+
+	gotonerr(err_init, err = alloc_torus_counters(priv),
+		 "alloc %s counters", dev->name);
+	gotonerr(err_init, err = alloc_torus(priv),
+		 "alloc %s ports", dev->name);
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	ports->port[0].dev = dev;
+	memcpy(ports->port[0].peer, dev->dev_addr, TORUS_ALEN);
+	mutex_unlock(&priv->port_mutex);
+	priv->queue = alloc_queue_counters(dev->num_tx_queues);
+	gotonerr(err_init, err = priv->queue ? 0 : -ENOMEM,
+		 "alloc %s queues", dev->name);
+	gotonerr(err_init, err = alloc_torus_hello(dev),
+		 "alloc %s hello", dev->name);
+	gotonerr(err_init, err = alloc_torus_proxy(dev),
+		 "alloc %s proxy", dev->name);
+	gotonerr(err_init, err = register_ndo_rx(dev, NULL),
+		 "register %s rx", dev->name);
+	return 0;
+err_init:
+	free_ndo_init(dev);
+	return err;
 }
 
-static int ndo_init(struct net_device *dev)
+static void ndo_uninit(struct net_device *dev)
 {
-	retonerr(register_ndo_rx(dev, dev), "register %s rx\n", dev->name);
-	return 0;
+	struct	torus *priv = netdev_priv(dev);
+	int	cpu;
+
+	stop_torus_hello(priv);
+	withdraw_torus_lsa(dev);
+	/* there's no destructor if register_netdevice() failed after init */
+	if (dev->reg_state == NETREG_UNINITIALIZED) {
+		free_ndo_init(dev);
+		return;
+	}
+	for_each_possible_cpu(cpu) {
+		if (!priv->burst)
+			break;
+		netif_napi_del(&per_cpu_ptr(priv->burst, cpu)->napi);
+		skb_queue_purge(&per_cpu_ptr(priv->burst, cpu)->q);
+	}
 }
 
 static int ndo_open(struct net_device *dev)
 {
 	struct	torus *priv = netdev_priv(dev);
-	struct	net_device **port;
+	struct	torus_ports *ports;
+	struct	net_device *port;
 	int	i;
 
 	rcu_read_lock();
-	port = rcu_dereference(priv->port);
-	for (i = 0; i < priv->ports; i++)
-		if (port[i])
-			netif_carrier_on(port[i]);
+	ports = rcu_dereference(priv->port);
+	for (i = 0; i < ports->n; i++)
+		if (port = torus_port_dev(ports, i), port)
+			netif_carrier_on(port);
 	rcu_read_unlock();
+	for_each_possible_cpu(i)
+		if (priv->burst)
+			napi_enable(&per_cpu_ptr(priv->burst, i)->napi);
+	start_torus_hello(priv);
 	return 0;
 }
 
 static int ndo_close(struct net_device *dev)
 {
 	struct	torus *priv = netdev_priv(dev);
-	struct	net_device **port;
+	struct	torus_ports *ports;
+	struct	net_device *port;
 	int	i;
 
 	rcu_read_lock();
-	port = rcu_dereference(priv->port);
-	for (i = 0; i < priv->ports; i++)
-		if (port[i])
-			netif_carrier_off(port[i]);
+	ports = rcu_dereference(priv->port);
+	for (i = 0; i < ports->n; i++)
+		if (port = torus_port_dev(ports, i), port)
+			netif_carrier_off(port);
 	rcu_read_unlock();
+	stop_torus_hello(priv);
+	for_each_possible_cpu(i)
+		if (priv->burst)
+			napi_disable(&per_cpu_ptr(priv->burst, i)->napi);
+	if (priv->dying)
+		return 0;
+	/* wait for ndo_rx() to see that dev isn't running before the purge */
+	synchronize_net();
+	for_each_possible_cpu(i)
+		if (priv->burst)
+			skb_queue_purge(&per_cpu_ptr(priv->burst, i)->q);
+	return 0;
+}
+
+/*
+ * Queue a frame received by a port to this cpu's burst, the napi poll then
+ * looks up and sends the whole burst at once.
+ */
+static void ndo_rx_burst(struct torus *priv, struct sk_buff *skb)
+{
+	struct	torus_burst *burst = this_cpu_ptr(priv->burst);
+
+	if (skb_queue_len(&burst->q) >= TORUS_BURST_BACKLOG) {
+		torus_drop(priv, &priv->rx, TORUS_DROP_BACKLOG,
+			   eth_hdr(skb)->h_dest, skb->len);
+		kfree_skb(skb);
+		return;
+	}
+	__skb_queue_tail(&burst->q, skb);
+	if (skb_queue_len(&burst->q) == 1)
+		napi_schedule(&burst->napi);
+}
+
+/*
+ * Allocate the per-cpu burst and its napi the first time torus.burst is
+ * set so that a toroid of many virtual nodes that never bursts doesn't
+ * carry a queue and napi per cpu per node; called with rtnl held.
+ */
+int alloc_torus_burst(struct net_device *dev)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_burst __percpu *burst;
+	int	cpu;
+
+	if (priv->burst)
+		return 0;
+	burst = alloc_percpu(struct torus_burst);
+	if (!burst)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		skb_queue_head_init(&per_cpu_ptr(burst, cpu)->q);
+		netif_napi_add(dev, &per_cpu_ptr(burst, cpu)->napi, ndo_poll,
+			       TORUS_BURST_MAX);
+		if (netif_running(dev))
+			napi_enable(&per_cpu_ptr(burst, cpu)->napi);
+	}
+	smp_wmb();
+	ACCESS_ONCE(priv->burst) = burst;
 	return 0;
 }
 
+/*
+ * Copy a broadcast or multicast frame to the ports of its class in the
+ * toroid's broadcast tree; skb stays with the caller.  Without coord,
+ * the originating node copies to every port and these aren't forwarded.
+ */
+static void ndo_fanout(struct torus *priv, struct sk_buff *skb, bool rx)
+{
+	struct	torus_ports *ports;
+	struct	torus_coord *c;
+	struct	sk_buff *clone;
+	struct	net_device *p;
+	const	u8 *fan = NULL;
+	int	i, n = 0, class = TORUS_FANOUT(-1, 0);
+
+	rcu_read_lock();
+	ports = rcu_dereference(priv->port);
+	c = rcu_dereference(priv->coord);
+	if (c && rx)
+		class = torus_coord_fanout(c, eth_hdr(skb)->h_source);
+	if (c && class >= 0) {
+		fan = c->fanout[class];
+		n = c->fanouts[class];
+	} else if (!rx)
+		n = ports->n;
+	/* use i = 1 vs. 0 to skip this node when flooding */
+	for (i = fan ? 0 : 1; i < n; i++) {
+		if (p = torus_port_dev(ports, fan ? fan[i] : i), !p)
+			continue;
+		if (clone = skb_clone(skb, GFP_ATOMIC), !clone) {
+			torus_drop(priv, &priv->tx, TORUS_DROP_CLONE,
+				   rx ? eth_hdr(skb)->h_dest : skb->data,
+				   skb->len);
+			continue;
+		}
+		if (rx)
+			skb_push(clone, ETH_HLEN);
+		ndo_forward(priv, p, clone);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Switch an MPLS frame by its top label rather than its destination; one
+ * that this node pops for its host goes around again as an IP frame of dev.
+ */
+static rx_handler_result_t ndo_rx_label(struct torus *priv,
+					struct net_device *dev,
+					struct sk_buff *skb)
+{
+	struct	net_device *port;
+	uint	len = skb->len, reason;
+
+	port = switch_torus_label(priv, skb, &reason);
+	if (!port) {
+		torus_drop(priv, &priv->tx, reason, NULL, len);
+		consume_skb(skb);
+		return RX_HANDLER_CONSUMED;
+	}
+	if (port != dev) {
+		count_packet(&priv->rx, len);
+		trace_torus_forward(dev, port, eth_hdr(skb)->h_dest, len);
+	}
+	skb->dev = port;
+	if (port == dev || is_torus(port))
+		return RX_HANDLER_ANOTHER;
+	skb_push(skb, ETH_HLEN);
+	if (dev_queue_xmit(skb) == 0)
+		count_packet(&priv->tx, len);
+	else
+		torus_drop(priv, &priv->tx, TORUS_DROP_XMIT, NULL, len);
+	return RX_HANDLER_CONSUMED;
+}
+
 static rx_handler_result_t ndo_rx(struct sk_buff **pskb)
 {
 	struct	net_device *dev, *port;
 	struct	torus *priv;
 	struct	ethhdr *e = eth_hdr(*pskb);
+	struct	torus_skb_cb *cb = TORUS_SKB_CB(*pskb);
+	struct	torus_latency __percpu *latency;
 	uint	len = (*pskb)->len;
 	
 	if (is_torus((*pskb)->dev))
@@ -98,83 +299,329 @@ static rx_handler_result_t ndo_rx(struct sk_buff **pskb)
 	else
 		goto consume;
 	priv = netdev_priv(dev);
+	if (unlikely(is_torus_hello(*pskb))) {
+		recv_torus_hello(priv, dev, *pskb);
+		goto consume;
+	}
+	trace_torus_rx(dev, (*pskb)->dev, e->h_dest, len);
+	latency = torus_latency(priv);
+	cb->rx = latency ? torus_now() : 0;
+	if (dev != (*pskb)->dev) {
+		cb->in = (long)rcu_dereference((*pskb)->dev->rx_handler_data);
+		count_torus_path_rx(priv, cb->in, len);
+		cb->src = 0;
+	}
+	if (e->h_proto == htons(ETH_P_MPLS_UC))
+		return ndo_rx_label(priv, dev, *pskb);
+	if (ACCESS_ONCE(priv->burst_len) && ACCESS_ONCE(priv->burst) &&
+	    dev != (*pskb)->dev &&
+	    !is_multicast_ether_addr(e->h_dest) && netif_running(dev)) {
+		ndo_rx_burst(priv, *pskb);
+		return RX_HANDLER_CONSUMED;
+	}
 	port = is_multicast_ether_addr(e->h_dest)
-		? dev : lookup_torus_port(priv, e->h_dest);
-	if (!port)
-		goto drop;
-	ndo_rx_trace(*pskb);
+		? dev : lookup_torus_port(priv, e->h_dest, *pskb);
+	if (!port) {
+		torus_drop(priv, &priv->tx, TORUS_DROP_NO_ROUTE, e->h_dest,
+			   len);
+		goto consume;
+	}
+	if (port == dev && dev != (*pskb)->dev) {
+		/* have dev rather than the port receive the frame */
+		(*pskb)->dev = dev;
+		return RX_HANDLER_ANOTHER;
+	}
 	if (port == dev) {
-		if (!is_multicast_ether_addr(e->h_dest))
+		/*
+		 * Whether from a port, or dev_forward_skb() of a neighbor
+		 * node, a broadcast gets here once, as dev, with its
+		 * header pulled; ndo_fanout() pushes it back on each clone.
+		 */
+		if (is_multicast_ether_addr(e->h_dest)) {
+			ndo_fanout(priv, *pskb, true);
+		} else {
+			/* eth_type_trans() saw the TTL and VC as another host */
 			reset_torus_ttl(e->h_dest);
+			set_torus_vc(e->h_dest, 0);
+			if (ether_addr_equal(e->h_dest, dev->dev_addr))
+				(*pskb)->pkt_type = PACKET_HOST;
+		}
 		count_packet(&priv->rx, len);
+		count_torus_e2e(latency, cb->src);
+		trace_torus_local(dev, (*pskb)->dev, e->h_dest, len);
+		if ((*pskb)->protocol == htons(ETH_P_ARP) ||
+		    (*pskb)->protocol == htons(ETH_P_IPV6))
+			learn_torus_neigh(priv, *pskb);
 		return RX_HANDLER_PASS;
 	}
 	if (is_torus(port)) {
 		count_packet(&priv->rx, len);
+		count_torus_fwd(latency, -1, cb->rx);
+		trace_torus_forward(dev, port, e->h_dest, len);
 		(*pskb)->dev = port;
 		return RX_HANDLER_ANOTHER;
 	}
 	if (dec_torus_ttl(e->h_dest) != 0) {
 		count_packet(&priv->rx, len);
+		count_torus_fwd(latency, torus_port_index(dev, port),
+				cb->rx);
+		trace_torus_forward(dev, port, e->h_dest, len);
+		torus_ecn(priv, port, torus_port_index(dev, port), *pskb);
 		(*pskb)->dev = port;
+		skb_push(*pskb, ETH_HLEN);
 		if (dev_queue_xmit(*pskb) == 0)
 			count_packet(&priv->tx, len);
 		else
-			count_drop(&priv->tx);
+			torus_drop(priv, &priv->tx, TORUS_DROP_XMIT, NULL,
+				   len);
 		return RX_HANDLER_CONSUMED;
 	}
-drop:
-	count_drop(&priv->tx);
+	torus_drop(priv, &priv->tx, TORUS_DROP_TTL, e->h_dest, len);
 consume:
 	consume_skb(*pskb);
 	return RX_HANDLER_CONSUMED;
 }
 
-static void ndo_forward(struct torus *priv, struct net_device *dev,
+/*
+ * Look up a burst of frames within one RCU read section; then send them
+ * grouped by port and account for the whole burst with one counter update.
+ * Frames for this node go back through netif_receive_skb() as dev.
+ */
+static int ndo_poll_burst(struct torus *priv, struct torus_burst *burst,
+			  int quota)
+{
+	struct	net_device *dev, *port;
+	struct	torus_latency __percpu *latency = torus_latency(priv);
+	struct	sk_buff *skb;
+	struct	ethhdr *e;
+	uint	rx_packets = 0, tx_packets = 0, rx_drops = 0, tx_drops = 0;
+	uint	ttl_drops = 0, len;
+	u64	rx_bytes = 0, tx_bytes = 0;
+	int	i, j, n;
+
+	rcu_read_lock();
+	dev = priv->dev;
+	/* the drops are work too, so they count against quota */
+	for (n = 0; n + rx_drops < quota; ) {
+		if (skb = __skb_dequeue(&burst->q), !skb)
+			break;
+		e = eth_hdr(skb);
+		port = __lookup_torus_port(priv, e->h_dest, skb);
+		if (!port || (port != dev && !is_torus(port) &&
+			      dec_torus_ttl(e->h_dest) == 0)) {
+			if (port)
+				ttl_drops++;
+			rx_drops++;
+			trace_torus_drop(dev, port ? TORUS_DROP_TTL :
+					 TORUS_DROP_NO_ROUTE, e->h_dest,
+					 skb->len);
+			consume_skb(skb);
+			continue;
+		}
+		if (port != dev) {
+			/* dev counts its own frames on their second round */
+			rx_packets++;
+			rx_bytes += skb->len;
+		}
+		burst->skb[n] = skb;
+		burst->port[n++] = port;
+	}
+	rcu_read_unlock();
+	for (i = 0; i < n; i++) {
+		if (!burst->skb[i])
+			continue;
+		port = burst->port[i];
+		for (j = i; j < n; j++) {
+			if (skb = burst->skb[j], !skb || burst->port[j] != port)
+				continue;
+			burst->skb[j] = NULL;
+			skb->dev = port;
+			if (port != dev) {
+				count_torus_fwd(latency,
+						torus_port_index(dev, port),
+						TORUS_SKB_CB(skb)->rx);
+				trace_torus_forward(dev, port,
+						    eth_hdr(skb)->h_dest,
+						    skb->len);
+			}
+			if (port == dev || is_torus(port)) {
+				netif_receive_skb(skb);
+				continue;
+			}
+			torus_ecn(priv, port, torus_port_index(dev, port), skb);
+			len = skb->len;
+			skb_push(skb, ETH_HLEN);
+			if (dev_queue_xmit(skb) == 0) {
+				tx_packets++;
+				tx_bytes += len;
+			} else {
+				tx_drops++;
+				trace_torus_drop(dev, TORUS_DROP_XMIT, NULL,
+						 len);
+			}
+		}
+	}
+	if (rx_packets)
+		count_packets(&priv->rx, rx_packets, rx_bytes);
+	if (tx_packets)
+		count_packets(&priv->tx, tx_packets, tx_bytes);
+	if (rx_drops || tx_drops) {
+		count_drops(&priv->tx, rx_drops + tx_drops);
+		if (rx_drops - ttl_drops)
+			count_drop_reason(priv->drop, TORUS_DROP_NO_ROUTE,
+					  rx_drops - ttl_drops);
+		if (ttl_drops)
+			count_drop_reason(priv->drop, TORUS_DROP_TTL,
+					  ttl_drops);
+		if (tx_drops)
+			count_drop_reason(priv->drop, TORUS_DROP_XMIT,
+					  tx_drops);
+	}
+	return n + rx_drops;
+}
+
+static int ndo_poll(struct napi_struct *napi, int budget)
+{
+	struct	torus *priv = netdev_priv(napi->dev);
+	struct	torus_burst *burst = container_of(napi, struct torus_burst,
+						   napi);
+	int	n, work = 0;
+
+	while (work < budget) {
+		n = ndo_poll_burst(priv, burst,
+				   min_t(int, budget - work,
+					 ACCESS_ONCE(priv->burst_len) ? :
+					 TORUS_BURST_MAX));
+		if (n == 0)
+			break;
+		work += n;
+	}
+	if (work < budget)
+		napi_complete(napi);
+	return work;
+}
+
+/*
+ * ndo_forward returns true if dev took skb, otherwise the drop is counted
+ */
+static bool ndo_forward(struct torus *priv, struct net_device *dev,
 			struct sk_buff *skb)
 {
 	uint	len = skb->len;
+	int	err;
 
-	ndo_tx_trace(skb);
+	count_torus_fwd(torus_latency(priv),
+			torus_port_index(priv->dev, dev),
+			TORUS_SKB_CB(skb)->rx);
+	trace_torus_forward(priv->dev, dev, skb->data, len);
 	if (is_torus(dev)) {
-		if (dev_forward_skb(dev, skb) == NET_RX_SUCCESS)
-			count_packet(&priv->tx, len);
-		else
-			count_drop(&priv->tx);
+		/* the next node takes the last hop's dimension from dim */
+		TORUS_SKB_CB(skb)->in = 0;
+		err = dev_forward_skb(dev, skb) == NET_RX_SUCCESS ? 0 : -EIO;
 	} else {
+		torus_ecn(priv, dev, torus_port_index(priv->dev, dev), skb);
 		skb->dev = dev;
-		if (dev_queue_xmit(skb) == 0)
-			count_packet(&priv->tx, len);
-		else
-			count_drop(&priv->tx);
+		err = dev_queue_xmit(skb);
+	}
+	if (err == 0) {
+		count_packet(&priv->tx, len);
+		return true;
 	}
+	torus_drop(priv, &priv->tx, TORUS_DROP_XMIT, NULL, len);
+	return false;
+}
+
+/*
+ * Spread host sourced flows over the tx queues by flow hash so that each
+ * flow stays in order on one queue.
+ */
+static u16 ndo_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	u32	hash = skb_get_rxhash(skb);
+
+	return (u16)(((u64)hash * dev->real_num_tx_queues) >> 32);
 }
 
+/*
+ * count_torus_queue counts a host sourced frame as sent, or dropped, by
+ * tx queue i in this cpu's entry, so no lock is needed.
+ */
+static void count_torus_queue(struct net_device *dev, u16 i, uint len,
+			      bool sent)
+{
+	struct	torus *priv = netdev_priv(dev);
+
+	if (sent)
+		count_queue_packet(priv->queue, i, len);
+	else
+		count_queue_drop(priv->queue, i);
+}
+
+/*
+ * Forward a host sourced MPLS frame by its top label; the host can't send
+ * itself one to pop.
+ */
+static bool ndo_tx_label(struct torus *priv, struct sk_buff *skb)
+{
+	struct	net_device *port;
+	uint	len = skb->len, reason = TORUS_DROP_NO_ROUTE;
+
+	skb_reset_mac_header(skb);
+	__skb_pull(skb, ETH_HLEN);
+	rcu_read_lock();
+	port = switch_torus_label(priv, skb, &reason);
+	rcu_read_unlock();
+	if (!port || port == priv->dev) {
+		torus_drop(priv, &priv->tx, reason, NULL, len);
+		consume_skb(skb);
+		return false;
+	}
+	__skb_push(skb, ETH_HLEN);
+	skb->dev = port;
+	return ndo_forward(priv, port, skb);
+}
+
+/*
+ * The frame's tx queue counts it only once it's sent, or fanned out.
+ */
 static netdev_tx_t ndo_tx(struct sk_buff *skb, struct net_device *dev)
 {
 	struct	torus *priv = netdev_priv(dev);
 	struct	ethhdr *e = (struct ethhdr *)skb->data;
-	struct	sk_buff *clone;
+	struct	torus_skb_cb *cb = TORUS_SKB_CB(skb);
 	struct	net_device *port;
-	int	i;
+	u16	queue = skb_get_queue_mapping(skb);
+	uint	len = skb->len;
+	bool	sent = true;
 
-	if (is_torus_router(e->h_dest))
+	cb->rx = 0;
+	cb->src = torus_latency(priv) ? torus_now() : 0;
+	cb->in = 0;
+	cb->dim = -1;
+	if (e->h_proto == htons(ETH_P_MPLS_UC)) {
+		sent = ndo_tx_label(priv, skb);
+		goto out;
+	}
+	if (is_torus_router(e->h_dest)) {
 		set_torus_dest(priv, skb);
+		e = (struct ethhdr *)skb->data;
+	}
 	if (is_multicast_ether_addr(e->h_dest)) {
-		/* use i = 1 vs. 0 to skip this node */
-		for (i = 1; i < priv->ports; i++)
-			if (priv->port[i])
-				if (clone = skb_clone(skb, GFP_ATOMIC), clone)
-					ndo_forward(priv, priv->port[i], clone);
+		if (!proxy_torus_neigh(priv, skb))
+			ndo_fanout(priv, skb, false);
 		consume_skb(skb);
-	} else if (port = lookup_torus_port(priv, e->h_dest), port != NULL) {
+	} else if (port = lookup_torus_port(priv, e->h_dest, skb), port) {
 		init_torus_ttl(e->h_dest);
 		skb->dev = port;
-		ndo_forward(priv, port, skb);
+		sent = ndo_forward(priv, port, skb);
 	} else {
-		count_drop(&priv->tx);
+		sent = false;
+		torus_drop(priv, &priv->tx, TORUS_DROP_NO_ROUTE, e->h_dest,
+			   skb->len);
 		consume_skb(skb);
 	}
+out:
+	count_torus_queue(dev, queue, len, sent);
 	return NETDEV_TX_OK;
 }
 
@@ -204,21 +651,58 @@ ndo_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *cnt)
 	return cnt;
 }
 
+/*
+ * Limit the GSO frames of dev to what its physical ports may send; since
+ * virtual ports pass them whole, a virtual toroid keeps the maximum.  dev
+ * also reserves the most headroom of any port, e.g. a torus_udp port's
+ * outer headers, so host sourced frames needn't be reallocated on egress.
+ */
+static void update_torus_limits(struct torus *priv)
+{
+	struct	torus_ports *ports;
+	struct	net_device *p;
+	uint	size = GSO_MAX_SIZE, segs = GSO_MAX_SEGS, headroom = 0;
+	int	i;
+
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	for (i = 1; ports && i < ports->n; i++) {
+		if (p = ports->port[i].dev, !p || p == priv->dev->master)
+			continue;
+		headroom = max_t(uint, headroom, p->needed_headroom);
+		if (is_torus(p))
+			continue;
+		size = min_t(uint, size, p->gso_max_size);
+		segs = min_t(uint, segs, p->gso_max_segs);
+	}
+	mutex_unlock(&priv->port_mutex);
+	netif_set_gso_max_size(priv->dev, size);
+	priv->dev->gso_max_segs = segs;
+	priv->dev->needed_headroom = headroom;
+}
+
+/*
+ * The rx_handler_data of a port is its index in port[]
+ */
 static int ndo_set_master(struct net_device *master, struct net_device *dev)
 {
 	struct torus *sub_priv, *priv = netdev_priv(master);
-	int	err;
+	int	i, err;
 
-	if (err = add_torus_port(priv, dev), err < 0)
+	if (i = add_torus_port(priv, dev), i < 0) {
+		err = i;
 		goto err_add_port;
+	}
 	if (err = netdev_set_master(dev, master), err < 0)
 		goto err_set_master;
 	if (is_torus(dev)) {
 		sub_priv = netdev_priv(dev);
 		if (err = add_torus_port(sub_priv, master), err < 0)
 			goto err_sub_add_port;
-	} else if (err = register_ndo_rx(dev, master), err < 0)
+	} else if (err = register_ndo_rx(dev, (void *)(long)i), err < 0)
 		goto err_rx_handler_register;
+	update_torus_coord(priv);
+	update_torus_limits(priv);
 	return 0;
 err_rx_handler_register:
 err_sub_add_port:
@@ -232,18 +716,24 @@ err_add_port:
 static int ndo_unset_master(struct net_device *master, struct net_device *dev)
 {
 	struct torus *priv = netdev_priv(master);
+	int	err;
 
 	if (!is_torus(dev))
 		netdev_rx_handler_unregister(dev);
 	netdev_set_master(dev, NULL);
-	return rm_torus_port(priv, dev);
+	err = rm_torus_port(priv, dev);
+	update_torus_coord(priv);
+	update_torus_limits(priv);
+	return err;
 }
 
 const struct net_device_ops torus_netdev = {
 	.ndo_init            = ndo_init,
+	.ndo_uninit          = ndo_uninit,
 	.ndo_open            = ndo_open,
 	.ndo_stop            = ndo_close,
 	.ndo_start_xmit      = ndo_tx,
+	.ndo_select_queue    = ndo_select_queue,
 	.ndo_change_mtu      = ndo_change_mtu,
 	.ndo_get_stats64     = ndo_get_stats64,
 	.ndo_set_mac_address = eth_mac_addr,
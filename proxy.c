@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <linux/jhash.h>
+#include <linux/socket.h>
+#include <linux/if_arp.h>
+#include <linux/icmpv6.h>
+#include <net/arp.h>
+#include <net/ndisc.h>
+#include <net/ip6_checksum.h>
+#include <torus.h>
+
+static inline uint torus_ip_len(u8 family)
+{
+	return family == AF_INET ? sizeof(__be32) : sizeof(struct in6_addr);
+}
+
+static inline struct hlist_head *torus_proxy_head(struct torus_proxy *p,
+						  u8 family, const u8 *ip)
+{
+	return &p->tbl[jhash(ip, torus_ip_len(family), family) &
+		       (TORUS_PROXY_SZ - 1)];
+}
+
+/*
+ * find_torus_binding must be called within rcu_read_lock() or with lock
+ */
+static struct torus_binding *find_torus_binding(struct torus_proxy *p,
+						u8 family, const u8 *ip)
+{
+	struct	torus_binding *b;
+	struct	hlist_node *pos;
+
+	__hlist_for_each_rcu(pos, torus_proxy_head(p, family, ip)) {
+		b = hlist_entry(pos, struct torus_binding, node);
+		if (b->family == family &&
+		    !memcmp(b->ip, ip, torus_ip_len(family)))
+			return b;
+	}
+	return NULL;
+}
+
+static inline bool is_stale_torus_binding(const struct torus_binding *b)
+{
+	return b->learned &&
+		time_after(jiffies, ACCESS_ONCE(b->heard) +
+			   msecs_to_jiffies(TORUS_PROXY_AGE_MS));
+}
+
+static void del_torus_binding(struct torus_proxy *p, struct torus_binding *b)
+{
+	hlist_del_rcu(&b->node);
+	kfree_rcu(b, rcu);
+	p->n--;
+}
+
+/*
+ * expire_torus_bindings removes the stale learned bindings; this must be
+ * called with lock.
+ */
+static void expire_torus_bindings(struct torus_proxy *p)
+{
+	struct	torus_binding *b;
+	struct	hlist_node *pos, *tmp;
+	int	i;
+
+	for (i = 0; i < TORUS_PROXY_SZ; i++)
+		hlist_for_each_safe(pos, tmp, &p->tbl[i]) {
+			b = hlist_entry(pos, struct torus_binding, node);
+			if (is_stale_torus_binding(b))
+				del_torus_binding(p, b);
+		}
+}
+
+/*
+ * bind_torus_ip adds or updates the binding of ip to addr unless a learned
+ * one would replace one pushed through netlink; relearning a binding
+ * refreshes it and a full table first drops the stale ones.  This must be
+ * called with lock.
+ */
+static int bind_torus_ip(struct torus_proxy *p, u8 family, const u8 *ip,
+			 const u8 *addr, bool learned, gfp_t gfp)
+{
+	struct	torus_binding *b;
+
+	if (b = find_torus_binding(p, family, ip), b) {
+		if (learned && !b->learned)
+			return 0;
+		if (!memcmp(b->addr, addr, TORUS_ALEN) &&
+		    b->learned == learned) {
+			ACCESS_ONCE(b->heard) = jiffies;
+			return 0;
+		}
+		del_torus_binding(p, b);
+	}
+	if (p->n >= TORUS_PROXY_MAX)
+		expire_torus_bindings(p);
+	if (p->n >= TORUS_PROXY_MAX)
+		return -ENOSPC;
+	if (b = kzalloc(sizeof(*b), gfp), !b)
+		return -ENOMEM;
+	b->heard = jiffies;
+	b->family = family;
+	b->learned = learned;
+	memcpy(b->addr, addr, TORUS_ALEN);
+	memcpy(b->ip, ip, torus_ip_len(family));
+	hlist_add_head_rcu(&b->node, torus_proxy_head(p, family, ip));
+	p->n++;
+	return 0;
+}
+
+int alloc_torus_proxy(struct net_device *dev)
+{
+	struct	torus *priv = netdev_priv(dev);
+	struct	torus_proxy *p;
+	int	i;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	retonerr(p ? 0 : -ENOMEM, "alloc %s proxy", dev->name);
+	p->hits = alloc_percpu(ulong);
+	p->misses = alloc_percpu(ulong);
+	if (!p->hits || !p->misses) {
+		free_percpu(p->hits);
+		free_percpu(p->misses);
+		kfree(p);
+		retonerr(-ENOMEM, "alloc %s proxy counters", dev->name);
+	}
+	spin_lock_init(&p->lock);
+	for (i = 0; i < TORUS_PROXY_SZ; i++)
+		INIT_HLIST_HEAD(&p->tbl[i]);
+	priv->proxy = p;
+	return 0;
+}
+
+/*
+ * free_torus_proxy is called after the last reader so the bindings may be
+ * freed directly
+ */
+void free_torus_proxy(struct torus *priv)
+{
+	struct	torus_proxy *p = priv->proxy;
+	struct	hlist_node *pos, *tmp;
+	int	i;
+
+	if (!p)
+		return;
+	for (i = 0; i < TORUS_PROXY_SZ; i++)
+		hlist_for_each_safe(pos, tmp, &p->tbl[i])
+			kfree(hlist_entry(pos, struct torus_binding, node));
+	free_percpu(p->hits);
+	free_percpu(p->misses);
+	kfree(p);
+	priv->proxy = NULL;
+}
+
+/*
+ * A reply from the torus address of the binding, as if that node had
+ * answered itself, so the host then sends to it directly.
+ */
+static bool proxy_torus_arp(struct torus *priv, struct sk_buff *skb)
+{
+	struct	net_device *dev = priv->dev;
+	struct	torus_binding *b;
+	struct	sk_buff *reply;
+	struct	arphdr *arp;
+	u8	*sha, *tha;
+	__be32	sip, tip;
+
+	if (!pskb_may_pull(skb, ETH_HLEN + sizeof(*arp) +
+			   2 * (ETH_ALEN + sizeof(__be32))))
+		return false;
+	arp = (struct arphdr *)(skb->data + ETH_HLEN);
+	if (arp->ar_op != htons(ARPOP_REQUEST) ||
+	    arp->ar_hrd != htons(ARPHRD_ETHER) ||
+	    arp->ar_pro != htons(ETH_P_IP) ||
+	    arp->ar_hln != ETH_ALEN || arp->ar_pln != sizeof(__be32))
+		return false;
+	sha = (u8 *)(arp + 1);
+	memcpy(&sip, sha + ETH_ALEN, sizeof(sip));
+	tha = sha + ETH_ALEN + sizeof(sip);
+	memcpy(&tip, tha + ETH_ALEN, sizeof(tip));
+	if (sip == tip)
+		return false;	/* gratuitous */
+	rcu_read_lock();
+	b = find_torus_binding(priv->proxy, AF_INET, (u8 *)&tip);
+	if (b && is_stale_torus_binding(b))
+		b = NULL;
+	reply = b ? arp_create(ARPOP_REPLY, ETH_P_ARP, sip, dev, tip, sha,
+			       b->addr, sha) : NULL;
+	rcu_read_unlock();
+	if (!b) {
+		this_cpu_inc(*priv->proxy->misses);
+		return false;
+	}
+	this_cpu_inc(*priv->proxy->hits);
+	if (reply) {
+		reply->protocol = eth_type_trans(reply, dev);
+		netif_rx(reply);
+	}
+	return true;
+}
+
+static bool proxy_torus_nd(struct torus *priv, struct sk_buff *skb)
+{
+	struct	net_device *dev = priv->dev;
+	struct	torus_binding *b;
+	struct	sk_buff *reply;
+	struct	ipv6hdr *ip6, *rip6;
+	struct	nd_msg *ns, *na;
+	struct	ethhdr *e;
+	u8	addr[TORUS_ALEN], *opt;
+	uint	len = sizeof(*na) + 8;
+
+	if (!pskb_may_pull(skb, ETH_HLEN + sizeof(*ip6) + sizeof(*ns)))
+		return false;
+	ip6 = (struct ipv6hdr *)(skb->data + ETH_HLEN);
+	ns = (struct nd_msg *)(ip6 + 1);
+	if (ip6->nexthdr != IPPROTO_ICMPV6 ||
+	    ns->icmph.icmp6_type != NDISC_NEIGHBOUR_SOLICITATION ||
+	    ipv6_addr_any(&ip6->saddr))
+		return false;	/* not a solicitation, or a DAD probe */
+	rcu_read_lock();
+	b = find_torus_binding(priv->proxy, AF_INET6, ns->target.s6_addr);
+	if (b && is_stale_torus_binding(b))
+		b = NULL;
+	if (b)
+		memcpy(addr, b->addr, TORUS_ALEN);
+	rcu_read_unlock();
+	if (!b) {
+		this_cpu_inc(*priv->proxy->misses);
+		return false;
+	}
+	this_cpu_inc(*priv->proxy->hits);
+	reply = netdev_alloc_skb(dev, ETH_HLEN + sizeof(*rip6) + len);
+	if (!reply)
+		return true;
+	e = (struct ethhdr *)skb_put(reply, ETH_HLEN);
+	memcpy(e->h_dest, ((struct ethhdr *)skb->data)->h_source, ETH_ALEN);
+	memcpy(e->h_source, addr, ETH_ALEN);
+	e->h_proto = htons(ETH_P_IPV6);
+	rip6 = (struct ipv6hdr *)skb_put(reply, sizeof(*rip6));
+	memset(rip6, 0, sizeof(*rip6));
+	rip6->version = 6;
+	rip6->payload_len = htons(len);
+	rip6->nexthdr = IPPROTO_ICMPV6;
+	rip6->hop_limit = 255;
+	rip6->saddr = ns->target;
+	rip6->daddr = ip6->saddr;
+	na = (struct nd_msg *)skb_put(reply, len);
+	memset(na, 0, len);
+	na->icmph.icmp6_type = NDISC_NEIGHBOUR_ADVERTISEMENT;
+	na->icmph.icmp6_solicited = 1;
+	na->icmph.icmp6_override = 1;
+	na->target = ns->target;
+	opt = na->opt;
+	opt[0] = ND_OPT_TARGET_LL_ADDR;
+	opt[1] = 1;	/* in units of 8 octets */
+	memcpy(opt + 2, addr, ETH_ALEN);
+	na->icmph.icmp6_cksum = csum_ipv6_magic(&rip6->saddr, &rip6->daddr,
+						len, IPPROTO_ICMPV6,
+						csum_partial(na, len, 0));
+	reply->protocol = eth_type_trans(reply, dev);
+	netif_rx(reply);
+	return true;
+}
+
+/*
+ * proxy_torus_neigh answers a host's ARP request or neighbor solicitation
+ * from the bindings and returns true; or returns false for the caller to
+ * flood it, or any other multicast frame.  skb->data is its ethernet
+ * header, which may move.
+ */
+bool proxy_torus_neigh(struct torus *priv, struct sk_buff *skb)
+{
+	struct	ethhdr *e = (struct ethhdr *)skb->data;
+
+	if (!priv->proxy)
+		return false;
+	if (e->h_proto == htons(ETH_P_ARP))
+		return proxy_torus_arp(priv, skb);
+	if (e->h_proto == htons(ETH_P_IPV6))
+		return proxy_torus_nd(priv, skb);
+	return false;
+}
+
+/*
+ * learn_torus_neigh binds the sender of an ARP frame, or the source of a
+ * neighbor solicitation or target of an advertisement, delivered to the
+ * host when its link layer address is a torus address; skb->data is its
+ * network header.
+ */
+void learn_torus_neigh(struct torus *priv, struct sk_buff *skb)
+{
+	struct	torus_proxy *p = priv->proxy;
+	struct	arphdr *arp;
+	struct	ipv6hdr *ip6;
+	struct	nd_msg *nd;
+	const	u8 *ip = NULL, *addr = NULL;
+	u8	family = AF_INET;
+
+	if (!p)
+		return;
+	if (skb->protocol == htons(ETH_P_ARP)) {
+		if (!pskb_may_pull(skb, sizeof(*arp) +
+				   2 * (ETH_ALEN + sizeof(__be32))))
+			return;
+		arp = arp_hdr(skb);
+		if (arp->ar_hrd != htons(ARPHRD_ETHER) ||
+		    arp->ar_pro != htons(ETH_P_IP) ||
+		    arp->ar_hln != ETH_ALEN || arp->ar_pln != sizeof(__be32))
+			return;
+		addr = (u8 *)(arp + 1);
+		ip = addr + ETH_ALEN;
+	} else if (skb->protocol == htons(ETH_P_IPV6)) {
+		if (!pskb_may_pull(skb, sizeof(*ip6)) ||
+		    ipv6_hdr(skb)->nexthdr != IPPROTO_ICMPV6 ||
+		    !pskb_may_pull(skb, sizeof(*ip6) + sizeof(*nd) + 8))
+			return;
+		ip6 = ipv6_hdr(skb);
+		nd = (struct nd_msg *)(ip6 + 1);
+		if (nd->opt[1] != 1)
+			return;
+		family = AF_INET6;
+		if (nd->icmph.icmp6_type == NDISC_NEIGHBOUR_SOLICITATION &&
+		    nd->opt[0] == ND_OPT_SOURCE_LL_ADDR &&
+		    !ipv6_addr_any(&ip6->saddr))
+			ip = ip6->saddr.s6_addr;
+		else if (nd->icmph.icmp6_type ==
+			 NDISC_NEIGHBOUR_ADVERTISEMENT &&
+			 nd->opt[0] == ND_OPT_TARGET_LL_ADDR)
+			ip = nd->target.s6_addr;
+		else
+			return;
+		addr = nd->opt + 2;
+	} else
+		return;
+	if (!is_valid_torus_addr(addr))
+		return;
+	spin_lock(&p->lock);
+	bind_torus_ip(p, family, ip, addr, true, GFP_ATOMIC);
+	spin_unlock(&p->lock);
+}
+
+/*
+ * set_torus_bindings adds or updates, or with del removes, the n bindings
+ * of b; del without any removes them all, learned or not.
+ */
+int set_torus_bindings(struct torus *priv, const struct torus_genl_binding *b,
+		       uint n, bool del)
+{
+	struct	torus_proxy *p = priv->proxy;
+	struct	torus_binding *old;
+	struct	hlist_node *pos, *tmp;
+	uint	i;
+	int	err = 0;
+
+	if (!p)
+		return -ENODEV;
+	for (i = 0; i < n; i++)
+		if ((b[i].family != AF_INET && b[i].family != AF_INET6) ||
+		    (!del && !is_valid_torus_addr(b[i].addr)))
+			return -EINVAL;
+	spin_lock_bh(&p->lock);
+	if (del && !n)
+		for (i = 0; i < TORUS_PROXY_SZ; i++)
+			hlist_for_each_safe(pos, tmp, &p->tbl[i])
+				del_torus_binding(p, hlist_entry(pos,
+					struct torus_binding, node));
+	for (i = 0; i < n && !err; i++)
+		if (!del)
+			err = bind_torus_ip(p, b[i].family, b[i].ip, b[i].addr,
+					    false, GFP_ATOMIC);
+		else if (old = find_torus_binding(p, b[i].family, b[i].ip), old)
+			del_torus_binding(p, old);
+	spin_unlock_bh(&p->lock);
+	return err;
+}
+
+/*
+ * get_torus_bindings copies up to max bindings, less the stale ones, to b
+ * and returns how many
+ */
+uint get_torus_bindings(struct torus *priv, struct torus_genl_binding *b,
+			uint max)
+{
+	struct	torus_proxy *p = priv->proxy;
+	struct	torus_binding *e;
+	struct	hlist_node *pos;
+	uint	i, n = 0;
+
+	if (!p)
+		return 0;
+	rcu_read_lock();
+	for (i = 0; i < TORUS_PROXY_SZ; i++)
+		__hlist_for_each_rcu(pos, &p->tbl[i]) {
+			if (n == max)
+				goto out;
+			e = hlist_entry(pos, struct torus_binding, node);
+			if (is_stale_torus_binding(e))
+				continue;
+			memset(&b[n], 0, sizeof(b[n]));
+			b[n].family = e->family;
+			b[n].learned = e->learned;
+			memcpy(b[n].addr, e->addr, TORUS_ALEN);
+			memcpy(b[n].ip, e->ip, torus_ip_len(e->family));
+			n++;
+		}
+out:
+	rcu_read_unlock();
+	return n;
+}
+
+/*
+ * get_torus_proxy fills v[TORUS_PROXY_STATS] with the hits, misses and
+ * number of bindings
+ */
+void get_torus_proxy(struct torus *priv, u64 *v)
+{
+	struct	torus_proxy *p = priv->proxy;
+	int	cpu;
+
+	memset(v, 0, TORUS_PROXY_STATS * sizeof(*v));
+	if (!p)
+		return;
+	for_each_possible_cpu(cpu) {
+		v[0] += *per_cpu_ptr(p->hits, cpu);
+		v[1] += *per_cpu_ptr(p->misses, cpu);
+	}
+	v[2] = ACCESS_ONCE(p->n);
+}
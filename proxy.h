@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_PROXY_H__
+#define __TORUS_PROXY_H__
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/torus.h>
+#include <addr.h>
+
+#define	TORUS_PROXY_BITS	6
+#define	TORUS_PROXY_SZ		(1 << TORUS_PROXY_BITS)
+#define	TORUS_PROXY_MAX		1024
+/*
+ * learned bindings that aren't heard again within this expire
+ */
+#define	TORUS_PROXY_AGE_MS	300000
+/*
+ * the number of values from get_torus_proxy()
+ */
+#define	TORUS_PROXY_STATS	3
+
+/*
+ * A binding is the torus address of an IPv4 or IPv6 host; those pushed
+ * through netlink replace learned ones but not the reverse.  A learned
+ * binding is stamped with the jiffies that it was last heard.
+ */
+struct	torus_binding {
+	struct	hlist_node	node;
+	struct	rcu_head	rcu;
+	ulong			heard;
+	u8			family;
+	bool			learned;
+	u8			addr[TORUS_ALEN];
+	u8			ip[16];
+};
+
+/*
+ * The ARP and ND proxy answers the address resolution of the node's host
+ * from its bindings rather than flooding the requests through the toroid;
+ * it learns from the ARP and ND frames delivered to the host.  Readers
+ * walk the buckets within rcu_read_lock(), writers hold lock.
+ */
+struct	torus_proxy {
+	spinlock_t		lock;
+	uint			n;
+	ulong	__percpu	*hits;
+	ulong	__percpu	*misses;
+	struct	hlist_head	tbl[TORUS_PROXY_SZ];
+};
+
+#endif	/* __TORUS_PROXY_H__ */
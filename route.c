@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <linux/sort.h>
+#include <linux/socket.h>
+#include <torus.h>
+
+static void free_torus_rt_rcu(struct rcu_head *rcu)
+{
+	free_torus_rt(container_of(rcu, struct torus_rt, rcu));
+}
+
+static int cmp_torus_route(const void *a, const void *b)
+{
+	return (int)((const struct torus_genl_route *)a)->plen -
+		(int)((const struct torus_genl_route *)b)->plen;
+}
+
+/*
+ * Copy r to route with the prefix bits after plen cleared so that routes
+ * of the same prefix compare equal; or return -EINVAL if it's malformed.
+ */
+static int get_torus_route(struct torus_genl_route *route,
+			   const struct torus_genl_route *r, bool del)
+{
+	uint	i, bits;
+
+	if (r->family == AF_INET) {
+		if (r->plen > 32)
+			return -EINVAL;
+	} else if (r->family != AF_INET6 || r->plen > 128)
+		return -EINVAL;
+	if (!del && !is_valid_torus_addr(r->addr))
+		return -EINVAL;
+	*route = *r;
+	for (i = 0, bits = r->plen; i < sizeof(route->prefix); i++) {
+		route->prefix[i] &= bits >= 8 ? 0xff : (u8)(0xff << (8 - bits));
+		bits = bits > 8 ? bits - 8 : 0;
+	}
+	return 0;
+}
+
+static int find_torus_route(const struct torus_rt *rt,
+			    const struct torus_genl_route *r)
+{
+	int	i;
+
+	for (i = 0; i < rt->routes; i++)
+		if (rt->route[i].family == r->family &&
+		    rt->route[i].plen == r->plen &&
+		    !memcmp(rt->route[i].prefix, r->prefix, sizeof(r->prefix)))
+			return i;
+	return -1;
+}
+
+/*
+ * new_torus_rt_node returns a node of the trie with each entry a copy of
+ * fill, if any
+ */
+static struct torus_rt_node *
+new_torus_rt_node(struct torus_rt *rt, const struct torus_rt_entry *fill)
+{
+	struct	torus_rt_node *node;
+	int	i;
+
+	if (rt->n >= rt->nodes)
+		return NULL;
+	if (node = kzalloc(sizeof(*node), GFP_KERNEL), !node)
+		return NULL;
+	for (i = 0; fill && i < TORUS_RT_ENTRIES; i++)
+		node->entry[i] = *fill;
+	rt->node[rt->n++] = node;
+	return node;
+}
+
+/*
+ * Since routes are added in ascending prefix length, the entries that a
+ * prefix covers never have children yet; a child starts with a copy of
+ * the shorter prefix's entry that it splits.
+ */
+static int add_torus_rt(struct torus_rt *rt, const struct torus_genl_route *r)
+{
+	struct	torus_rt_node **root, *node;
+	struct	torus_rt_entry *e, leaf;
+	uint	plen = r->plen, level = 0, first, span, i;
+
+	root = &rt->root[r->family == AF_INET6 ? TORUS_RT_IPV6 : TORUS_RT_IPV4];
+	if (!*root && (*root = new_torus_rt_node(rt, NULL), !*root))
+		return -ENOSPC;
+	for (node = *root; plen > TORUS_RT_STRIDE; plen -= TORUS_RT_STRIDE) {
+		e = &node->entry[r->prefix[level++]];
+		if (!e->child &&
+		    (e->child = new_torus_rt_node(rt, e->valid ? e : NULL),
+		     !e->child))
+			return -ENOSPC;
+		node = e->child;
+	}
+	memset(&leaf, 0, sizeof(leaf));
+	memcpy(leaf.addr, r->addr, TORUS_ALEN);
+	leaf.valid = true;
+	span = 1 << (TORUS_RT_STRIDE - plen);
+	first = r->prefix[level] & ~(span - 1) & (TORUS_RT_ENTRIES - 1);
+	for (i = first; i < first + span; i++)
+		node->entry[i] = leaf;
+	return 0;
+}
+
+/*
+ * set_torus_routes adds, replaces or, with del, removes the n routes of r;
+ * del without any removes them all.  This must be called with rtnl held.
+ */
+int set_torus_routes(struct torus *priv, const struct torus_genl_route *r,
+		     uint n, bool del)
+{
+	struct	torus_rt *old, *rt = NULL;
+	struct	torus_genl_route route;
+	uint	i, routes;
+	int	j, err;
+
+	old = rtnl_dereference(priv->rt);
+	routes = old && (n || !del) ? old->routes : 0;
+	if (!del)
+		routes = min_t(uint, routes + n, TORUS_RT_MAX);
+	if (routes) {
+		rt = kzalloc(sizeof(*rt) + (routes * sizeof(route)),
+			     GFP_KERNEL);
+		retonerr(rt ? 0 : -ENOMEM, "alloc routes");
+		if (old && (n || !del)) {
+			rt->routes = old->routes;
+			memcpy(rt->route, old->route,
+			       old->routes * sizeof(route));
+		}
+	}
+	for (i = 0; rt && i < n; i++) {
+		if (err = get_torus_route(&route, &r[i], del), err < 0)
+			goto err_route;
+		j = find_torus_route(rt, &route);
+		if (del) {
+			if (j >= 0)
+				rt->route[j] = rt->route[--rt->routes];
+		} else if (j >= 0)
+			memcpy(rt->route[j].addr, route.addr, TORUS_ALEN);
+		else if (rt->routes < routes)
+			rt->route[rt->routes++] = route;
+		else {
+			err = -ENOSPC;
+			goto err_route;
+		}
+	}
+	if (rt && !rt->routes) {
+		kfree(rt);
+		rt = NULL;
+	}
+	if (rt) {
+		sort(rt->route, rt->routes, sizeof(route), cmp_torus_route,
+		     NULL);
+		for (i = 0, rt->nodes = 2; i < rt->routes; i++)
+			if (rt->route[i].plen > TORUS_RT_STRIDE)
+				rt->nodes += (rt->route[i].plen - 1) /
+					TORUS_RT_STRIDE;
+		rt->node = kcalloc(rt->nodes, sizeof(*rt->node), GFP_KERNEL);
+		if (!rt->node) {
+			err = -ENOMEM;
+			goto err_route;
+		}
+		for (i = 0; i < rt->routes; i++)
+			if (err = add_torus_rt(rt, &rt->route[i]), err < 0)
+				goto err_route;
+	}
+	rcu_assign_pointer(priv->rt, rt);
+	if (old)
+		call_rcu(&old->rcu, free_torus_rt_rcu);
+	return 0;
+
+err_route:
+	free_torus_rt(rt);
+	return err;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_ROUTE_H__
+#define __TORUS_ROUTE_H__
+
+#include <linux/kernel.h>
+#include <linux/rcupdate.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/torus.h>
+#include <addr.h>
+
+#define	TORUS_RT_MAX		1024
+#define	TORUS_RT_STRIDE		8
+#define	TORUS_RT_ENTRIES	(1 << TORUS_RT_STRIDE)
+#define	TORUS_RT_IPV4		0
+#define	TORUS_RT_IPV6		1
+
+/*
+ * The routes of IPv4 and IPv6 destinations to torus addresses are a
+ * multibit trie of each family that consumes a byte of the destination
+ * per node, so an IPv4 lookup reads at most four entries.  Prefixes that
+ * end within a node are expanded over every entry they cover, so the walk
+ * stops at the first entry without a child and never backtracks.
+ */
+struct	torus_rt_node;
+
+struct	torus_rt_entry {
+	struct	torus_rt_node	*child;
+	u8			addr[TORUS_ALEN];
+	bool			valid;
+};
+
+/*
+ * a node is a page of entries
+ */
+struct	torus_rt_node {
+	struct	torus_rt_entry	entry[TORUS_RT_ENTRIES];
+};
+
+/*
+ * The trie is rebuilt whole, in ascending prefix length, from the routes
+ * with each change then replaces the old; node[] has its n nodes to free
+ * them.  A route needs at most a node for each byte of its prefix after
+ * the first, so node[] is sized to the two roots and that sum; the worst
+ * case, TORUS_RT_MAX disjoint IPv6 host routes, is 15 nodes or 60KB each.
+ */
+struct	torus_rt {
+	struct	rcu_head	rcu;
+	struct	torus_rt_node	*root[2];
+	struct	torus_rt_node	**node;
+	uint			nodes;
+	uint			n;
+	uint			routes;
+	struct	torus_genl_route route[0];
+};
+
+static inline const u8 *torus_rt_match(const struct torus_rt_node *node,
+				       const u8 *key, uint len)
+{
+	const	struct torus_rt_entry *e;
+	uint	i;
+
+	for (i = 0; node && i < len; i++, node = e->child) {
+		e = &node->entry[key[i]];
+		if (!e->child)
+			return e->valid ? e->addr : NULL;
+	}
+	return NULL;
+}
+
+/*
+ * lookup_torus_rt returns the torus address of the longest prefix of the
+ * IPv4 or IPv6 destination of the ethernet frame in skb, or NULL; it must
+ * be called within rcu_read_lock() and may move skb->data.
+ */
+static inline const u8 *lookup_torus_rt(const struct torus_rt *rt,
+					struct sk_buff *skb)
+{
+	const	struct ethhdr *e = (struct ethhdr *)skb->data;
+
+	switch (e->h_proto) {
+	case htons(ETH_P_IP):
+		if (!rt->root[TORUS_RT_IPV4] ||
+		    !pskb_may_pull(skb, ETH_HLEN + sizeof(struct iphdr)))
+			return NULL;
+		return torus_rt_match(rt->root[TORUS_RT_IPV4],
+				      (u8 *)&((struct iphdr *)
+					      (skb->data + ETH_HLEN))->daddr,
+				      sizeof(__be32));
+	case htons(ETH_P_IPV6):
+		if (!rt->root[TORUS_RT_IPV6] ||
+		    !pskb_may_pull(skb, ETH_HLEN + sizeof(struct ipv6hdr)))
+			return NULL;
+		return torus_rt_match(rt->root[TORUS_RT_IPV6],
+				      ((struct ipv6hdr *)
+				       (skb->data + ETH_HLEN))->daddr.s6_addr,
+				      sizeof(struct in6_addr));
+	}
+	return NULL;
+}
+
+static inline void free_torus_rt(struct torus_rt *rt)
+{
+	uint	i;
+
+	if (!rt)
+		return;
+	for (i = 0; i < rt->n; i++)
+		kfree(rt->node[i]);
+	kfree(rt->node);
+	kfree(rt);
+}
+
+#endif	/* __TORUS_ROUTE_H__ */
@@ -16,14 +16,26 @@
  */
 
 #include <torus.h>
+#include <linux/moduleparam.h>
 
 struct rtnl_link_ops torus_rtnl;
 
+/*
+ * Without node_sysfs, only the master of a virtual toroid has the torus
+ * sysfs attributes; that saves the files of thousands of nodes.
+ */
+static bool node_sysfs = true;
+module_param(node_sysfs, bool, 0644);
+MODULE_PARM_DESC(node_sysfs, "add sysfs attributes to virtual toroid nodes");
+
 static const struct nla_policy rto_policy[] = {
 	[TORUS_VERSION_ATTR]	= { .type = NLA_U32 },
 	[TORUS_ROWS_ATTR]	= { .type = NLA_U32 },
 	[TORUS_COLS_ATTR]	= { .type = NLA_U32 },
-	[TORUS_MASTER_ATTR]	= { .type = NLA_STRING, .len = IFNAMSIZ }
+	[TORUS_MASTER_ATTR]	= { .type = NLA_STRING, .len = IFNAMSIZ },
+	[TORUS_QUEUES_ATTR]	= { .type = NLA_U32 },
+	[TORUS_DIMS_ATTR]	= { .type = NLA_BINARY,
+				    .len = TORUS_MAX_DIMS * sizeof(u16) }
 };
 
 static struct net_device *get_named_dev(struct net *net, const char *name)
@@ -55,9 +67,21 @@ static inline struct net_device *get_dev_by_attr(struct net *net,
 static void rto_destructor(struct net_device *dev)
 {
 	struct	torus *priv = netdev_priv(dev);
+	int	cpu;
 
-	free_percpu_counters(&priv->rx);
-	free_percpu_counters(&priv->tx);
+	free_torus_counters(priv);
+	/* an ndo_rx() that raced the close may have queued to the burst */
+	if (priv->burst) {
+		for_each_possible_cpu(cpu)
+			skb_queue_purge(&per_cpu_ptr(priv->burst, cpu)->q);
+		free_percpu(priv->burst);
+	}
+	if (priv->latency)
+		free_percpu(priv->latency);
+	free_torus_hello(priv);
+	free_torus_proxy(priv);
+	if (priv->queue)
+		free_percpu(priv->queue);
 	free_torus(priv);
 	free_torus_node(priv);
 	free_netdev(dev);
@@ -67,21 +91,23 @@ static void rto_setup(struct net_device *dev)
 {
 	struct	torus *priv = netdev_priv(dev);
 
-	alloc_percpu_counters(&priv->rx);
-	alloc_percpu_counters(&priv->tx);
-	alloc_torus(priv);
+	priv->dev = dev;
 	ether_setup(dev);
 	dev->priv_flags &= ~IFF_TX_SKB_SHARING;
 	dev->netdev_ops = &torus_netdev;
 	dev->ethtool_ops = &torus_ethtool;
-	dev->features |= NETIF_F_LLTX;
+	dev->features |= NETIF_F_LLTX | TORUS_FEATURES;
 	dev->destructor = rto_destructor;
-	dev->hw_features = NETIF_F_HW_CSUM | NETIF_F_SG | NETIF_F_RXCSUM;
+	dev->hw_features = TORUS_FEATURES;
+	dev->vlan_features = TORUS_FEATURES;
 }
 
 static int rto_validate(struct nlattr *tb[], struct nlattr *data[])
 {
 	const u8 *addr;
+	const u16 *size;
+	u32	nodes = 1;
+	int	len, d;
 
 	if (tb[IFLA_MTU])
 		retonerange(nla_get_u32(tb[IFLA_MTU]),
@@ -98,94 +124,190 @@ static int rto_validate(struct nlattr *tb[], struct nlattr *data[])
 	retonerr(data[TORUS_VERSION_ATTR] ? 0 : -EINVAL, "no VERSION");
 	retonerange(nla_get_u32(data[TORUS_VERSION_ATTR]),
 		    TORUS_MIN_VERSION, TORUS_MAX_VERSION, "VERSION");
-	if (data[TORUS_ROWS_ATTR])
+	if (data[TORUS_ROWS_ATTR]) {
 		retonerange(nla_get_u32(data[TORUS_ROWS_ATTR]),
 			    TORUS_MIN_ROWS, TORUS_MAX_ROWS, "ROWS");
+		retonerr(data[TORUS_COLS_ATTR] ? 0 : -EINVAL, "no COLS");
+	}
 	if (data[TORUS_COLS_ATTR])
 		retonerange(nla_get_u32(data[TORUS_COLS_ATTR]),
 			    TORUS_MIN_COLS, TORUS_MAX_COLS, "COLS");
+	if (data[TORUS_DIMS_ATTR]) {
+		len = nla_len(data[TORUS_DIMS_ATTR]);
+		retonerr(len && !(len % sizeof(u16)) ? 0 : -EINVAL,
+			 "invalid DIMS");
+		size = nla_data(data[TORUS_DIMS_ATTR]);
+		for (d = 0; d < len / sizeof(u16); d++) {
+			retonerange(size[d], TORUS_MIN_SIZE, TORUS_MAX_SIZE,
+				    "DIMS");
+			nodes *= size[d];
+		}
+		retonerange(nodes, TORUS_MIN_SIZE, TORUS_MAX_NODES, "nodes");
+	}
 	if (data[TORUS_MASTER_ATTR])
 		retonerr(get_dev_by_attr(NULL, data[TORUS_MASTER_ATTR])
 			 ? 0 : -ENODEV, "can't find master");
+	if (data[TORUS_QUEUES_ATTR])
+		retonerange(nla_get_u32(data[TORUS_QUEUES_ATTR]),
+			    TORUS_MIN_QUEUES, TORUS_MAX_QUEUES, "QUEUES");
 	return 0;
 }
 
-static int rto_init_node(struct net_device *dev, u32 nodes)
+/*
+ * Allocate a tx and rx queue for each possible cpu; rto_set_queues() then
+ * limits those in use to the online cpus or the QUEUES attribute.  The
+ * nodes of a virtual toroid only have the QUEUES, or one, instead; see
+ * rto_node_tb().
+ */
+static unsigned int rto_get_num_queues(void)
+{
+	return min_t(unsigned int, num_possible_cpus(), TORUS_MAX_QUEUES);
+}
+
+static int rto_set_queues(struct net_device *dev, u32 queues)
+{
+	if (queues == 0)
+		queues = num_online_cpus();
+	queues = min_t(u32, queues, dev->num_tx_queues);
+	retonerr(netif_set_real_num_tx_queues(dev, queues),
+		 "set %s tx queues", dev->name);
+	retonerr(netif_set_real_num_rx_queues(dev, min_t(u32, queues,
+							 dev->num_rx_queues)),
+		 "set %s rx queues", dev->name);
+	return 0;
+}
+
+static int rto_init_node(struct net_device *dev, bool sysfs)
 {
 	struct	torus *priv = netdev_priv(dev);
-	struct	net_device **port;
 
 	spin_lock_init(&priv->lock);
 	if (strchr(dev->name, '%'))
 		retonerr(dev_alloc_name(dev, dev->name), "alloc %s", dev->name);
-	retonerr(priv->ports == 0 ? -ENOMEM : 0,
-		 "%s has zero ports", dev->name);
-	port = rcu_dereference(priv->port);
-	port[0] = dev;
-	memcpy(rcu_dereference(priv->peer), dev->dev_addr, TORUS_ALEN);
+	if (sysfs)
+		set_torus_sysfs(dev);
 	retonerr(register_netdevice(dev), "register %s", dev->name);
 	netif_carrier_off(dev);
-	create_torus_sysfs(dev);
-	pr_torus_info("new %*s %pM", IFNAMSIZ, dev->name, dev->dev_addr);
+	pr_torus_debug("new %*s %pM", IFNAMSIZ, dev->name, dev->dev_addr);
+	return 0;
+}
+
+/*
+ * rto_node_tb copies tb to ntb with the number of tx and rx queues of a
+ * node of a virtual toroid, unless given, in nq; its host sourced frames
+ * are few beside those forwarded, and a queue per possible cpu of each
+ * of thousands of nodes would add up.
+ */
+struct	rto_nq {
+	struct	nlattr	nla;
+	u32		queues;
+};
+
+static void rto_node_tb(struct nlattr *ntb[], struct nlattr *tb[],
+			struct rto_nq *nq, u32 queues)
+{
+	memcpy(ntb, tb, (IFLA_MAX + 1) * sizeof(*ntb));
+	nq->nla.nla_len = nla_attr_size(sizeof(nq->queues));
+	nq->nla.nla_type = IFLA_NUM_TX_QUEUES;
+	nq->queues = queues ? queues : 1;
+	if (!ntb[IFLA_NUM_TX_QUEUES])
+		ntb[IFLA_NUM_TX_QUEUES] = &nq->nla;
+	if (!ntb[IFLA_NUM_RX_QUEUES])
+		ntb[IFLA_NUM_RX_QUEUES] = &nq->nla;
+}
+
+/*
+ * rto_get_dims returns the number of dimensions of a virtual toroid, with
+ * their sizes in size[], from either the DIMS or the ROWS and COLS
+ * attributes; or 0 for a single node.
+ */
+static uint rto_get_dims(struct nlattr *data[], u16 *size)
+{
+	uint	dims;
+
+	if (!data)
+		return 0;
+	if (data[TORUS_DIMS_ATTR]) {
+		dims = nla_len(data[TORUS_DIMS_ATTR]) / sizeof(u16);
+		memcpy(size, nla_data(data[TORUS_DIMS_ATTR]),
+		       dims * sizeof(u16));
+		return dims;
+	}
+	if (data[TORUS_ROWS_ATTR]) {
+		size[0] = nla_get_u32(data[TORUS_ROWS_ATTR]);
+		size[1] = nla_get_u32(data[TORUS_COLS_ATTR]);
+		return 2;
+	}
 	return 0;
 }
 
-static inline void rto_assign_peers(struct torus *priv)
+/*
+ * The node id is the mixed radix number of the coordinates with the last
+ * dimension the least significant; each coordinate is added to the
+ * address byte of its dimension.
+ */
+static void rto_node_addr(u8 *addr, u32 id, uint dims, const u16 *size)
 {
-	/* FIXME this will be replaced with a discovery protocol */
-	struct	torus *node_priv;
-	struct	net_device **node_port;
-	u8	*peer, *addr, *node_lu;
-	int	i, j;
-
-	for (i = 0; i < priv->nodes; i++) {
-		node_priv = netdev_priv(priv->node[i]);
-		node_port = rcu_dereference(node_priv->port);
-		node_lu = rcu_dereference(node_priv->lu);
-		for (j = 0; j < node_priv->ports; j++)
-			if (node_port[j] != NULL) {
-				peer = rcu_dereference(node_priv->peer)
-					+ (j * TORUS_ALEN);
-				addr = node_port[j]->dev_addr;
-				memcpy(peer, addr, TORUS_ALEN);
-#if 1
-				node_lu[TORUS_LU(addr, 3)] = j;
-#else
-				/* use this w/in the discovery protocol */
-				set_torus_lu(node_priv, addr, 3, j);
-#endif
-			}
+	int	d;
+
+	for (d = dims - 1; d >= 0; d--) {
+		addr[TORUS_COORD_BYTE(dims, d)] += id % size[d];
+		id /= size[d];
 	}
 }
 
-static inline void rto_assign_ports(struct torus *priv, u32 rows, u32 cols)
+/*
+ * rto_link_node adds node_dev to the ports of node_priv with its peer
+ * already known so that the coordinates find their ports before the
+ * hellos.
+ */
+static void rto_link_node(struct torus *node_priv, struct net_device *node_dev)
+{
+	int	i;
+
+	if (i = add_torus_port(node_priv, node_dev), i <= 0)
+		return;
+	mutex_lock(&node_priv->port_mutex);
+	memcpy(torus_ports_locked(node_priv)->port[i].peer, node_dev->dev_addr,
+	       TORUS_ALEN);
+	mutex_unlock(&node_priv->port_mutex);
+}
+
+/*
+ * Link each node with its plus neighbor in each dimension, that's stride[d]
+ * away within the ring of that dimension.
+ */
+static inline void rto_assign_ports(struct torus *priv, uint dims,
+				    const u16 *size)
 {
-	struct	torus *node_priv, *neighbor_priv;
-	struct	net_device *node_dev, **node_port;
-	struct	net_device *neighbor_dev, **neighbor_port;
-	u32	node_id, neighbor_id;
+	struct	torus *node_priv;
+	struct	net_device *node_dev, *neighbor_dev;
+	u32	node_id, neighbor_id, stride[TORUS_MAX_DIMS], coord;
+	u8	origin[TORUS_MAX_DIMS];
+	int	d;
 
+	for (d = dims - 1; d >= 0; d--) {
+		stride[d] = d == dims - 1 ? 1 : stride[d + 1] * size[d + 1];
+		origin[d] = priv->node[0]->dev_addr[TORUS_COORD_BYTE(dims, d)];
+	}
 	for (node_id = 0; node_id < priv->nodes; node_id++) {
 		node_dev = priv->node[node_id];
 		node_priv = netdev_priv(node_dev);
-		node_port = rcu_dereference(node_priv->port);
-		neighbor_id = (node_id + cols) % priv->nodes;
-		neighbor_dev = priv->node[neighbor_id];
-		neighbor_priv = netdev_priv(neighbor_dev);
-		neighbor_port = rcu_dereference(neighbor_priv->port);
-		add_torus_port(node_priv, neighbor_dev);
-		add_torus_port(neighbor_priv, node_dev);
-
-		neighbor_id =  node_id + 1;
-		if (neighbor_id % cols == 0)
-			neighbor_id -= cols;
-		neighbor_dev = priv->node[neighbor_id];
-		neighbor_priv = netdev_priv(neighbor_dev);
-		neighbor_port = rcu_dereference(neighbor_priv->port);
-		add_torus_port(node_priv, neighbor_dev);
-		add_torus_port(neighbor_priv, node_dev);
+		if (node_priv->hello)
+			node_priv->hello->interval = TORUS_HELLO_VIRTUAL_MS;
+		for (d = 0; d < dims; d++) {
+			coord = (node_id / stride[d]) % size[d];
+			neighbor_id = coord == size[d] - 1
+				? node_id - (coord * stride[d])
+				: node_id + stride[d];
+			neighbor_dev = priv->node[neighbor_id];
+			rto_link_node(node_priv, neighbor_dev);
+			rto_link_node(netdev_priv(neighbor_dev), node_dev);
+		}
 	}
-	rto_assign_peers(priv);
+	for (node_id = 0; node_id < priv->nodes; node_id++)
+		set_torus_coord(netdev_priv(priv->node[node_id]), dims, size,
+				origin);
 }
 
 static void rto_ifname(u8 *name, struct nlattr *tb[], struct net_device *master)
@@ -202,87 +324,137 @@ static void rto_ifname(u8 *name, struct nlattr *tb[], struct net_device *master)
 	} while (get_named_dev(NULL, name));
 }
 
+static void rto_dellink(struct net_device *, struct list_head *);
+
+/*
+ * The nodes of a virtual toroid are named by their id after the master's
+ * name, e.g. te0.1; or, if that's taken or too long, by the first free
+ * number after as much of the master's name as fits, for dev_alloc_name().
+ */
+static void rto_node_ifname(u8 *name, struct net_device *dev, u32 id,
+			    struct net *net)
+{
+	if (snprintf(name, IFNAMSIZ, "%s.%u", dev->name, id) < IFNAMSIZ &&
+	    !__dev_get_by_name(net, name))
+		return;
+	snprintf(name, IFNAMSIZ, "%.*s.%%d", IFNAMSIZ - 8, dev->name);
+}
+
+/*
+ * The nodes of a virtual toroid are registered before its master, dev, so
+ * that a failure of any of them, or of dev, only has to unregister those
+ * made so far and return the unregistered dev for rtnl_newlink() to free.
+ */
 static int rto_newlink(struct net *net, struct net_device *dev,
 		       struct nlattr *tb[], struct nlattr *data[])
 {
 	struct	torus *priv = netdev_priv(dev);
-	struct	net *dest_net;
+	struct	net *dest_net = NULL;
 	struct	net_device *node, *master = NULL;
+	struct	nlattr *ntb[IFLA_MAX + 1];
+	struct	rto_nq nq;
+	LIST_HEAD(kill);
 	u8	name[IFNAMSIZ];
-	u32	rows = 0, cols = 0;
+	u16	size[TORUS_MAX_DIMS];
+	u32	nodes = 1, queues = 0;
+	u64	start = torus_now();
+	uint	dims;
 	int	i, err;
 
 	if (data) {
+		if (data[TORUS_QUEUES_ATTR])
+			queues = nla_get_u32(data[TORUS_QUEUES_ATTR]);
 		if (data[TORUS_MASTER_ATTR])
 			master = get_dev_by_attr(net, data[TORUS_MASTER_ATTR]);
-		if (data[TORUS_ROWS_ATTR]) {
-			rows = nla_get_u32(data[TORUS_ROWS_ATTR]);
-			cols = nla_get_u32(data[TORUS_COLS_ATTR]);
-			priv->nodes = rows * cols;
-			retonerr(alloc_torus_node(priv, priv->nodes),
-				 "alloc node table");
-			priv->node[0] = dev;
-		}
+	}
+	if (dims = rto_get_dims(data, size), dims) {
+		for (i = 0; i < dims; i++)
+			nodes *= size[i];
+		retonerr(alloc_torus_node(priv, nodes), "alloc node table");
+		priv->node[0] = dev;
 	}
 	rto_ifname(dev->name, tb, master);
+	if (strchr(dev->name, '%'))
+		gotonerr(err_nodes, err = dev_alloc_name(dev, dev->name),
+			 "alloc %s", dev->name);
 	if (!tb[IFLA_ADDRESS])
 		random_torus_addr(dev);
-	retonerr(rto_init_node(dev, priv->nodes), "init %s", dev->name);
-	if (master)
-		set_torus_master(master, dev);
-	if (priv->nodes == 0)
-		return 0;
-	dest_net = rtnl_link_get_net(net, tb);
-	gotonerr(err_dest_net, err = IS_ERR(dest_net) ? PTR_ERR(dest_net) : 0,
-		 "get dest net");
+	gotonerr(err_nodes, err = rto_set_queues(dev, queues),
+		 "queues %s", dev->name);
+	if (priv->nodes) {
+		dest_net = rtnl_link_get_net(net, tb);
+		gotonerr(err_nodes,
+			 err = IS_ERR(dest_net) ? PTR_ERR(dest_net) : 0,
+			 "get dest net");
+		rto_node_tb(ntb, tb, &nq, queues);
+	}
 	for (i = 1; i < priv->nodes; i++) {
-		rto_ifname(name, tb, master);
-		node = rtnl_create_link(net, dest_net, name, &torus_rtnl, tb);
-		gotonerr(err_create_sub_node,
-			 err = IS_ERR(node) ? PTR_ERR(node) : 0,
+		rto_node_ifname(name, dev, i, dest_net);
+		node = rtnl_create_link(net, dest_net, name, &torus_rtnl, ntb);
+		gotonerr(err_nodes, err = IS_ERR(node) ? PTR_ERR(node) : 0,
 			 "create %s", name);
 		memcpy(node->dev_addr, dev->dev_addr, TORUS_ALEN);
-		node->dev_addr[4] += i;		/* dev_addr[5] for clones */
-		gotonerr(err_init_sub_node, err = rto_init_node(node, 0),
+		/* dimension coordinates; dev_addr[5] for clones */
+		rto_node_addr(node->dev_addr, i, dims, size);
+		gotonerr(err_init_node, err = rto_set_queues(node, queues),
+			 "queues %s", name);
+		gotonerr(err_init_node,
+			 err = rto_init_node(node, ACCESS_ONCE(node_sysfs)),
 			 "init %s", name);
 		priv->node[i] = node;
 	}
-	rto_assign_ports(priv, rows, cols);
+	gotonerr(err_nodes, err = rto_init_node(dev, true),
+		 "init %s", dev->name);
+	if (master)
+		set_torus_master(master, dev);
+	if (priv->nodes == 0)
+		return 0;
+	rto_assign_ports(priv, dims, size);
 	put_net(dest_net);
+	pr_torus_info("new %s of %u nodes in %lluus", dev->name, priv->nodes,
+		      div_u64(torus_now() - start, NSEC_PER_USEC));
 	return 0;
-err_init_sub_node:
-err_create_sub_node:
-	put_net(dest_net);
-err_dest_net:
-	netdev_rx_handler_unregister(dev);
-	unregister_netdevice(dev);
+err_init_node:
+	free_netdev(node);
+err_nodes:
+	if (dest_net && !IS_ERR(dest_net))
+		put_net(dest_net);
+	/* unregister the nodes made so far in one batch */
+	for (i = 1; i < priv->nodes; i++)
+		if (priv->node[i])
+			rto_dellink(priv->node[i], &kill);
+	unregister_netdevice_many(&kill);
+	free_torus_node(priv);
 	return err;
 }
 
+/*
+ * Queue dev with the nodes of its virtual toroid and its nested torus ports
+ * for unregister_netdevice_many() to tear down in one batch.
+ */
 static void rto_dellink(struct net_device *dev, struct list_head *head)
 {
 	struct	torus *priv = netdev_priv(dev);
-	struct	net_device **port;
-	char	name[IFNAMSIZ], addr[TORUS_ALEN];
+	struct	torus_ports *ports;
+	struct	net_device *port;
 	int	i;
 
-	memcpy(name, dev->name, sizeof(name));
-	memcpy(addr, dev->dev_addr, sizeof(addr));
+	priv->dying = true;
 	for (i = 1; i < priv->nodes; i++)
 		rto_dellink(priv->node[i], head);
-	port = rcu_dereference(priv->port);
-	for (i = 1; i < priv->ports; i++)
-		if (port[i] && port[i]->master == dev) {
-			if (is_torus(port[i]))
-				rto_dellink(port[i], head);
+	/* unset_torus_master() may shrink the ports so reload them */
+	for (i = 1; ports = rtnl_dereference(priv->port), i < ports->n; i++)
+		if (port = ports->port[i].dev, port && port->master == dev) {
+			if (is_torus(port))
+				rto_dellink(port, head);
 			else
-				unset_torus_master(dev, port[i]);
+				unset_torus_master(dev, port);
 		}
 	if (dev->master && is_torus(dev->master))
 		unset_torus_master(dev->master, dev);
 	netdev_rx_handler_unregister(dev);
 	unregister_netdevice_queue(dev, head);
-	pr_torus_info("del %*s %pM", IFNAMSIZ, dev->name, dev->dev_addr);
+	pr_torus_debug("del %*s %pM", IFNAMSIZ, dev->name, dev->dev_addr);
 }
 
 struct rtnl_link_ops torus_rtnl = {
@@ -293,5 +465,7 @@ struct rtnl_link_ops torus_rtnl = {
 	.priv_size	= sizeof(struct torus),
 	.setup		= rto_setup,
 	.newlink	= rto_newlink,
-	.dellink	= rto_dellink
+	.dellink	= rto_dellink,
+	.get_num_tx_queues = rto_get_num_queues,
+	.get_num_rx_queues = rto_get_num_queues
 };
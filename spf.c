@@ -0,0 +1,894 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <torus.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+#include <linux/pkt_sched.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+
+/*
+ * A snapshot of the link state database as a graph of nodes indexed by
+ * the order of the walk, with the adjacencies of node u in
+ * adj[off[u]] through adj[off[u + 1] - 1], only those that both ends
+ * advertise, and slot[] hashing addr[] to the node index.  The rest is
+ * scratch for each local node's run; down[v] has a bit for each of the
+ * first BITS_PER_LONG neighbors of the run's node on a shortest path to
+ * v, near[] is the nearest node of each lookup entry and alt[] the
+ * neighbor of its backup path.  touched[] is what the database had of the
+ * same at the snapshot.
+ */
+struct	torus_spf_graph {
+	uint	nodes;
+	uint	slots;
+	u8	(*addr)[TORUS_ALEN];
+	uint	*off;
+	uint	*adj;
+	int	*slot;
+	uint	*dist;
+	ulong	*down;
+	int	*first;
+	uint	*queue;
+	u8	*port;
+	int	hop[TORUS_LU_SZ];
+	uint	best[TORUS_LU_SZ];
+	int	near[TORUS_LU_SZ];
+	int	alt[TORUS_LU_SZ];
+	uint	touched_n;
+	bool	touched_all;
+	u8	touched[TORUS_SPF_TOUCHED][2][TORUS_ALEN];
+};
+
+static int torus_spf_id __read_mostly;
+
+static void torus_spf_work(struct work_struct *);
+static void torus_lsa_refresh(struct work_struct *);
+
+static inline struct torus_spf *torus_spf(struct net *net)
+{
+	return net_generic(net, torus_spf_id);
+}
+
+static inline struct hlist_head *torus_lsdb_head(struct torus_spf *spf,
+						 const u8 *origin)
+{
+	return &spf->lsdb[jhash(origin, TORUS_ALEN, 0) & (TORUS_LSDB_SZ - 1)];
+}
+
+static struct torus_lsdb_entry *find_torus_lsdb(struct torus_spf *spf,
+						const u8 *origin)
+{
+	struct	torus_lsdb_entry *e;
+	struct	hlist_node *pos;
+
+	hlist_for_each(pos, torus_lsdb_head(spf, origin)) {
+		e = hlist_entry(pos, struct torus_lsdb_entry, node);
+		if (ether_addr_equal(e->origin, origin))
+			return e;
+	}
+	return NULL;
+}
+
+static void touch_torus_link(struct torus_spf *spf, const u8 *a, const u8 *b)
+{
+	if (spf->touched_all)
+		return;
+	if (spf->touched_n == TORUS_SPF_TOUCHED) {
+		spf->touched_all = true;
+		return;
+	}
+	memcpy(spf->touched[spf->touched_n][0], a, TORUS_ALEN);
+	memcpy(spf->touched[spf->touched_n++][1], b, TORUS_ALEN);
+}
+
+/*
+ * touch_torus_lsdb notes the links of e that other, of the same origin,
+ * doesn't have for the next run; with spf->lock held
+ */
+static void touch_torus_lsdb(struct torus_spf *spf,
+			     const struct torus_lsdb_entry *e,
+			     const struct torus_lsdb_entry *other)
+{
+	uint	i, j;
+
+	for (i = 0; i < e->n; i++) {
+		for (j = 0; other && j < other->n; j++)
+			if (ether_addr_equal(e->peer[i], other->peer[j]))
+				break;
+		if (!other || j == other->n)
+			touch_torus_link(spf, e->origin, e->peer[i]);
+	}
+}
+
+static inline void del_torus_lsdb(struct torus_spf *spf,
+				  struct torus_lsdb_entry *e)
+{
+	hlist_del(&e->node);
+	spf->entries--;
+	spf->peers -= e->n;
+	kfree(e);
+}
+
+static inline void schedule_torus_spf(struct torus_spf *spf)
+{
+	schedule_delayed_work(&spf->spf, msecs_to_jiffies(TORUS_SPF_DELAY_MS));
+}
+
+/*
+ * update_torus_lsdb replaces the entry of new's origin unless new is a
+ * remote LSA that isn't newer, or is of a local origin; a local LSA takes
+ * the next seq, returned through seq.  The SPF is only scheduled if the
+ * peers changed rather than just the seq.  This takes new.
+ */
+static bool update_torus_lsdb(struct torus_spf *spf,
+			      struct torus_lsdb_entry *new, u32 *seq)
+{
+	struct	torus_lsdb_entry *old;
+	bool	changed;
+
+	spin_lock_bh(&spf->lock);
+	old = find_torus_lsdb(spf, new->origin);
+	if (old && !new->local &&
+	    (old->local || !torus_seq_after(new->seq, old->seq))) {
+		spin_unlock_bh(&spf->lock);
+		kfree(new);
+		return false;
+	}
+	if (new->local)
+		new->seq = old ? old->seq + 1 : (u32)get_seconds();
+	*seq = new->seq;
+	new->heard = jiffies;
+	changed = !old || old->n != new->n ||
+		memcmp(old->peer, new->peer, new->n * TORUS_ALEN);
+	if (changed) {
+		if (old)
+			touch_torus_lsdb(spf, old, new);
+		touch_torus_lsdb(spf, new, old);
+	}
+	if (old)
+		del_torus_lsdb(spf, old);
+	hlist_add_head(&new->node, torus_lsdb_head(spf, new->origin));
+	spf->entries++;
+	spf->peers += new->n;
+	spin_unlock_bh(&spf->lock);
+	if (changed)
+		schedule_torus_spf(spf);
+	return true;
+}
+
+/*
+ * Send the LSA through the physical ports of every running torus device
+ * of the name-space but the one it came from; those of the nested and
+ * virtual ports share this database.
+ */
+static void flood_torus_lsa(struct net *net, struct net_device *ingress,
+			    const struct torus_lsa *lsa, uint len)
+{
+	struct	net_device *dev, *port;
+	struct	torus_ports *ports;
+	struct	torus *priv;
+	struct	sk_buff *skb;
+	int	i;
+
+	rcu_read_lock();
+	for_each_netdev_rcu(net, dev) {
+		if (!is_torus(dev) || !netif_running(dev))
+			continue;
+		priv = netdev_priv(dev);
+		ports = rcu_dereference(priv->port);
+		for (i = 1; i < ports->n; i++) {
+			port = torus_port_dev(ports, i);
+			if (!port || port == ingress || is_torus(port))
+				continue;
+			skb = new_torus_hello_skb(dev, port, len);
+			if (!skb)
+				continue;
+			memcpy(skb->data + ETH_HLEN, lsa, len);
+			dev_queue_xmit(skb);
+		}
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * originate_torus_lsa advertises the peers that priv has heard
+ */
+void originate_torus_lsa(struct torus *priv)
+{
+	struct	net_device *dev = priv->dev;
+	struct	torus_neighbors *h = priv->hello;
+	struct	torus_lsdb_entry *new;
+	struct	torus_lsa *lsa;
+	uint	i, n = 0, len;
+	u32	seq;
+
+	if (!h)
+		return;
+	new = kmalloc(sizeof(*new) + TORUS_LSA_PEERS * TORUS_ALEN, GFP_KERNEL);
+	if (!new)
+		return;
+	spin_lock_bh(&h->lock);
+	for (i = 1; i < h->n && n < TORUS_LSA_PEERS; i++)
+		if (h->neighbor[i].up)
+			memcpy(new->peer[n++], h->neighbor[i].addr,
+			       TORUS_ALEN);
+	spin_unlock_bh(&h->lock);
+	memcpy(new->origin, dev->dev_addr, TORUS_ALEN);
+	new->local = true;
+	new->n = n;
+	len = sizeof(*lsa) + (n * TORUS_ALEN);
+	lsa = kzalloc(len, GFP_KERNEL);
+	if (!lsa) {
+		kfree(new);
+		return;
+	}
+	lsa->version = TORUS_HELLO_VERSION;
+	lsa->type = TORUS_LSA_TYPE;
+	lsa->n = htons(n);
+	memcpy(lsa->origin, new->origin, TORUS_ALEN);
+	memcpy(lsa->peer, new->peer, n * TORUS_ALEN);
+	if (update_torus_lsdb(torus_spf(dev_net(dev)), new, &seq)) {
+		lsa->seq = htonl(seq);
+		flood_torus_lsa(dev_net(dev), NULL, lsa, len);
+	}
+	kfree(lsa);
+}
+
+/*
+ * ndo_rx() gives LSAs to recv_torus_lsa() by way of recv_torus_hello()
+ */
+void recv_torus_lsa(struct torus *priv, struct net_device *dev,
+		    struct sk_buff *skb)
+{
+	struct	torus_lsdb_entry *new;
+	struct	torus_lsa *lsa;
+	uint	n, len;
+	u32	seq;
+
+	if (skb->dev == dev || !pskb_may_pull(skb, sizeof(*lsa)))
+		return;
+	lsa = (struct torus_lsa *)skb->data;
+	n = ntohs(lsa->n);
+	len = sizeof(*lsa) + (n * TORUS_ALEN);
+	if (n > TORUS_LSA_PEERS || !pskb_may_pull(skb, len))
+		return;
+	lsa = (struct torus_lsa *)skb->data;
+	new = kmalloc(sizeof(*new) + (n * TORUS_ALEN), GFP_ATOMIC);
+	if (!new)
+		return;
+	memcpy(new->origin, lsa->origin, TORUS_ALEN);
+	new->seq = ntohl(lsa->seq);
+	new->local = false;
+	new->n = n;
+	memcpy(new->peer, lsa->peer, n * TORUS_ALEN);
+	if (update_torus_lsdb(torus_spf(dev_net(dev)), new, &seq))
+		flood_torus_lsa(dev_net(dev), skb->dev, lsa, len);
+}
+
+/*
+ * withdraw_torus_lsa forgets the LSA of a torus device going away; the
+ * other name-spaces age it out
+ */
+void withdraw_torus_lsa(struct net_device *dev)
+{
+	struct	torus_spf *spf = torus_spf(dev_net(dev));
+	struct	torus_lsdb_entry *e;
+
+	spin_lock_bh(&spf->lock);
+	e = find_torus_lsdb(spf, dev->dev_addr);
+	if (e && e->local) {
+		touch_torus_lsdb(spf, e, NULL);
+		del_torus_lsdb(spf, e);
+	}
+	spin_unlock_bh(&spf->lock);
+	if (e)
+		schedule_torus_spf(spf);
+}
+
+/*
+ * kick_torus_spf has the next run compute dev, as once its spf is set
+ */
+void kick_torus_spf(struct net_device *dev)
+{
+	struct	torus_spf *spf = torus_spf(dev_net(dev));
+
+	spin_lock_bh(&spf->lock);
+	touch_torus_link(spf, dev->dev_addr, dev->dev_addr);
+	spin_unlock_bh(&spf->lock);
+	schedule_torus_spf(spf);
+}
+
+static void free_torus_spf_graph(struct torus_spf_graph *g)
+{
+	if (!g)
+		return;
+	vfree(g->addr);
+	vfree(g->off);
+	vfree(g->adj);
+	vfree(g->slot);
+	vfree(g->dist);
+	vfree(g->down);
+	vfree(g->first);
+	vfree(g->queue);
+	vfree(g->port);
+	vfree(g);
+}
+
+static struct torus_spf_graph *alloc_torus_spf_graph(uint nodes, uint peers)
+{
+	struct	torus_spf_graph *g;
+
+	if (g = vzalloc(sizeof(*g)), !g)
+		return NULL;
+	g->slots = roundup_pow_of_two(2 * nodes + 1);
+	g->addr = vzalloc(nodes * TORUS_ALEN + 1);
+	g->off = vzalloc((nodes + 1) * sizeof(*g->off));
+	g->adj = vzalloc(peers * sizeof(*g->adj) + 1);
+	g->slot = vzalloc(g->slots * sizeof(*g->slot));
+	g->dist = vzalloc(nodes * sizeof(*g->dist) + 1);
+	g->down = vzalloc(nodes * sizeof(*g->down) + 1);
+	g->first = vzalloc(nodes * sizeof(*g->first) + 1);
+	g->queue = vzalloc(nodes * sizeof(*g->queue) + 1);
+	g->port = vzalloc(nodes + 1);
+	if (!g->addr || !g->off || !g->adj || !g->slot || !g->dist ||
+	    !g->down || !g->first || !g->queue || !g->port) {
+		free_torus_spf_graph(g);
+		return NULL;
+	}
+	return g;
+}
+
+static int find_torus_spf_node(const struct torus_spf_graph *g,
+			       const u8 *addr)
+{
+	uint	i = jhash(addr, TORUS_ALEN, 0) & (g->slots - 1);
+
+	for (; g->slot[i] >= 0; i = (i + 1) & (g->slots - 1))
+		if (ether_addr_equal(g->addr[g->slot[i]], addr))
+			return g->slot[i];
+	return -1;
+}
+
+/*
+ * A link is only used if both ends advertise it, so prune_torus_spf_graph
+ * drops the rest from adj[] once rather than each walk checking them.
+ */
+static void prune_torus_spf_graph(struct torus_spf_graph *g)
+{
+	uint	u, v, k, j, n;
+
+	for (u = 0; u < g->nodes; u++)
+		for (k = g->off[u]; k < g->off[u + 1]; k++) {
+			v = g->adj[k];
+			for (j = g->off[v]; j < g->off[v + 1]; j++)
+				if (g->adj[j] == u)
+					break;
+			if (j == g->off[v + 1])
+				g->adj[k] = UINT_MAX;
+		}
+	for (u = 0, n = 0; u < g->nodes; u++) {
+		k = g->off[u];
+		g->off[u] = n;
+		for (; k < g->off[u + 1]; k++)
+			if (g->adj[k] != UINT_MAX)
+				g->adj[n++] = g->adj[k];
+	}
+	g->off[u] = n;
+}
+
+/*
+ * snap_torus_spf copies the database to a new graph, retrying if it grew
+ * while the graph was allocated, and takes what it has touched
+ */
+static struct torus_spf_graph *snap_torus_spf(struct torus_spf *spf)
+{
+	struct	torus_spf_graph *g;
+	struct	torus_lsdb_entry *e;
+	struct	hlist_node *pos;
+	uint	nodes, peers, u, i, k;
+	int	b, w;
+
+	for (;;) {
+		spin_lock_bh(&spf->lock);
+		nodes = spf->entries;
+		peers = spf->peers;
+		spin_unlock_bh(&spf->lock);
+		if (g = alloc_torus_spf_graph(nodes, peers), !g)
+			return NULL;
+		spin_lock_bh(&spf->lock);
+		if (spf->entries <= nodes && spf->peers <= peers)
+			break;
+		spin_unlock_bh(&spf->lock);
+		free_torus_spf_graph(g);
+	}
+	memset(g->slot, 0xff, g->slots * sizeof(*g->slot));
+	for (b = 0, u = 0; b < TORUS_LSDB_SZ; b++)
+		hlist_for_each(pos, &spf->lsdb[b]) {
+			e = hlist_entry(pos, struct torus_lsdb_entry, node);
+			memcpy(g->addr[u], e->origin, TORUS_ALEN);
+			i = jhash(e->origin, TORUS_ALEN, 0) & (g->slots - 1);
+			while (g->slot[i] >= 0)
+				i = (i + 1) & (g->slots - 1);
+			g->slot[i] = u++;
+		}
+	g->nodes = u;
+	for (b = 0, u = 0, k = 0; b < TORUS_LSDB_SZ; b++)
+		hlist_for_each(pos, &spf->lsdb[b]) {
+			e = hlist_entry(pos, struct torus_lsdb_entry, node);
+			g->off[u++] = k;
+			for (i = 0; i < e->n; i++)
+				if (w = find_torus_spf_node(g, e->peer[i]), w >= 0)
+					g->adj[k++] = w;
+		}
+	g->off[u] = k;
+	g->touched_n = spf->touched_n;
+	g->touched_all = spf->touched_all;
+	memcpy(g->touched, spf->touched, sizeof(g->touched[0]) * g->touched_n);
+	spf->touched_n = 0;
+	spf->touched_all = false;
+	spin_unlock_bh(&spf->lock);
+	prune_torus_spf_graph(g);
+	return g;
+}
+
+/*
+ * Breadth first from s, since every link costs the same, to find the
+ * distance, the first hop and the neighbors on a shortest path to each
+ * node.  The nodes at one distance are all dequeued before those at the
+ * next, so down[u] is whole before it's passed on.
+ */
+static void walk_torus_spf(struct torus_spf_graph *g, uint s)
+{
+	uint	head = 0, tail = 0, u, v, k;
+
+	memset(g->dist, 0xff, g->nodes * sizeof(*g->dist));
+	g->dist[s] = 0;
+	g->first[s] = -1;
+	g->down[s] = 0;
+	g->queue[tail++] = s;
+	while (head < tail) {
+		u = g->queue[head++];
+		for (k = g->off[u]; k < g->off[u + 1]; k++) {
+			v = g->adj[k];
+			if (g->dist[v] == UINT_MAX) {
+				g->dist[v] = g->dist[u] + 1;
+				g->first[v] = u == s ? v : g->first[u];
+				g->down[v] = 0;
+				g->queue[tail++] = v;
+			}
+			if (g->dist[v] != g->dist[u] + 1)
+				continue;
+			if (u != s)
+				g->down[v] |= g->down[u];
+			else if (k - g->off[s] < BITS_PER_LONG)
+				g->down[v] |= 1UL << (k - g->off[s]);
+		}
+	}
+}
+
+static inline uint torus_spf_dist(const struct torus_spf_graph *g,
+				  const u8 *addr)
+{
+	int	u = find_torus_spf_node(g, addr);
+
+	return u < 0 ? UINT_MAX : g->dist[u];
+}
+
+/*
+ * A node's tables only depend on the links between the nodes at
+ * consecutive distances from it.  Were every touched link between nodes
+ * at the same distance now, or both unreachable, that labeling of
+ * distances would fit the graph before the change as well, so neither
+ * the distances nor those links would differ and the node needn't run
+ * again.  dist[] must be that of s.
+ */
+static bool torus_spf_touched(const struct torus_spf_graph *g, uint s)
+{
+	uint	i;
+
+	if (g->touched_all)
+		return true;
+	for (i = 0; i < g->touched_n; i++)
+		if (ether_addr_equal(g->touched[i][0], g->touched[i][1])) {
+			if (ether_addr_equal(g->touched[i][0], g->addr[s]))
+				return true;
+		} else if (torus_spf_dist(g, g->touched[i][0]) !=
+			   torus_spf_dist(g, g->touched[i][1]))
+			return true;
+	return false;
+}
+
+/*
+ * The first hop of each lookup entry is that of its nearest node.  The
+ * entry of node v is the byte of v's address after the first that differs
+ * from s's, in the table of the byte before; so the nearest node of each
+ * entry is ever closer with each hop and there are no loops.
+ *
+ * The backup of each entry is another neighbor n on a shortest path to
+ * the entry's node D, so dist(n, D) < dist(s, D) and n's own path can't
+ * come back through s.  This downstream condition is stricter than that
+ * of a loop-free alternate, dist(n, D) < 1 + dist(s, D), but the two only
+ * differ on rings of odd size and it takes no walks beyond that from s.
+ */
+static void run_torus_spf_node(struct torus_spf_graph *g, uint s)
+{
+	const	u8 *self = g->addr[s];
+	ulong	down;
+	uint	v, k;
+	int	idx;
+
+	memset(g->hop, 0xff, sizeof(g->hop));
+	for (v = 0; v < g->nodes; v++) {
+		if (v == s || g->dist[v] == UINT_MAX)
+			continue;
+		for (k = 1; k < TORUS_ALEN; k++)
+			if (g->addr[v][k] != self[k])
+				break;
+		if (k == TORUS_ALEN)
+			continue;
+		idx = ((k - 1) * TORUS_LU_TBL_ENTRIES) + g->addr[v][k];
+		if (g->hop[idx] < 0 || g->dist[v] < g->best[idx]) {
+			g->hop[idx] = g->first[v];
+			g->best[idx] = g->dist[v];
+			g->near[idx] = v;
+		}
+	}
+	memset(g->alt, 0xff, sizeof(g->alt));
+	for (idx = 0; idx < TORUS_LU_SZ; idx++) {
+		if (g->hop[idx] < 0)
+			continue;
+		down = g->down[g->near[idx]];
+		for (k = 0; down && k < BITS_PER_LONG; k++, down >>= 1)
+			if ((down & 1) &&
+			    g->adj[g->off[s] + k] != g->hop[idx]) {
+				g->alt[idx] = g->adj[g->off[s] + k];
+				break;
+			}
+	}
+}
+
+/*
+ * Write the lookup entries of priv, with their backups, that differ from
+ * the graph's, and reset those that SPF wrote before but are now
+ * unreachable; returns the number written.
+ */
+static uint write_torus_spf_node(struct torus *priv, struct torus_spf_graph *g)
+{
+	struct	torus_ports *ports;
+	struct	torus_lu *lu;
+	u8	*tbl, *mp, *alt;
+	int	i, u, idx, want, backup;
+	uint	written = 0;
+
+	mutex_lock(&priv->port_mutex);
+	if (lu = begin_torus_lu(priv), !lu) {
+		mutex_unlock(&priv->port_mutex);
+		return 0;
+	}
+	ports = torus_ports_locked(priv);
+	for (i = 1; i < ports->n; i++)
+		if (ports->port[i].dev &&
+		    (u = find_torus_spf_node(g, ports->port[i].peer)) >= 0)
+			g->port[u] = i;
+	for (idx = 0; idx < TORUS_LU_SZ; idx++) {
+		tbl = &lu->tbl[0][0] + idx;
+		mp = &lu->mp[0][0] + idx;
+		alt = &lu->alt[0][0] + idx;
+		if (g->hop[idx] >= 0) {
+			if (want = g->port[g->hop[idx]], !want)
+				continue;
+			backup = g->alt[idx] >= 0 ? g->port[g->alt[idx]] : 0;
+			set_bit(idx, priv->spf_owned);
+		} else if (test_and_clear_bit(idx, priv->spf_owned))
+			want = backup = 0;
+		else
+			continue;
+		if (*tbl != want || *mp || *alt != backup) {
+			*tbl = want;
+			*mp = 0;
+			*alt = backup;
+			written++;
+		}
+	}
+	for (i = 1; i < ports->n; i++)
+		if (ports->port[i].dev &&
+		    (u = find_torus_spf_node(g, ports->port[i].peer)) >= 0)
+			g->port[u] = 0;
+	if (written)
+		commit_torus_lu(priv, lu);
+	else
+		abort_torus_lu(priv, lu);
+	mutex_unlock(&priv->port_mutex);
+	return written;
+}
+
+/*
+ * hold_torus_spf_devs returns the number of torus devices of the
+ * name-space with spf set, held in a new *devs; rtnl is only taken for
+ * this and, unless wait, not at all if it's taken already, as by an
+ * unregister waiting on the sysfs store that called it
+ */
+static int hold_torus_spf_devs(struct torus_spf *spf, bool wait,
+			       struct net_device ***devs)
+{
+	struct	net_device *dev, **v;
+	int	n = 0;
+
+	if (wait)
+		rtnl_lock();
+	else if (!rtnl_trylock())
+		return restart_syscall();
+	for_each_netdev(spf->net, dev)
+		if (is_torus(dev) &&
+		    ACCESS_ONCE(((struct torus *)netdev_priv(dev))->spf))
+			n++;
+	if (v = kcalloc(n, sizeof(*v), GFP_KERNEL), !v) {
+		rtnl_unlock();
+		return -ENOMEM;
+	}
+	n = 0;
+	for_each_netdev(spf->net, dev)
+		if (is_torus(dev) &&
+		    ACCESS_ONCE(((struct torus *)netdev_priv(dev))->spf)) {
+			dev_hold(dev);
+			v[n++] = dev;
+		}
+	rtnl_unlock();
+	*devs = v;
+	return n;
+}
+
+/*
+ * run_torus_spf computes then writes the lookup tables of the torus
+ * devices of the name-space with spf set that reach a change, or of all
+ * of them unless wait; without rtnl, since each table is published as a
+ * new generation and the held devices can't be freed
+ */
+static int run_torus_spf(struct torus_spf *spf, bool wait)
+{
+	struct	torus_spf_graph *g;
+	struct	net_device **devs;
+	struct	torus *priv;
+	u64	t, spf_ns = 0, write_ns = 0, nodes = 0, written = 0;
+	int	i, n, s;
+
+	if (n = hold_torus_spf_devs(spf, wait, &devs), n < 0)
+		return n;
+	mutex_lock(&spf->run);
+	if (g = snap_torus_spf(spf), !g) {
+		mutex_unlock(&spf->run);
+		for (i = 0; i < n; i++)
+			dev_put(devs[i]);
+		kfree(devs);
+		pr_torus_err("no memory for SPF");
+		return -ENOMEM;
+	}
+	if (!wait)
+		g->touched_all = true;
+	for (i = 0; i < n; i++) {
+		priv = netdev_priv(devs[i]);
+		if (devs[i]->reg_state != NETREG_REGISTERED ||
+		    !ACCESS_ONCE(priv->spf))
+			continue;
+		if (s = find_torus_spf_node(g, devs[i]->dev_addr), s < 0)
+			continue;
+		t = torus_now();
+		walk_torus_spf(g, s);
+		if (!torus_spf_touched(g, s))
+			continue;
+		run_torus_spf_node(g, s);
+		spf_ns += torus_now() - t;
+		t = torus_now();
+		written += write_torus_spf_node(priv, g);
+		write_ns += torus_now() - t;
+		nodes++;
+	}
+	mutex_unlock(&spf->run);
+	for (i = 0; i < n; i++)
+		dev_put(devs[i]);
+	kfree(devs);
+	free_torus_spf_graph(g);
+	spin_lock_bh(&spf->lock);
+	spf->runs++;
+	spf->nodes = nodes;
+	spf->spf_ns = spf_ns;
+	spf->write_ns = write_ns;
+	spf->written = written;
+	spin_unlock_bh(&spf->lock);
+	return 0;
+}
+
+static void torus_spf_work(struct work_struct *work)
+{
+	run_torus_spf(container_of(to_delayed_work(work), struct torus_spf,
+				   spf), true);
+}
+
+/*
+ * is_torus_lsa_flooded is true if dev has a physical port for its LSAs to
+ * reach other name-spaces; within rcu_read_lock()
+ */
+static bool is_torus_lsa_flooded(struct net_device *dev)
+{
+	struct	torus_ports *ports;
+	struct	net_device *port;
+	int	i;
+
+	ports = rcu_dereference(((struct torus *)netdev_priv(dev))->port);
+	for (i = 1; ports && i < ports->n; i++)
+		if (port = torus_port_dev(ports, i), port && !is_torus(port))
+			return true;
+	return false;
+}
+
+/*
+ * hold_torus_lsa_devs returns the number of running torus devices of the
+ * name-space with a physical port, held in a new *devs, or 0
+ */
+static int hold_torus_lsa_devs(struct torus_spf *spf,
+			       struct net_device ***devs)
+{
+	struct	net_device *dev, **v;
+	int	i = 0, n = 0;
+
+	rcu_read_lock();
+	for_each_netdev_rcu(spf->net, dev)
+		if (is_torus(dev) && netif_running(dev) &&
+		    is_torus_lsa_flooded(dev))
+			n++;
+	rcu_read_unlock();
+	if (!n || (v = kcalloc(n, sizeof(*v), GFP_KERNEL), !v))
+		return 0;
+	rcu_read_lock();
+	for_each_netdev_rcu(spf->net, dev)
+		if (i < n && is_torus(dev) && netif_running(dev) &&
+		    is_torus_lsa_flooded(dev)) {
+			dev_hold(dev);
+			v[i++] = dev;
+		}
+	rcu_read_unlock();
+	*devs = v;
+	return i;
+}
+
+/*
+ * Age out the remote LSAs that haven't been refreshed then refresh those
+ * of the local torus devices with physical ports.  The others' LSAs are
+ * only in this name-space's database, where local entries don't age, so
+ * they needn't be; nor is rtnl held, the devices are.
+ */
+static void torus_lsa_refresh(struct work_struct *work)
+{
+	struct	torus_spf *spf = container_of(to_delayed_work(work),
+					      struct torus_spf, refresh);
+	struct	torus_lsdb_entry *e;
+	struct	hlist_node *pos, *tmp;
+	struct	net_device **devs = NULL;
+	ulong	max_age = msecs_to_jiffies(TORUS_LSA_MAX_AGE *
+					   TORUS_LSA_REFRESH_MS);
+	bool	aged = false;
+	int	b, i, n;
+
+	spin_lock_bh(&spf->lock);
+	for (b = 0; b < TORUS_LSDB_SZ; b++)
+		hlist_for_each_safe(pos, tmp, &spf->lsdb[b]) {
+			e = hlist_entry(pos, struct torus_lsdb_entry, node);
+			if (!e->local && time_after(jiffies, e->heard + max_age)) {
+				touch_torus_lsdb(spf, e, NULL);
+				del_torus_lsdb(spf, e);
+				aged = true;
+			}
+		}
+	spin_unlock_bh(&spf->lock);
+	n = hold_torus_lsa_devs(spf, &devs);
+	for (i = 0; i < n; i++) {
+		if (devs[i]->reg_state == NETREG_REGISTERED)
+			originate_torus_lsa(netdev_priv(devs[i]));
+		dev_put(devs[i]);
+	}
+	kfree(devs);
+	if (aged)
+		schedule_torus_spf(spf);
+	schedule_delayed_work(&spf->refresh,
+			      msecs_to_jiffies(TORUS_LSA_REFRESH_MS));
+}
+
+/*
+ * bench_torus_spf runs the SPF of dev's name-space now and logs its times
+ */
+int bench_torus_spf(struct net_device *dev)
+{
+	struct	torus_spf *spf = torus_spf(dev_net(dev));
+	u64	v[TORUS_SPF_STATS];
+	int	err;
+
+	if (err = run_torus_spf(spf, false), err)
+		return err;
+	get_torus_spf(dev, v);
+	pr_torus_info("SPF of %llu nodes in %lluus, wrote %llu entries in %lluus",
+		      v[1], div_u64(v[2], NSEC_PER_USEC), v[4],
+		      div_u64(v[3], NSEC_PER_USEC));
+	return 0;
+}
+
+/*
+ * get_torus_spf copies the runs then the nodes, SPF and write nanoseconds
+ * and entries written of the latest run in dev's name-space to v[]
+ */
+void get_torus_spf(struct net_device *dev, u64 *v)
+{
+	struct	torus_spf *spf = torus_spf(dev_net(dev));
+
+	spin_lock_bh(&spf->lock);
+	v[0] = spf->runs;
+	v[1] = spf->nodes;
+	v[2] = spf->spf_ns;
+	v[3] = spf->write_ns;
+	v[4] = spf->written;
+	spin_unlock_bh(&spf->lock);
+}
+
+static int __net_init torus_spf_init_net(struct net *net)
+{
+	struct	torus_spf *spf = torus_spf(net);
+	int	b;
+
+	spf->net = net;
+	spin_lock_init(&spf->lock);
+	mutex_init(&spf->run);
+	for (b = 0; b < TORUS_LSDB_SZ; b++)
+		INIT_HLIST_HEAD(&spf->lsdb[b]);
+	INIT_DELAYED_WORK(&spf->spf, torus_spf_work);
+	INIT_DELAYED_WORK(&spf->refresh, torus_lsa_refresh);
+	schedule_delayed_work(&spf->refresh,
+			      msecs_to_jiffies(TORUS_LSA_REFRESH_MS));
+	return 0;
+}
+
+static void __net_exit torus_spf_exit_net(struct net *net)
+{
+	struct	torus_spf *spf = torus_spf(net);
+	struct	hlist_node *pos, *tmp;
+	int	b;
+
+	cancel_delayed_work_sync(&spf->refresh);
+	cancel_delayed_work_sync(&spf->spf);
+	for (b = 0; b < TORUS_LSDB_SZ; b++)
+		hlist_for_each_safe(pos, tmp, &spf->lsdb[b])
+			del_torus_lsdb(spf, hlist_entry(pos,
+							struct torus_lsdb_entry,
+							node));
+}
+
+static struct pernet_operations torus_spf_ops = {
+	.init	= torus_spf_init_net,
+	.exit	= torus_spf_exit_net,
+	.id	= &torus_spf_id,
+	.size	= sizeof(struct torus_spf),
+};
+
+int register_torus_spf(void)
+{
+	return register_pernet_subsys(&torus_spf_ops);
+}
+
+void unregister_torus_spf(void)
+{
+	unregister_pernet_subsys(&torus_spf_ops);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TORUS_SPF_H__
+#define __TORUS_SPF_H__
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/torus.h>
+#include <addr.h>
+
+#define	TORUS_LSDB_BITS		10
+#define	TORUS_LSDB_SZ		(1 << TORUS_LSDB_BITS)
+/*
+ * wait this long after a change for others before running SPF
+ */
+#define	TORUS_SPF_DELAY_MS	5
+/*
+ * the most links of changed LSAs noted between runs, past which the next
+ * run is of every node
+ */
+#define	TORUS_SPF_TOUCHED	256
+/*
+ * the number of values from get_torus_spf()
+ */
+#define	TORUS_SPF_STATS		5
+/*
+ * the most peers of an LSA that fit a standard frame
+ */
+#define	TORUS_LSA_PEERS							\
+	((ETH_DATA_LEN - sizeof(struct torus_lsa)) / TORUS_ALEN)
+
+struct	torus_lsdb_entry {
+	struct	hlist_node node;
+	/*
+	 * heard is the jiffy of the last refresh of a remote origin's LSA;
+	 * local is set for those of this name-space's torus devices
+	 */
+	ulong		heard;
+	u32		seq;
+	bool		local;
+	u8		origin[TORUS_ALEN];
+	u16		n;
+	u8		peer[0][TORUS_ALEN];
+};
+
+/*
+ * The torus devices of a network name-space share one link state database
+ * since they'd all have the same one anyway; only LSAs to and from the
+ * physical ports are flooded.
+ */
+struct	torus_spf {
+	struct	net	*net;
+	spinlock_t	lock;
+	struct	hlist_head lsdb[TORUS_LSDB_SZ];
+	uint		entries;
+	uint		peers;
+	struct	delayed_work spf;
+	struct	delayed_work refresh;
+	/*
+	 * touched has the links, origin then peer, that the LSAs changed
+	 * since the last run added or removed, or a node's own address twice
+	 * to have it run; a run only computes the nodes whose shortest paths
+	 * a touched link may be on, or all with touched_all.  run serializes
+	 * the runs so their tables are written in order.
+	 */
+	uint		touched_n;
+	bool		touched_all;
+	u8		touched[TORUS_SPF_TOUCHED][2][TORUS_ALEN];
+	struct	mutex	run;
+	/*
+	 * runs counts the SPF computations; the rest are of the latest
+	 * with the nanoseconds to compute the shortest paths of the local
+	 * nodes it ran then to write their changed lookup entries
+	 */
+	u64		runs;
+	u64		nodes;
+	u64		spf_ns;
+	u64		write_ns;
+	u64		written;
+};
+
+/*
+ * is sequence number a after b, allowing for wrap
+ */
+static inline bool torus_seq_after(u32 a, u32 b)
+{
+	return (s32)(a - b) > 0;
+}
+
+#endif	/* __TORUS_SPF_H__ */
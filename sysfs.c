@@ -23,33 +23,89 @@ static ssize_t show_dev(struct net_device **, ssize_t, char *);
 static ssize_t show_lu(struct device *, struct device_attribute *, char *);
 static ssize_t store_lu(struct device *, struct device_attribute *,
 			const char *, size_t);
+static ssize_t show_lu_gen(struct device *, struct device_attribute *, char *);
 static ssize_t show_node(struct device *, struct device_attribute *, char *);
 static ssize_t show_peer(struct device *, struct device_attribute *, char *);
 static ssize_t show_port(struct device *, struct device_attribute *, char *);
+static ssize_t show_queue(struct device *, struct device_attribute *, char *);
+static ssize_t show_burst(struct device *, struct device_attribute *, char *);
+static ssize_t show_path(struct device *, struct device_attribute *, char *);
+static ssize_t show_adaptive(struct device *, struct device_attribute *,
+			     char *);
+static ssize_t store_adaptive(struct device *, struct device_attribute *,
+			      const char *, size_t);
+static ssize_t show_deviation(struct device *, struct device_attribute *,
+			      char *);
+static ssize_t show_mp(struct device *, struct device_attribute *, char *);
+static ssize_t store_mp(struct device *, struct device_attribute *,
+			const char *, size_t);
+static ssize_t show_coord(struct device *, struct device_attribute *, char *);
+static ssize_t store_coord(struct device *, struct device_attribute *,
+			   const char *, size_t);
+static ssize_t store_burst(struct device *, struct device_attribute *,
+			   const char *, size_t);
+static ssize_t show_hello(struct device *, struct device_attribute *, char *);
+static ssize_t store_hello(struct device *, struct device_attribute *,
+			   const char *, size_t);
+static ssize_t show_neighbor(struct device *, struct device_attribute *,
+			     char *);
+static ssize_t show_convergence(struct device *, struct device_attribute *,
+				char *);
+static ssize_t show_spf(struct device *, struct device_attribute *, char *);
+static ssize_t show_backup(struct device *, struct device_attribute *,
+			   char *);
+static ssize_t store_spf(struct device *, struct device_attribute *,
+			 const char *, size_t);
+static ssize_t show_proxy(struct device *, struct device_attribute *, char *);
+static ssize_t show_vc(struct device *, struct device_attribute *, char *);
+static ssize_t show_ecn(struct device *, struct device_attribute *, char *);
+static ssize_t store_ecn(struct device *, struct device_attribute *,
+			 const char *, size_t);
+static ssize_t show_mark(struct device *, struct device_attribute *, char *);
 
 static DEVICE_ATTR(lu1, S_IWUSR | S_IRUGO, show_lu, store_lu);
 static DEVICE_ATTR(lu2, S_IWUSR | S_IRUGO, show_lu, store_lu);
 static DEVICE_ATTR(lu3, S_IWUSR | S_IRUGO, show_lu, store_lu);
 static DEVICE_ATTR(lu4, S_IWUSR | S_IRUGO, show_lu, store_lu);
 static DEVICE_ATTR(lu5, S_IWUSR | S_IRUGO, show_lu, store_lu);
+static DEVICE_ATTR(lu_gen, S_IRUGO, show_lu_gen, NULL);
 static DEVICE_ATTR(nodes, S_IRUGO, show_node, NULL);
 static DEVICE_ATTR(peers, S_IRUGO, show_peer, NULL);
 static DEVICE_ATTR(ports, S_IRUGO, show_port, NULL);
+static DEVICE_ATTR(queues, S_IRUGO, show_queue, NULL);
+static DEVICE_ATTR(burst, S_IWUSR | S_IRUGO, show_burst, store_burst);
+static DEVICE_ATTR(coord, S_IWUSR | S_IRUGO, show_coord, store_coord);
+static DEVICE_ATTR(paths, S_IRUGO, show_path, NULL);
+static DEVICE_ATTR(multipath, S_IWUSR | S_IRUGO, show_mp, store_mp);
+static DEVICE_ATTR(adaptive, S_IWUSR | S_IRUGO, show_adaptive, store_adaptive);
+static DEVICE_ATTR(deviations, S_IRUGO, show_deviation, NULL);
+static DEVICE_ATTR(hello, S_IWUSR | S_IRUGO, show_hello, store_hello);
+static DEVICE_ATTR(neighbors, S_IRUGO, show_neighbor, NULL);
+static DEVICE_ATTR(convergence, S_IRUGO, show_convergence, NULL);
+static DEVICE_ATTR(spf, S_IWUSR | S_IRUGO, show_spf, store_spf);
+static DEVICE_ATTR(backups, S_IRUGO, show_backup, NULL);
+static DEVICE_ATTR(proxy, S_IRUGO, show_proxy, NULL);
+static DEVICE_ATTR(vc, S_IRUGO, show_vc, NULL);
+static DEVICE_ATTR(ecn, S_IWUSR | S_IRUGO, show_ecn, store_ecn);
+static DEVICE_ATTR(marks, S_IRUGO, show_mark, NULL);
 
 static const char elipsis[] = "...\n";
 
+/*
+ * luN is the table indexed by byte N of the destination address
+ */
 static uint lu_idx(struct device_attribute *attr)
 {
 	if (attr == &dev_attr_lu1)
-		return 1;
+		return 0;
 	else if (attr == &dev_attr_lu2)
-		return 2;
+		return 1;
 	else if (attr == &dev_attr_lu3)
-		return 3;
+		return 2;
 	else if (attr == &dev_attr_lu4)
-		return 4;
+		return 3;
 	else
-		return 5;
+		return 4;
 }
 
 static ssize_t show_dev(struct net_device **tbl, ssize_t count, char *buf)
@@ -80,15 +136,14 @@ static ssize_t show_lu(struct device *dev, struct device_attribute *attr,
 {
 	struct	torus *priv = netdev_priv(to_net_dev(dev));
 	uint	tbl = lu_idx(attr);
-	u8	*lu;
+	struct	torus_lu *lu;
 	size_t	n, l = PAGE_SIZE;
-	int	i, lasti;
+	int	i;
 
 	rcu_read_lock();
 	lu = rcu_dereference(priv->lu);
-	for (i = tbl * TORUS_LU_TBL_ENTRIES, lasti = i + TORUS_LU_TBL_ENTRIES;
-	     i < lasti; i++) {
-		n = scnprintf(buf, l, "%d\n", lu[i]);
+	for (i = 0; i < TORUS_LU_TBL_ENTRIES; i++) {
+		n = scnprintf(buf, l, "%d\n", lu->tbl[tbl][i]);
 		l -= n;
 		buf += n;
 	}
@@ -96,6 +151,14 @@ static ssize_t show_lu(struct device *dev, struct device_attribute *attr,
 	return PAGE_SIZE - l;
 }
 
+static ssize_t show_lu_gen(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", get_torus_lu_gen(priv));
+}
+
 static ssize_t show_node(struct device *dev, struct device_attribute *attr,
 			 char *buf)
 {
@@ -108,14 +171,14 @@ static ssize_t show_peer(struct device *dev, struct device_attribute *attr,
 			 char *buf)
 {
 	struct	torus *priv = netdev_priv(to_net_dev(dev));
-	u8	*peer;
+	struct	torus_ports *ports;
 	ssize_t	n, l = PAGE_SIZE;
 	int	i;
 
 	rcu_read_lock();
-	peer = rcu_dereference(priv->peer);
-	for (i = 0; i < priv->ports; i++) {
-		n = scnprintf(buf, l, "%pM\n", peer + (i * TORUS_ALEN));
+	ports = rcu_dereference(priv->port);
+	for (i = 0; i < ports->n; i++) {
+		n = scnprintf(buf, l, "%pM\n", ports->port[i].peer);
 		l -= n;
 		buf += n;
 		if (l <= 3 * TORUS_ALEN) {
@@ -134,63 +197,629 @@ static ssize_t show_port(struct device *dev, struct device_attribute *attr,
 			 char *buf)
 {
 	struct	torus *priv = netdev_priv(to_net_dev(dev));
-	struct	net_device **port;
+	struct	torus_ports *ports;
+	struct	net_device *port;
+	ssize_t	n, l = PAGE_SIZE;
+	int	i;
+
+	rcu_read_lock();
+	ports = rcu_dereference(priv->port);
+	for (i = 0; i < ports->n; i++) {
+		if (port = torus_port_dev(ports, i), port)
+			n = scnprintf(buf, l, "%s\n", port->name);
+		else
+			n = scnprintf(buf, l, "\n");
+		l -= n;
+		buf += n;
+		if (l <= IFNAMSIZ) {
+			if (l >= sizeof(elipsis)) {
+				n = scnprintf(buf, l, elipsis);
+				l -= n;
+			}
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return PAGE_SIZE - l;
+}
+
+static ssize_t show_queue(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct	net_device *netdev = to_net_dev(dev);
+	struct	torus *priv = netdev_priv(netdev);
+	u64	packets, bytes, drops;
+	ssize_t	n, l = PAGE_SIZE;
+	int	i;
+
+	for (i = 0; i < netdev->real_num_tx_queues; i++) {
+		get_queue_counters(priv->queue, i, &packets, &bytes, &drops);
+		n = scnprintf(buf, l, "%d %llu %llu %llu\n", i, packets,
+			      bytes, drops);
+		l -= n;
+		buf += n;
+		if (l <= 64) {
+			if (l >= sizeof(elipsis)) {
+				n = scnprintf(buf, l, elipsis);
+				l -= n;
+			}
+			break;
+		}
+	}
+	return PAGE_SIZE - l;
+}
+
+/*
+ * paths has the frames and bytes sent to each port in use
+ */
+static ssize_t show_path(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_ports *ports;
+	u64	v[4];
+	ssize_t	n, l = PAGE_SIZE;
+	int	i;
+
+	rcu_read_lock();
+	ports = rcu_dereference(priv->port);
+	for (i = 1; i < ports->n; i++) {
+		if (!torus_port_dev(ports, i))
+			continue;
+		get_torus_path(priv, i, v);
+		n = scnprintf(buf, l, "%d %llu %llu\n", i, v[2], v[3]);
+		l -= n;
+		buf += n;
+		if (l <= 64) {
+			if (l >= sizeof(elipsis)) {
+				n = scnprintf(buf, l, elipsis);
+				l -= n;
+			}
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return PAGE_SIZE - l;
+}
+
+/*
+ * multipath has a "N ENTRY PORT PORT..." line for each entry of luN with
+ * more than one next hop
+ */
+static ssize_t show_mp(struct device *dev, struct device_attribute *attr,
+		       char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_lu *lu;
+	struct	torus_nhg *nhg;
+	ssize_t	n, l = PAGE_SIZE;
+	int	t, e, i;
+
+	rcu_read_lock();
+	lu = rcu_dereference(priv->lu);
+	for (t = 0; t < TORUS_LU_TBLS; t++)
+		for (e = 0; e < TORUS_LU_TBL_ENTRIES; e++) {
+			if (!lu->mp[t][e])
+				continue;
+			if (l <= 64) {
+				if (l >= sizeof(elipsis)) {
+					n = scnprintf(buf, l, elipsis);
+					l -= n;
+				}
+				goto done;
+			}
+			nhg = &lu->nhg[lu->mp[t][e]];
+			n = scnprintf(buf, l, "%d %d", t + 1, e);
+			for (i = 0; i < nhg->n; i++)
+				n += scnprintf(buf + n, l - n, " %d",
+					       nhg->port[i]);
+			n += scnprintf(buf + n, l - n, "\n");
+			l -= n;
+			buf += n;
+		}
+done:
+	rcu_read_unlock();
+	return PAGE_SIZE - l;
+}
+
+/*
+ * Write "N ENTRY PORT [PORT...]" to multipath to have the flow hash pick
+ * among the given next hops for the ENTRY of luN.
+ */
+static ssize_t store_mp(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_lu *lu;
+	u8	port[TORUS_NHG_PORTS];
+	ulong	t, e, u;
+	uint	n = 0;
+	char	*end;
+	int	err;
+
+	t = simple_strtoul(buf, &end, 10);
+	retonerange(t, 1, TORUS_LU_TBLS, "table");
+	e = simple_strtoul(skip_spaces(end), &end, 10);
+	retonerange(e, 0, TORUS_LU_TBL_ENTRIES - 1, "entry");
+	for (buf = skip_spaces(end); isdigit(*buf); buf = skip_spaces(end)) {
+		retonerange(n, 0, TORUS_NHG_PORTS - 1, "next hops");
+		u = simple_strtoul(buf, &end, 10);
+		retonerange(u, 0, TORUS_PORT_MAX - 1, "port");
+		port[n++] = u;
+	}
+	if (lu = begin_torus_lu(priv), !lu)
+		return -ENOMEM;
+	if (err = set_torus_mp(lu, t - 1, e, port, n), err < 0) {
+		abort_torus_lu(priv, lu);
+		return err;
+	}
+	commit_torus_lu(priv, lu);
+	return bufsz;
+}
+
+static ssize_t show_burst(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", priv->burst_len);
+}
+
+static ssize_t store_burst(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	uint	u;
+
+	retonerr(kstrtouint(buf, 10, &u), "invalid burst");
+	retonerange(u, 0, TORUS_BURST_MAX, "burst");
+	if (u) {
+		int	err;
+
+		if (!rtnl_trylock())
+			return restart_syscall();
+		err = alloc_torus_burst(to_net_dev(dev));
+		rtnl_unlock();
+		retonerr(err, "alloc burst");
+	}
+	ACCESS_ONCE(priv->burst_len) = u;
+	return bufsz;
+}
+
+static ssize_t show_adaptive(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", priv->adaptive);
+}
+
+static ssize_t store_adaptive(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	bool	b;
+
+	retonerr(strtobool(buf, &b), "invalid adaptive");
+	ACCESS_ONCE(priv->adaptive) = b;
+	return bufsz;
+}
+
+/*
+ * deviations is the number of adaptive choices unlike the flow hash's
+ */
+static ssize_t show_deviation(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	u64	sum = 0;
+	int	cpu;
+
+	if (priv->deviations)
+		for_each_possible_cpu(cpu)
+			sum += *per_cpu_ptr(priv->deviations, cpu);
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", sum);
+}
+
+/*
+ * proxy is "HITS MISSES BINDINGS", the address resolutions of the host
+ * answered from or missing in its bindings then the number of them
+ */
+static ssize_t show_proxy(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	u64	v[TORUS_PROXY_STATS];
+
+	get_torus_proxy(priv, v);
+	return scnprintf(buf, PAGE_SIZE, "%llu %llu %llu\n", v[0], v[1], v[2]);
+}
+
+/*
+ * vc is "VC0 VC1 DATELINES", the unicast frames sent on each virtual
+ * channel then those that switched to channel 1 at a dateline
+ */
+static ssize_t show_vc(struct device *dev, struct device_attribute *attr,
+		       char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_vc_counters *p;
+	u64	v[TORUS_VCS + 1] = { 0 };
+	int	cpu, i;
+
+	if (priv->vc)
+		for_each_possible_cpu(cpu) {
+			p = per_cpu_ptr(priv->vc, cpu);
+			for (i = 0; i < TORUS_VCS; i++)
+				v[i] += p->frames[i];
+			v[TORUS_VCS] += p->datelines;
+		}
+	return scnprintf(buf, PAGE_SIZE, "%llu %llu %llu\n", v[0], v[1], v[2]);
+}
+
+/*
+ * ecn is the bytes queued to a physical port beyond which the ECN capable
+ * frames forwarded to it are marked CE; 0 disables marking
+ */
+static ssize_t show_ecn(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", priv->ecn);
+}
+
+static ssize_t store_ecn(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	uint	u;
+
+	retonerr(kstrtouint(buf, 10, &u), "invalid ecn");
+	ACCESS_ONCE(priv->ecn) = u;
+	return bufsz;
+}
+
+/*
+ * marks has a "PORT MARKS" line of the frames marked CE for each port
+ * in use
+ */
+static ssize_t show_mark(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_ports *ports;
+	ssize_t	n, l = PAGE_SIZE;
+	int	i;
+
+	rcu_read_lock();
+	ports = rcu_dereference(priv->port);
+	for (i = 1; i < ports->n; i++) {
+		if (!torus_port_dev(ports, i))
+			continue;
+		n = scnprintf(buf, l, "%d %llu\n", i,
+			      get_torus_marks(priv, i));
+		l -= n;
+		buf += n;
+		if (l <= 64) {
+			if (l >= sizeof(elipsis)) {
+				n = scnprintf(buf, l, elipsis);
+				l -= n;
+			}
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return PAGE_SIZE - l;
+}
+
+/*
+ * backups is the number of frames sent by a backup next hop then a line
+ * of the index of each port that's down
+ */
+static ssize_t show_backup(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_ports *ports;
 	ssize_t	count;
+	u64	sum = 0;
+	int	cpu, i;
 
+	if (priv->backups)
+		for_each_possible_cpu(cpu)
+			sum += *per_cpu_ptr(priv->backups, cpu);
+	count = scnprintf(buf, PAGE_SIZE, "%llu\n", sum);
 	rcu_read_lock();
-	port = rcu_dereference(priv->port);
-	count = show_dev(port, priv->ports, buf);
+	ports = rcu_dereference(priv->port);
+	for (i = 1; i < ports->n; i++)
+		if (torus_port_dev(ports, i) && ports->port[i].down)
+			count += scnprintf(buf + count, PAGE_SIZE - count,
+					   "%d ", i);
 	rcu_read_unlock();
+	if (count && buf[count - 1] == ' ')
+		buf[count - 1] = '\n';
 	return count;
 }
 
+/*
+ * hello is the interval in milliseconds between hellos through each port;
+ * 0 stops them
+ */
+static ssize_t show_hello(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 priv->hello ? priv->hello->interval : 0);
+}
+
+static ssize_t store_hello(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	uint	u;
+
+	retonerr(priv->hello ? 0 : -ENODEV, "no hello");
+	retonerr(kstrtouint(buf, 10, &u), "invalid hello");
+	retonerange(u, 0, USHRT_MAX, "hello");
+	ACCESS_ONCE(priv->hello->interval) = u;
+	if (netif_running(to_net_dev(dev)))
+		start_torus_hello(priv);
+	return bufsz;
+}
+
+/*
+ * neighbors has a line of "INDEX PEER up|down MSEC" for each port that has
+ * heard a hello, MSEC since the last
+ */
+static ssize_t show_neighbor(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_neighbors *h = priv->hello;
+	struct	torus_neighbor *n;
+	ssize_t	count = 0;
+	int	i;
+
+	if (!h)
+		return 0;
+	spin_lock_bh(&h->lock);
+	for (i = 1; i < h->n; i++) {
+		n = &h->neighbor[i];
+		if (!n->heard)
+			continue;
+		if (PAGE_SIZE - count < sizeof(elipsis) + 48) {
+			count += scnprintf(buf + count, PAGE_SIZE - count,
+					   elipsis);
+			break;
+		}
+		count += scnprintf(buf + count, PAGE_SIZE - count,
+				   "%d %pM %s %u\n", i, n->addr,
+				   n->up ? "up" : "down",
+				   jiffies_to_msecs(jiffies - n->heard));
+	}
+	spin_unlock_bh(&h->lock);
+	return count;
+}
+
+/*
+ * convergence is "PORTS LATEST LONGEST MEAN", the number of ports that have
+ * learned their first peer then the microseconds from their add to that
+ */
+static ssize_t show_convergence(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_neighbors *h = priv->hello;
+	u64	converged, latest, longest, total;
+
+	if (!h)
+		return 0;
+	spin_lock_bh(&h->lock);
+	converged = h->converged;
+	latest = h->latest;
+	longest = h->longest;
+	total = h->total;
+	spin_unlock_bh(&h->lock);
+	return scnprintf(buf, PAGE_SIZE, "%llu %llu %llu %llu\n", converged,
+			 div_u64(latest, NSEC_PER_USEC),
+			 div_u64(longest, NSEC_PER_USEC),
+			 converged ? div64_u64(total, converged * NSEC_PER_USEC)
+			 : 0ULL);
+}
+
+/*
+ * spf is "ENABLED RUNS NODES SPF_USEC WRITE_USEC WRITTEN" with the number
+ * of local nodes, the microseconds to compute their paths and write their
+ * tables, and the entries written by the latest run of the name-space;
+ * write 0 or 1 to disable or enable, or "bench" to run it now
+ */
+static ssize_t show_spf(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	u64	v[TORUS_SPF_STATS];
+
+	get_torus_spf(to_net_dev(dev), v);
+	return scnprintf(buf, PAGE_SIZE, "%d %llu %llu %llu %llu %llu\n",
+			 priv->spf, v[0], v[1],
+			 div_u64(v[2], NSEC_PER_USEC),
+			 div_u64(v[3], NSEC_PER_USEC), v[4]);
+}
+
+static ssize_t store_spf(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	bool	b;
+	int	err;
+
+	if (sysfs_streq(buf, "bench")) {
+		err = bench_torus_spf(to_net_dev(dev));
+		return err < 0 ? err : bufsz;
+	}
+	retonerr(strtobool(buf, &b), "invalid spf");
+	ACCESS_ONCE(priv->spf) = b;
+	if (b) {
+		originate_torus_lsa(priv);
+		kick_torus_spf(to_net_dev(dev));
+	}
+	return bufsz;
+}
+
+/*
+ * coord shows SIZE[xSIZE...] ORIGIN[:ORIGIN...] followed by a line with
+ * the plus and minus port index of each dimension; or 0 without coord.
+ */
+static ssize_t show_coord(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	struct	torus_coord *c;
+	ssize_t	n = 0;
+	int	d;
+
+	rcu_read_lock();
+	c = rcu_dereference(priv->coord);
+	if (!c)
+		n = scnprintf(buf, PAGE_SIZE, "0\n");
+	else {
+		for (d = 0; d < c->dims; d++)
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%s%u",
+				       d ? "x" : "", c->size[d]);
+		for (d = 0; d < c->dims; d++)
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%c%02x",
+				       d ? ':' : ' ', c->origin[d]);
+		n += scnprintf(buf + n, PAGE_SIZE - n, "\n");
+		for (d = 0; d < c->dims; d++)
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%u %u\n",
+				       c->plus[d], c->minus[d]);
+	}
+	rcu_read_unlock();
+	return n;
+}
+
+/*
+ * Write SIZE[xSIZE...] [ ORIGIN[:ORIGIN...] ] to coord to route within a
+ * regular toroid by address, the ORIGIN is the hex address byte of
+ * coordinate zero in each dimension; 0 reverts to the lookup tables.
+ */
+static ssize_t store_coord(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t bufsz)
+{
+	struct	torus *priv = netdev_priv(to_net_dev(dev));
+	u16	size[TORUS_MAX_DIMS];
+	u8	origin[TORUS_MAX_DIMS];
+	uint	d, dims = 0;
+	char	*end;
+	ulong	u;
+
+	memset(origin, 0, sizeof(origin));
+	do {
+		u = simple_strtoul(buf, &end, 10);
+		if (end == buf)
+			return -EINVAL;	/* only an explicit 0 reverts */
+		if (u == 0 && dims == 0 && *end != 'x')
+			break;
+		retonerange(dims, 0, TORUS_MAX_DIMS - 1, "dimensions");
+		size[dims++] = u;
+		buf = end + 1;
+	} while (*end == 'x');
+	buf = skip_spaces(end);
+	for (d = 0; d < dims && isxdigit(*buf); d++) {
+		origin[d] = simple_strtoul(buf, &end, 16);
+		buf = *end == ':' ? end + 1 : end;
+	}
+	retonerr(set_torus_coord(priv, dims, size, origin), "set coord");
+	return bufsz;
+}
+
 static ssize_t store_lu(struct device *dev, struct device_attribute *attr,
 			const char *buf, size_t bufsz)
 {
 	struct	torus *priv = netdev_priv(to_net_dev(dev));
 	uint	tbl = lu_idx(attr);
-	u8	u = 0, *lu;
+	struct	torus_lu *lu;
+	u8	u = 0, tmp[TORUS_LU_TBL_ENTRIES];
 	ssize_t	bufi = 0, lui = 0;
 
-	if (lu = kmalloc(TORUS_LU_TBL_ENTRIES, GFP_KERNEL), !lu)
-		return -ENOMEM;
 	for (bufi = 0, lui = 0; lui < TORUS_LU_TBL_ENTRIES; bufi++)
 		if (bufi == bufsz) {
 			pr_torus_err("insufficient entries, %zd", lui);
 			return -EINVAL;
 		} else if (!isdigit(buf[bufi])) {
-			lu[lui++] = u;
+			tmp[lui++] = u;
 			u = 0;
 		} else {
 			u *= 10;
 			u += buf[bufi] - '0';
 		}
-	spin_lock(&priv->lock);
-	memcpy(rcu_dereference(priv->lu) + (tbl * TORUS_LU_TBL_ENTRIES),
-	       lu, TORUS_LU_TBL_ENTRIES);
-	spin_unlock(&priv->lock);
+	if (lu = begin_torus_lu(priv), !lu)
+		return -ENOMEM;
+	memcpy(lu->tbl[tbl], tmp, TORUS_LU_TBL_ENTRIES);
+	memset(lu->mp[tbl], 0, TORUS_LU_TBL_ENTRIES);
+	memset(lu->alt[tbl], 0, TORUS_LU_TBL_ENTRIES);
+	commit_torus_lu(priv, lu);
 	return bufsz;
 }
 
-int create_torus_sysfs(struct net_device *dev)
+static struct attribute *torus_attrs[] = {
+	&dev_attr_lu1.attr,
+	&dev_attr_lu2.attr,
+	&dev_attr_lu3.attr,
+	&dev_attr_lu4.attr,
+	&dev_attr_lu5.attr,
+	&dev_attr_lu_gen.attr,
+	&dev_attr_nodes.attr,
+	&dev_attr_peers.attr,
+	&dev_attr_ports.attr,
+	&dev_attr_queues.attr,
+	&dev_attr_burst.attr,
+	&dev_attr_coord.attr,
+	&dev_attr_paths.attr,
+	&dev_attr_multipath.attr,
+	&dev_attr_adaptive.attr,
+	&dev_attr_deviations.attr,
+	&dev_attr_backups.attr,
+	&dev_attr_hello.attr,
+	&dev_attr_neighbors.attr,
+	&dev_attr_convergence.attr,
+	&dev_attr_spf.attr,
+	&dev_attr_proxy.attr,
+	&dev_attr_vc.attr,
+	&dev_attr_ecn.attr,
+	&dev_attr_marks.attr,
+	NULL
+};
+
+/*
+ * only the master of a virtual toroid has nodes
+ */
+static umode_t torus_attr_visible(struct kobject *kobj, struct attribute *attr,
+				  int i)
 {
+	struct	net_device *dev = to_net_dev(container_of(kobj, struct device,
+							  kobj));
 	struct	torus *priv = netdev_priv(dev);
-#define	new_sys_file(_attr)						\
-	do {	int	err;						\
-		err = device_create_file(&dev->dev,			\
-					 &dev_attr_##_attr);		\
-		if (err)						\
-			return err;					\
-	} while (0)
-
-	new_sys_file(lu1);
-	new_sys_file(lu2);
-	new_sys_file(lu3);
-	new_sys_file(lu4);
-	new_sys_file(lu5);
-	if (priv->node)
-		new_sys_file(nodes);
-	new_sys_file(peers);
-	new_sys_file(ports);
-	return 0;
+
+	if (attr == &dev_attr_nodes.attr && !priv->node)
+		return 0;
+	return attr->mode;
+}
+
+static struct attribute_group torus_group = {
+	.attrs		= torus_attrs,
+	.is_visible	= torus_attr_visible,
+};
+
+/*
+ * set_torus_sysfs has register_netdevice() add the torus attributes as a
+ * group with the rest, and its unregister remove them; so it must be
+ * called before the register.
+ */
+void set_torus_sysfs(struct net_device *dev)
+{
+	dev->sysfs_groups[0] = &torus_group;
 }
@@ -22,12 +22,26 @@
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/ethtool.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
 #include <net/rtnetlink.h>
+#include <net/sch_generic.h>
+#include <net/inet_ecn.h>
 #include <linux/torus.h>
 #include <counters.h>
 #include <printk.h>
 #include <err.h>
 #include <addr.h>
+#include <coord.h>
+#include <latency.h>
+#include <hello.h>
+#include <spf.h>
+#include <route.h>
+#include <proxy.h>
+#include <label.h>
+#include <udp.h>
+#include <torus_trace.h>
 
 #ifndef	UNUSED
 #define	UNUSED	__attribute__((__unused__))
@@ -43,15 +57,174 @@
 
 #define	TORUS_PORT_MAX		256
 #define	TORUS_PORT_CHUNK	16
+#define	TORUS_PORT_CHUNKS	(TORUS_PORT_MAX / TORUS_PORT_CHUNK)
 #define	TORUS_LU_TBLS		(TORUS_ALEN - 1)
 #define	TORUS_LU_TBL_ENTRIES	256
 #define	TORUS_LU_SZ		(TORUS_LU_TBLS * TORUS_LU_TBL_ENTRIES)
-#define	TORUS_LU(addr,tbl)	\
-	(((tbl) * TORUS_LU_TBL_ENTRIES) + (addr)[(tbl) + 1])
+#define	TORUS_LU(lu,addr,t)	((lu)->tbl[t][(addr)[(t) + 1]])
+#define	TORUS_MP(lu,addr,t)	((lu)->mp[t][(addr)[(t) + 1]])
+#define	TORUS_ALT(lu,addr,t)	((lu)->alt[t][(addr)[(t) + 1]])
+#define	TORUS_NHG_MAX		64
+#define	TORUS_NHG_PORTS		(2 * TORUS_MAX_DIMS)
+#define	TORUS_BURST_MAX		NAPI_POLL_WEIGHT
+#define	TORUS_BURST_BACKLOG	(16 * TORUS_BURST_MAX)
+/*
+ * Frames keep their GSO and CHECKSUM_PARTIAL state through the toroid; a
+ * physical port without these offloads segments and checksums on egress.
+ */
+#define	TORUS_FEATURES	(NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HW_CSUM | \
+			 NETIF_F_RXCSUM | NETIF_F_HIGHDMA | NETIF_F_TSO | \
+			 NETIF_F_TSO6 | NETIF_F_TSO_ECN)
+
+/*
+ * With a non-zero torus.burst, ndo_rx() queues frames received by ports
+ * to the per-cpu burst for lookup and transmit in bulk by its napi poll.
+ * The burst is allocated when torus.burst is first set, so a node that
+ * never batches has none.
+ */
+struct	torus_burst {
+	struct	napi_struct	napi;
+	struct	sk_buff_head	q;
+	/*
+	 * skb[] and port[] hold a burst between its lookup and transmit
+	 */
+	struct	sk_buff		*skb[TORUS_BURST_MAX];
+	struct	net_device	*port[TORUS_BURST_MAX];
+};
+
+/*
+ * Each port has a record of its own cache line so that the forwarding
+ * path finds its device, liveness and peer together.  peer is the LLADDR
+ * of the node at the other side of the point-to-point link and down is
+ * set while the port isn't running or has lost its carrier.
+ */
+struct	torus_port {
+	struct	net_device	*dev;
+	bool			down;
+	u8			peer[TORUS_ALEN];
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The port records are replaced whole, and the old freed after a grace
+ * period, only to grow or shrink them by TORUS_PORT_CHUNK; n is the number
+ * of records, used or not.
+ */
+struct	torus_ports {
+	struct	rcu_head	rcu;
+	uint			n;
+	struct	torus_port	port[0];
+};
+
+/*
+ * A next hop group is a set of ports with minimal paths to the same
+ * destinations, the flow hash picks one of them for each frame.
+ */
+struct	torus_nhg {
+	u8			n;
+	u8			port[TORUS_NHG_PORTS];
+};
+
+/*
+ * The lookup tables are replaced whole so that readers see either the
+ * old or the new set, never a mix.  Each table is 256 bytes so, with the
+ * set cache-line aligned by torus_lu_cache, a lookup touches one line per
+ * table.
+ */
+struct	torus_lu {
+	u8			tbl[TORUS_LU_TBLS][TORUS_LU_TBL_ENTRIES]
+					____cacheline_aligned_in_smp;
+	/*
+	 * a non-zero mp[t][e] is the index of the nhg[] that replaces the
+	 * single port of tbl[t][e]; nhg[0] isn't used
+	 */
+	u8			mp[TORUS_LU_TBLS][TORUS_LU_TBL_ENTRIES]
+					____cacheline_aligned_in_smp;
+	/*
+	 * a non-zero alt[t][e] is the port of a loop-free alternate path
+	 * taken while that of tbl[t][e] is down
+	 */
+	u8			alt[TORUS_LU_TBLS][TORUS_LU_TBL_ENTRIES]
+					____cacheline_aligned_in_smp;
+	struct	torus_nhg	nhg[TORUS_NHG_MAX];
+	/*
+	 * gen counts the sets published since the device was created
+	 */
+	u64			gen;
+	struct	rcu_head	rcu;
+};
 
 struct	torus {
+	/*
+	 * dev is the net_device of this torus, the same as port[0]
+	 */
+	struct	net_device	*dev;
 	struct	counters 	rx;
 	struct	counters	tx;
+	/*
+	 * queue has the per cpu counts of each of dev->num_tx_queues
+	 */
+	struct	queue_counters __percpu *queue;
+	/*
+	 * path has the per cpu receives and transmits of each chunk of port
+	 * indices and drop the per cpu drops of each reason
+	 */
+	struct	port_counters __percpu *path[TORUS_PORT_CHUNKS];
+	struct	drop_counters __percpu *drop;
+	/*
+	 * with adaptive, the least backlogged of multiple minimal next hops
+	 * is chosen rather than that of the flow hash; deviations counts
+	 * the choices that differ
+	 */
+	bool			adaptive;
+	ulong	__percpu	*deviations;
+	/*
+	 * backups counts the lookups that took a next hop's backup since
+	 * its port was down
+	 */
+	ulong	__percpu	*backups;
+	/*
+	 * vc counts the unicast frames sent on each virtual channel and
+	 * those that crossed a dateline onto channel 1
+	 */
+	struct	torus_vc_counters __percpu *vc;
+	/*
+	 * with an ecn threshold of queued bytes, the ECN capable frames
+	 * forwarded to a physical port more loaded than that are marked CE;
+	 * marks has the per cpu count of each chunk of port indices
+	 */
+	uint			ecn;
+	ulong	__percpu	*marks[TORUS_PORT_CHUNKS];
+	/*
+	 * with timed, latency has the per cpu histograms of the time frames
+	 * spend in this node; it's allocated on first use and kept until
+	 * the destructor so the forwarding path needn't synchronize
+	 */
+	bool			timed;
+	struct	torus_latency __percpu *latency;
+	struct	dentry		*debugfs;
+	/*
+	 * hello has the state of the neighbor discovery on each port
+	 */
+	struct	torus_neighbors	*hello;
+	/*
+	 * dying is set by rto_dellink() so that ndo_close() leaves the
+	 * purge of the burst queues to ndo_uninit(), after the one
+	 * synchronize_net() of the whole batch
+	 */
+	bool			dying;
+	/*
+	 * with spf, the lookup tables are computed from the link state
+	 * database of the name-space; spf_owned marks the entries it wrote.
+	 * It's off until set so it doesn't replace those written otherwise.
+	 */
+	bool			spf;
+	ulong			spf_owned[BITS_TO_LONGS(TORUS_LU_SZ)];
+	struct	torus_burst __percpu *burst;
+	/*
+	 * burst is the maximum number of frames looked up and sent per
+	 * round of the napi poll; 0 disables batching
+	 */
+	uint			burst_len;
 	spinlock_t		lock;
 	/*
 	 * node is only used by the master of a virtual torus network
@@ -60,26 +233,93 @@ struct	torus {
 	struct	net_device	**node;
 	uint			nodes;
 	/*
-	 * port[0] always points back to dev
-	 * port[] grows as necessary by PORTS_CHUNK up to PORTS_MAX
+	 * port->port[0].dev always points back to dev; the records are
+	 * only changed with port_mutex held, which nests outside of lock
+	 */
+	struct	mutex		port_mutex;
+	struct	torus_ports	__rcu *port;
+	/*
+	 * Each entry of lu->tbl[] is an index to port->port[]
+	 */
+	struct	torus_lu	__rcu *lu;
+	/*
+	 * with coord, the next hop within a regular toroid is computed
+	 * from the destination address instead of looked up in lu[]
+	 */
+	struct	torus_coord	__rcu *coord;
+	/*
+	 * rt has the longest prefix match of the IPv4 and IPv6 destinations
+	 * of host sourced frames to torus addresses; it's replaced with
+	 * rtnl held
 	 */
-	struct	net_device	**port;
-	uint			ports;
+	struct	torus_rt	__rcu *rt;
 	/*
-	 * peer[i] is the LLADDR of the node at the other side of the
-	 * point-to-point link from port[i]
+	 * proxy answers the host's address resolution from its bindings
 	 */
-	u8			*peer;
+	struct	torus_proxy	*proxy;
 	/*
-	 * Each entry of lu[] is an index to port[] and peer[]
+	 * labels switch MPLS frames by their top label rather than their
+	 * destination; it's replaced with rtnl held
 	 */
-	u8			*lu;
+	struct	torus_labels	__rcu *labels;
 };
 
+extern       struct	kmem_cache	*torus_lu_cache;
 extern       struct	rtnl_link_ops	torus_rtnl;
+extern       struct	rtnl_link_ops	torus_udp_rtnl;
 extern const struct	net_device_ops	torus_netdev;
 extern const struct	ethtool_ops	torus_ethtool;
-extern int   create_torus_sysfs(struct net_device *dev);
+extern void  set_torus_sysfs(struct net_device *dev);
+extern int   register_torus_debugfs(void);
+extern void  unregister_torus_debugfs(void);
+extern void  create_torus_debugfs(struct net_device *dev);
+extern void  remove_torus_debugfs(struct net_device *dev);
+extern void  notify_torus_peer(struct net_device *dev, uint port,
+			       const u8 *peer, bool up);
+extern int   alloc_torus_burst(struct net_device *dev);
+extern int   alloc_torus_hello(struct net_device *dev);
+extern void  free_torus_hello(struct torus *priv);
+extern int   grow_torus_neighbors(struct torus *priv, uint n);
+extern void  start_torus_hello(struct torus *priv);
+extern void  stop_torus_hello(struct torus *priv);
+extern void  reset_torus_neighbor(struct torus *priv, int i);
+extern void  recv_torus_hello(struct torus *priv, struct net_device *dev,
+			      struct sk_buff *skb);
+extern struct sk_buff *new_torus_hello_skb(struct net_device *dev,
+					   struct net_device *port, uint len);
+extern int   register_torus_spf(void);
+extern void  unregister_torus_spf(void);
+extern void  originate_torus_lsa(struct torus *priv);
+extern void  recv_torus_lsa(struct torus *priv, struct net_device *dev,
+			    struct sk_buff *skb);
+extern void  withdraw_torus_lsa(struct net_device *dev);
+extern void  kick_torus_spf(struct net_device *dev);
+extern void  get_torus_spf(struct net_device *dev, u64 *v);
+extern int   bench_torus_spf(struct net_device *dev);
+extern int   register_torus_genl(void);
+extern void  unregister_torus_genl(void);
+extern int   set_torus_coord(struct torus *priv, uint dims, const u16 *size,
+			     const u8 *origin);
+extern void  update_torus_coord(struct torus *priv);
+extern int   set_torus_routes(struct torus *priv,
+			      const struct torus_genl_route *r, uint n,
+			      bool del);
+extern int   alloc_torus_proxy(struct net_device *dev);
+extern void  free_torus_proxy(struct torus *priv);
+extern bool  proxy_torus_neigh(struct torus *priv, struct sk_buff *skb);
+extern void  learn_torus_neigh(struct torus *priv, struct sk_buff *skb);
+extern int   set_torus_bindings(struct torus *priv,
+				const struct torus_genl_binding *b, uint n,
+				bool del);
+extern uint  get_torus_bindings(struct torus *priv,
+				struct torus_genl_binding *b, uint max);
+extern void  get_torus_proxy(struct torus *priv, u64 *v);
+extern int   set_torus_labels(struct torus *priv,
+			      const struct torus_genl_label *l, uint n,
+			      bool del);
+extern struct net_device *switch_torus_label(struct torus *priv,
+					     struct sk_buff *skb,
+					     uint *reason);
 
 #define	set_torus_master(master,dev)	\
 	torus_netdev.ndo_add_slave(master, dev)
@@ -91,27 +331,280 @@ static inline bool is_torus(struct net_device *dev)
 	return dev && dev->netdev_ops == &torus_netdev;
 }
 
+struct	torus_vc_counters {
+	ulong	frames[TORUS_VCS];
+	ulong	datelines;
+};
+
+/*
+ * torus_drop counts a dropped frame in c and by reason then traces it
+ */
+static inline void torus_drop(struct torus *priv, struct counters *c,
+			      uint reason, const u8 *dest, uint len)
+{
+	count_drop(c);
+	count_drop_reason(priv->drop, reason, 1);
+	trace_torus_drop(priv->dev, reason, dest, len);
+}
+
+/*
+ * torus_latency returns the histograms to count in, or NULL if not timed
+ */
+static inline struct torus_latency __percpu *torus_latency(struct torus *priv)
+{
+	if (!ACCESS_ONCE(priv->timed))
+		return NULL;
+	smp_rmb();
+	return priv->latency;
+}
+
+static inline size_t torus_ports_size(uint n)
+{
+	return sizeof(struct torus_ports) + (n * sizeof(struct torus_port));
+}
+
+/*
+ * torus_ports_locked returns the port records to a holder of port_mutex
+ */
+static inline struct torus_ports *torus_ports_locked(struct torus *priv)
+{
+	return rcu_dereference_protected(priv->port,
+					 lockdep_is_held(&priv->port_mutex));
+}
+
+/*
+ * nr_torus_ports returns the number of port records, used or not; it only
+ * changes with rtnl held
+ */
+static inline uint nr_torus_ports(struct torus *priv)
+{
+	uint	n;
+
+	rcu_read_lock();
+	n = rcu_dereference(priv->port)->n;
+	rcu_read_unlock();
+	return n;
+}
+
+/*
+ * The per cpu path counters and marks are allocated a chunk at a time as
+ * the port records first grow to them, then kept until the destructor so
+ * that neither a reader of shrunk records nor a stale lookup entry finds
+ * them freed.  Nothing is counted to a chunk that isn't there.
+ */
+#define	torus_port_chunk(priv, x, i)					\
+	((i) < TORUS_PORT_MAX ?						\
+	 ACCESS_ONCE((priv)->x[(i) / TORUS_PORT_CHUNK]) : NULL)
+
+static inline int grow_torus_port_chunks(struct torus *priv, uint n)
+{
+	struct	port_counters __percpu *path;
+	ulong	__percpu *marks;
+	uint	c;
+
+	for (c = 0; c < DIV_ROUND_UP(n, TORUS_PORT_CHUNK); c++) {
+		if (!priv->path[c]) {
+			path = alloc_port_counters(TORUS_PORT_CHUNK);
+			if (!path)
+				return -ENOMEM;
+			ACCESS_ONCE(priv->path[c]) = path;
+		}
+		if (!priv->marks[c]) {
+			marks = __alloc_percpu(TORUS_PORT_CHUNK * sizeof(ulong),
+					       __alignof__(ulong));
+			if (!marks)
+				return -ENOMEM;
+			ACCESS_ONCE(priv->marks[c]) = marks;
+		}
+	}
+	return 0;
+}
+
+static inline void free_torus_port_chunks(struct torus *priv)
+{
+	uint	c;
+
+	for (c = 0; c < TORUS_PORT_CHUNKS; c++) {
+		if (priv->path[c])
+			free_percpu(priv->path[c]);
+		if (priv->marks[c])
+			free_percpu(priv->marks[c]);
+	}
+}
+
+static inline void count_torus_path_rx(struct torus *priv, uint i, uint bytes)
+{
+	count_port_rx(torus_port_chunk(priv, path, i), i % TORUS_PORT_CHUNK,
+		      bytes);
+}
+
+static inline void count_torus_path_tx(struct torus *priv, uint i, uint bytes)
+{
+	count_port_tx(torus_port_chunk(priv, path, i), i % TORUS_PORT_CHUNK,
+		      bytes);
+}
+
+static inline void get_torus_path(struct torus *priv, uint i, u64 *v)
+{
+	get_port_counters(torus_port_chunk(priv, path, i),
+			  i % TORUS_PORT_CHUNK, v);
+}
+
+static inline void count_torus_mark(struct torus *priv, uint i)
+{
+	ulong	__percpu *marks = torus_port_chunk(priv, marks, i);
+
+	if (marks)
+		this_cpu_inc(marks[i % TORUS_PORT_CHUNK]);
+}
+
+/*
+ * reset_torus_marks clears the count of a port index as it's reused
+ */
+static inline void reset_torus_marks(struct torus *priv, uint i)
+{
+	ulong	__percpu *marks = torus_port_chunk(priv, marks, i);
+	int	cpu;
+
+	if (marks)
+		for_each_possible_cpu(cpu)
+			per_cpu_ptr(marks, cpu)[i % TORUS_PORT_CHUNK] = 0;
+}
+
+static inline u64 get_torus_marks(struct torus *priv, uint i)
+{
+	ulong	__percpu *marks = torus_port_chunk(priv, marks, i);
+	u64	sum = 0;
+	int	cpu;
+
+	if (marks)
+		for_each_possible_cpu(cpu)
+			sum += per_cpu_ptr(marks, cpu)[i % TORUS_PORT_CHUNK];
+	return sum;
+}
+
+/*
+ * torus_port_dev returns the device of port i, or NULL if it's unused or
+ * beyond the records, perhaps since shrunk under a stale lookup entry
+ */
+static inline struct net_device *torus_port_dev(const struct torus_ports *ports,
+						uint i)
+{
+	return i < ports->n ? ACCESS_ONCE(ports->port[i].dev) : NULL;
+}
+
+/*
+ * torus_port_down is checked per frame so it also catches a lost carrier
+ * before the link watch gets to the notifier
+ */
+static inline bool torus_port_down(const struct torus_ports *ports, uint i)
+{
+	struct	net_device *dev = torus_port_dev(ports, i);
+
+	return !dev || ACCESS_ONCE(ports->port[i].down) ||
+		!netif_carrier_ok(dev);
+}
+
+static inline bool torus_port_live(struct net_device *dev)
+{
+	return netif_running(dev) && netif_carrier_ok(dev);
+}
+
+/*
+ * update_torus_port_live sets the down flag of dev's port of priv from its
+ * state
+ */
+static inline void update_torus_port_live(struct torus *priv,
+					  struct net_device *dev)
+{
+	struct	torus_ports *ports;
+	uint	i;
+
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	for (i = 1; i < ports->n; i++)
+		if (ports->port[i].dev == dev)
+			ports->port[i].down = !torus_port_live(dev);
+	mutex_unlock(&priv->port_mutex);
+}
+
+/*
+ * torus_backup_hop returns the chosen port i if it's live, otherwise
+ * another live one of the n next hops, else alt if that's live; or i if
+ * none are.
+ */
+static inline u8 torus_backup_hop(struct torus *priv,
+				  const struct torus_ports *ports,
+				  const u8 *hop, uint n, u8 i, u8 alt)
+{
+	uint	j;
+
+	if (likely(!torus_port_down(ports, i)))
+		return i;
+	for (j = 0; j < n; j++)
+		if (hop[j] != i && !torus_port_down(ports, hop[j]))
+			break;
+	if (j < n)
+		alt = hop[j];
+	else if (!alt || torus_port_down(ports, alt))
+		return i;
+	if (priv->backups)
+		this_cpu_inc(*priv->backups);
+	return alt;
+}
+
+/*
+ * alloc_torus_counters allocates the per cpu counters of a device as it's
+ * initialized, with the path counters and marks of its first port chunk;
+ * free_torus_counters releases whatever of them was allocated.
+ */
+static inline int alloc_torus_counters(struct torus *priv)
+{
+	alloc_percpu_counters(&priv->rx);
+	alloc_percpu_counters(&priv->tx);
+	priv->deviations = alloc_percpu(ulong);
+	priv->backups = alloc_percpu(ulong);
+	priv->vc = alloc_percpu(struct torus_vc_counters);
+	priv->drop = alloc_percpu(struct drop_counters);
+	if (!have_percpu_counters(&priv->rx) ||
+	    !have_percpu_counters(&priv->tx) ||
+	    !priv->deviations || !priv->backups || !priv->vc || !priv->drop)
+		return -ENOMEM;
+	return grow_torus_port_chunks(priv, TORUS_PORT_CHUNK);
+}
+
+static inline void free_torus_counters(struct torus *priv)
+{
+	free_percpu_counters(&priv->rx);
+	free_percpu_counters(&priv->tx);
+	if (priv->deviations)
+		free_percpu(priv->deviations);
+	if (priv->backups)
+		free_percpu(priv->backups);
+	if (priv->vc)
+		free_percpu(priv->vc);
+	if (priv->drop)
+		free_percpu(priv->drop);
+	free_torus_port_chunks(priv);
+}
+
 static inline int alloc_torus(struct torus *priv)
 {
-	struct	net_device **port;
-	u8	*peer, *lu;
+	struct	torus_ports *ports;
+	struct	torus_lu *lu;
 
-	port = kcalloc(TORUS_PORT_CHUNK, sizeof(*port), GFP_KERNEL);
-	gotonerr(err_alloc_port, port ? 0 : -ENOMEM, "alloc port");
-	peer = kcalloc(TORUS_PORT_CHUNK, TORUS_ALEN, GFP_KERNEL);
-	gotonerr(err_alloc_peer, peer ? 0 : -ENOMEM, "alloc peer");
-	lu = kzalloc(TORUS_LU_SZ, GFP_KERNEL);
+	ports = kzalloc(torus_ports_size(TORUS_PORT_CHUNK), GFP_KERNEL);
+	gotonerr(err_alloc_port, ports ? 0 : -ENOMEM, "alloc port");
+	lu = kmem_cache_zalloc(torus_lu_cache, GFP_KERNEL);
 	gotonerr(err_alloc_lu, lu ? 0 : -ENOMEM, "alloc lu");
-	priv->ports = TORUS_PORT_CHUNK;
-	rcu_assign_pointer(priv->port, port);
-	rcu_assign_pointer(priv->peer, peer);
+	ports->n = TORUS_PORT_CHUNK;
+	mutex_init(&priv->port_mutex);
+	rcu_assign_pointer(priv->port, ports);
 	rcu_assign_pointer(priv->lu, lu);
 	return 0;
 
 err_alloc_lu:
-	kfree(peer);
-err_alloc_peer:
-	kfree(port);
+	kfree(ports);
 err_alloc_port:
 	return -ENOMEM;
 }
@@ -119,52 +612,320 @@ err_alloc_port:
 static inline void free_torus(struct torus *priv)
 {
 	kfree(priv->port);
-	kfree(priv->peer);
-	kfree(priv->lu);
+	if (priv->lu)
+		kmem_cache_free(torus_lu_cache, priv->lu);
+	free_torus_rt(rcu_dereference_protected(priv->rt, 1));
+	kfree(rcu_dereference_protected(priv->labels, 1));
+	kfree(priv->coord);
 }
 
+/*
+ * set_torus_dest replaces the router address of a host sourced frame with
+ * the torus address routed to its IP destination; the caller must reload
+ * its header since this may move skb->data.
+ */
 static inline void set_torus_dest(struct torus *priv, struct sk_buff *skb)
 {
-	struct	ethhdr *e = (struct ethhdr *)skb->data;
+	struct	torus_rt *rt;
+	const	u8 *addr = NULL;
+
+	rcu_read_lock();
+	if (rt = rcu_dereference(priv->rt), rt)
+		addr = lookup_torus_rt(rt, skb);
+	if (addr)
+		memcpy(((struct ethhdr *)skb->data)->h_dest, addr, TORUS_ALEN);
+	else
+		((struct ethhdr *)skb->data)->h_dest[0] = 0;	/* drop */
+	rcu_read_unlock();
+}
+
+/*
+ * torus_port_load is the bytes queued by the qdisc and in flight by BQL
+ * on the tx queue of port that the flow hash selects.
+ */
+static inline uint torus_port_load(struct net_device *port, u32 hash)
+{
+	struct	netdev_queue *txq;
+	struct	Qdisc *q;
+	uint	load = 0;
 
-	/* FIXME lookup torus lladdr from ip[v6] addr */
-	e->h_dest[0] = 0;	/* this will drop for now */
+	if (!port)
+		return UINT_MAX;
+	txq = netdev_get_tx_queue(port, torus_pick(hash,
+						   port->real_num_tx_queues));
+	if (q = rcu_dereference_bh(txq->qdisc), q)
+		load += q->qstats.backlog;
+#ifdef CONFIG_BQL
+	load += txq->dql.num_queued - txq->dql.num_completed;
+#endif
+	return load;
 }
 
-static inline struct net_device *lookup_torus_port(struct torus *priv, u8 *addr)
+/*
+ * torus_ecn marks an IPv4 or IPv6 ECT frame to port i with CE while the
+ * port's load exceeds the ecn threshold, so the sources slow down before
+ * the port drops any.  The IP header of a clone is copied before it's
+ * written, and a frame that can't be is left unmarked.
+ */
+static inline void torus_ecn(struct torus *priv, struct net_device *port,
+			     int i, struct sk_buff *skb)
 {
-	struct	net_device *dev, **port, *a[TORUS_LU_TBLS];
-	u8	*lu;
-	int	i;
+	uint	threshold = ACCESS_ONCE(priv->ecn);
+	uint	len = skb_network_offset(skb);
+
+	if (!threshold || i <= 0 || is_torus(port) ||
+	    torus_port_load(port, skb_get_rxhash(skb)) <= threshold)
+		return;
+	if (skb->protocol == htons(ETH_P_IP))
+		len += sizeof(struct iphdr);
+	else if (skb->protocol == htons(ETH_P_IPV6))
+		len += sizeof(struct ipv6hdr);
+	else
+		return;
+	if (!pskb_may_pull(skb, len) ||
+	    (skb_cloned(skb) && !skb_clone_writable(skb, len) &&
+	     pskb_expand_head(skb, 0, 0, GFP_ATOMIC)))
+		return;
+	if (INET_ECN_set_ce(skb))
+		count_torus_mark(priv, i);
+}
+
+/*
+ * torus_pick_hop returns the flow hash choice of the n next hops or,
+ * if adaptive, the least loaded of them
+ */
+static inline u8 torus_pick_hop(struct torus *priv,
+				const struct torus_ports *ports,
+				const u8 *hop, uint n, u32 hash)
+{
+	uint	i, pick = torus_pick(hash, n), best = pick, load, least;
+
+	if (n == 1 || !ACCESS_ONCE(priv->adaptive))
+		return hop[pick];
+	least = torus_port_load(torus_port_dev(ports, hop[pick]), hash);
+	for (i = 0; i < n && least; i++) {
+		if (i == pick)
+			continue;
+		load = torus_port_load(torus_port_dev(ports, hop[i]), hash);
+		if (load < least) {
+			least = load;
+			best = i;
+		}
+	}
+	if (best != pick && priv->deviations)
+		this_cpu_inc(*priv->deviations);
+	return hop[best];
+}
+
+/*
+ * torus_coord_next_vc sets the virtual channel of a frame to addr going out
+ * port i by the dateline of its ring
+ */
+static inline void torus_coord_next_vc(struct torus *priv,
+				       const struct torus_coord *c, u8 *addr,
+				       struct sk_buff *skb, uint i)
+{
+	struct	torus_skb_cb *cb = TORUS_SKB_CB(skb);
+	uint	vc = get_torus_vc(addr);
+	int	in = cb->in ? torus_coord_dim(c, cb->in) : cb->dim;
+	int	out = torus_coord_dim(c, i);
+
+	cb->dim = out;
+	if (vc = torus_coord_vc(c, in, vc, i, out), vc == get_torus_vc(addr))
+		return;
+	set_torus_vc(addr, vc);
+	if (vc && priv->vc)
+		this_cpu_inc(priv->vc->datelines);
+}
+
+/*
+ * __lookup_torus_port must be called within rcu_read_lock(); the flow hash
+ * of skb picks among multiple next hops and its length is counted to the
+ * chosen path.  A frame to another node goes on the virtual channel of its
+ * next hop, which is carried in its destination, leaving skb->priority to
+ * its class.
+ */
+static inline struct net_device *__lookup_torus_port(struct torus *priv,
+						     u8 *addr,
+						     struct sk_buff *skb)
+{
+	struct	torus_ports *ports;
+	struct	torus_coord *coord;
+	struct	torus_lu *lu;
+	struct	torus_nhg *nhg;
+	u8	a[TORUS_LU_TBLS], hop[2 * TORUS_MAX_DIMS];
+	uint	n;
+	int	i, t, g;
 
 	if (!is_local_ether_addr(addr))
 		return NULL;
-	rcu_read_lock();
-	port = rcu_dereference(priv->port);
+	ports = rcu_dereference(priv->port);
+	coord = rcu_dereference(priv->coord);
+	if (coord && (n = torus_coord_hops(coord, addr, hop), n)) {
+		i = torus_pick_hop(priv, ports, hop, n, skb_get_rxhash(skb));
+		i = torus_backup_hop(priv, ports, hop, n, i, 0);
+		torus_coord_next_vc(priv, coord, addr, skb, i);
+		goto found;
+	}
 	lu = rcu_dereference(priv->lu);
-	dev = port[0];
-	for (i = 0; i < TORUS_LU_TBLS; i++)
-		a[i] = port[lu[TORUS_LU(addr, i)]];
+	for (t = 0; t < TORUS_LU_TBLS; t++)
+		a[t] = TORUS_LU(lu, addr, t);
+	for (t = 0; t < TORUS_LU_TBLS; t++)
+		if (a[t] != 0)
+			break;
+	if (t == TORUS_LU_TBLS)
+		return ports->port[0].dev;
+	if (g = TORUS_MP(lu, addr, t), g) {
+		nhg = &lu->nhg[g];
+		i = torus_pick_hop(priv, ports, nhg->port, nhg->n,
+				   skb_get_rxhash(skb));
+		i = torus_backup_hop(priv, ports, nhg->port, nhg->n, i,
+				     TORUS_ALT(lu, addr, t));
+	} else
+		i = torus_backup_hop(priv, ports, &a[t], 1, a[t],
+				     TORUS_ALT(lu, addr, t));
+found:
+	count_torus_path_tx(priv, i, skb->len);
+	if (i && priv->vc)
+		this_cpu_inc(priv->vc->frames[get_torus_vc(addr)]);
+	return torus_port_dev(ports, i);
+}
+
+static inline struct net_device *lookup_torus_port(struct torus *priv, u8 *addr,
+						   struct sk_buff *skb)
+{
+	struct	net_device *dev;
+
+	rcu_read_lock();
+	dev = __lookup_torus_port(priv, addr, skb);
 	rcu_read_unlock();
-	for (i = 0; i < TORUS_LU_TBLS; i++)
-		if (a[i] != dev)
-			return a[i];
 	return dev;
 }
 
-static inline void set_torus_lu(struct torus *priv, u8 *addr, u8 idx, u8 val)
+static inline void free_torus_lu_rcu(struct rcu_head *rcu)
 {
-	u8	*lu;
+	kmem_cache_free(torus_lu_cache, container_of(rcu, struct torus_lu, rcu));
+}
 
+/*
+ * begin_torus_lu returns a copy of the live lookup tables to change then
+ * publish with commit_torus_lu or drop with abort_torus_lu; priv->lock is
+ * held in between so the caller must not sleep.  Like lock_task_sighand(),
+ * it only holds the lock if it returns a copy.
+ */
+#define	begin_torus_lu(priv)						\
+({									\
+	struct	torus_lu *__lu;						\
+	__cond_lock(&(priv)->lock, (__lu = __begin_torus_lu(priv)));	\
+	__lu;								\
+})
+
+static inline struct torus_lu *__begin_torus_lu(struct torus *priv)
+{
+	struct	torus_lu *lu, *old;
+
+	if (lu = kmem_cache_alloc(torus_lu_cache, GFP_KERNEL), !lu)
+		return NULL;
 	spin_lock(&priv->lock);
-	lu = rcu_dereference(priv->lu);
-	lu[TORUS_LU(addr, idx)] = val;
+	old = rcu_dereference_protected(priv->lu,
+					lockdep_is_held(&priv->lock));
+	memcpy(lu, old, offsetof(struct torus_lu, gen));
+	lu->gen = old->gen;
+	return lu;
+}
+
+static inline u64 commit_torus_lu(struct torus *priv, struct torus_lu *lu)
+	__releases(&priv->lock)
+{
+	struct	torus_lu *old;
+	u64	gen;
+
+	old = rcu_dereference_protected(priv->lu,
+					lockdep_is_held(&priv->lock));
+	gen = lu->gen = old->gen + 1;
+	rcu_assign_pointer(priv->lu, lu);
 	spin_unlock(&priv->lock);
+	call_rcu(&old->rcu, free_torus_lu_rcu);
+	trace_torus_lu_update(priv->dev, gen);
+	return gen;
 }
 
+static inline void abort_torus_lu(struct torus *priv, struct torus_lu *lu)
+	__releases(&priv->lock)
+{
+	spin_unlock(&priv->lock);
+	kmem_cache_free(torus_lu_cache, lu);
+}
+
+static inline int set_torus_lu(struct torus *priv, u8 *addr, u8 idx, u8 val)
+{
+	struct	torus_lu *lu;
+
+	if (lu = begin_torus_lu(priv), !lu)
+		return -ENOMEM;
+	TORUS_LU(lu, addr, idx) = val;
+	TORUS_MP(lu, addr, idx) = 0;
+	TORUS_ALT(lu, addr, idx) = 0;
+	commit_torus_lu(priv, lu);
+	return 0;
+}
+
+/*
+ * set_torus_mp makes entry e of table t, in a copy from begin_torus_lu,
+ * the n ports of an nhg[] with the same ports or else an unused one.
+ * With one port, it's an ordinary entry.
+ */
+static inline int set_torus_mp(struct torus_lu *lu, uint t, uint e,
+			       const u8 *port, uint n)
+{
+	bool	used[TORUS_NHG_MAX];
+	uint	g, unused = 0, i, j;
+
+	if (n == 0 || n > TORUS_NHG_PORTS)
+		return -EINVAL;
+	lu->tbl[t][e] = port[0];
+	lu->mp[t][e] = 0;
+	lu->alt[t][e] = 0;
+	if (n == 1)
+		return 0;
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < TORUS_LU_TBLS; i++)
+		for (j = 0; j < TORUS_LU_TBL_ENTRIES; j++)
+			used[lu->mp[i][j]] = true;
+	for (g = 1; g < TORUS_NHG_MAX; g++)
+		if (!used[g]) {
+			if (!unused)
+				unused = g;
+		} else if (lu->nhg[g].n == n &&
+			   !memcmp(lu->nhg[g].port, port, n))
+			break;
+	if (g == TORUS_NHG_MAX) {
+		if (!unused)
+			return -ENOSPC;
+		g = unused;
+		lu->nhg[g].n = n;
+		memcpy(lu->nhg[g].port, port, n);
+	}
+	lu->mp[t][e] = g;
+	return 0;
+}
+
+static inline u64 get_torus_lu_gen(struct torus *priv)
+{
+	u64	gen;
+
+	rcu_read_lock();
+	gen = rcu_dereference(priv->lu)->gen;
+	rcu_read_unlock();
+	return gen;
+}
+
+/*
+ * a virtual toroid may have up to TORUS_MAX_NODES so its table is vmalloc'd
+ */
 static inline int alloc_torus_node(struct torus *priv, u32 nodes)
 {
-	priv->node = kcalloc(nodes, sizeof(*priv->node), GFP_KERNEL);
+	priv->node = vzalloc(nodes * sizeof(*priv->node));
 	if (!priv->node)
 		return -ENOMEM;
 	priv->nodes = nodes;
@@ -173,100 +934,100 @@ static inline int alloc_torus_node(struct torus *priv, u32 nodes)
 
 static inline void free_torus_node(struct torus *priv)
 {
-	kfree(priv->node);
+	vfree(priv->node);
 	priv->node = NULL;
 	priv->nodes = 0;
 }
 
+/*
+ * resize_torus_ports replaces the port records with a copy of n of them;
+ * readers may still have the old ones so those are freed after a grace
+ * period rather than waiting for it.
+ */
+static inline int resize_torus_ports(struct torus *priv, uint n)
+{
+	struct	torus_ports *old, *new;
+
+	if (new = kzalloc(torus_ports_size(n), GFP_KERNEL), !new)
+		return -ENOMEM;
+	old = torus_ports_locked(priv);
+	new->n = n;
+	memcpy(new->port, old->port,
+	       min(n, old->n) * sizeof(struct torus_port));
+	rcu_assign_pointer(priv->port, new);
+	kfree_rcu(old, rcu);
+	return 0;
+}
+
 static inline int add_torus_port(struct torus *priv, struct net_device *dev)
 {
-	struct	net_device **old_port, **new_port;
-	u8	*old_peer, *new_peer;
+	struct	torus_ports *ports;
+	struct	torus_port *p;
 	int	i, err;
 
 	/*
-	 * we don't have to synchronize with readers to add a dev
-	 * unless we need to expand the port[] and peer[]
+	 * we don't have to synchronize with readers to add a dev to an
+	 * unused record, nor to grow them since the old are freed by rcu
 	 */
-	spin_lock(&priv->lock);
-	err = -ENOSPC;
-	for (i = 0; i < TORUS_PORT_MAX; i++)
-		if (i == priv->ports) {
-			err = -ENOMEM;
-			new_port = kcalloc(priv->ports + TORUS_PORT_CHUNK,
-					   sizeof(*priv->port), GFP_KERNEL);
-			if (!new_port)
-				break;
-			new_peer = kcalloc(priv->ports + TORUS_PORT_CHUNK,
-					   TORUS_ALEN, GFP_KERNEL);
-			if (!new_peer) {
-				kfree(new_port);
-				break;
-			}
-			old_port = priv->port;
-			old_peer = priv->peer;
-			memcpy(new_port, rcu_dereference(old_port),
-			       sizeof(*new_port) * priv->ports);
-			memcpy(new_peer, rcu_dereference(old_peer),
-			       TORUS_ALEN * priv->ports);
-			new_port[priv->ports] = dev;
-			priv->ports += TORUS_PORT_CHUNK;
-			rcu_assign_pointer(priv->port, new_port);
-			rcu_assign_pointer(priv->peer, new_peer);
-			synchronize_rcu();
-			kfree(old_port);
-			kfree(old_peer);
-			err = i;
-			break;
-		} else if (priv->port[i] == NULL) {
-			priv->port[i] = dev;
-			err = i;
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	for (i = 1; i < ports->n; i++)
+		if (!ports->port[i].dev)
 			break;
-		}
-	spin_unlock(&priv->lock);
+	err = -ENOSPC;
+	if (i == TORUS_PORT_MAX)
+		goto out;
+	if (i == ports->n) {
+		err = grow_torus_port_chunks(priv, ports->n + TORUS_PORT_CHUNK);
+		if (err < 0)
+			goto out;
+		err = grow_torus_neighbors(priv, ports->n + TORUS_PORT_CHUNK);
+		if (err < 0)
+			goto out;
+		err = resize_torus_ports(priv, ports->n + TORUS_PORT_CHUNK);
+		if (err < 0)
+			goto out;
+		ports = torus_ports_locked(priv);
+	}
+	reset_torus_marks(priv, i);
+	p = &ports->port[i];
+	memset(p->peer, 0, TORUS_ALEN);
+	p->down = !torus_port_live(dev);
+	/* the record is complete before readers can find its dev */
+	smp_wmb();
+	ACCESS_ONCE(p->dev) = dev;
+	err = i;
+out:
+	mutex_unlock(&priv->port_mutex);
+	if (err > 0)
+		reset_torus_neighbor(priv, err);
 	return err;
 }
 
 static inline int rm_torus_port(struct torus *priv, struct net_device *dev)
 {
-	struct	net_device **old_port, **new_port;
-	u8	*old_peer, *new_peer;
-	int	i, err;
+	struct	torus_ports *ports;
+	uint	i, last = 0;
+	int	err = -ENODEV;
 
-	/* we have to synchronize with readers to remove a dev */
-	spin_lock(&priv->lock);
-	err = -ENODEV;
-	for (i = 0; i < TORUS_PORT_MAX; i++)
-		if (priv->port[i] == dev) {
-			new_port = kcalloc(priv->ports, sizeof(*priv->port),
-					   GFP_KERNEL);
-			if (!new_port) {
-				err = -ENOMEM;
-				break;
-			}
-			new_peer = kcalloc(priv->ports, TORUS_ALEN, GFP_KERNEL);
-			if (!new_peer) {
-				kfree(new_port);
-				err = -ENOMEM;
-				break;
-			}
-			old_port = priv->port;
-			old_peer = priv->peer;
-			memcpy(new_port, rcu_dereference(old_port),
-			       sizeof(*new_port) * priv->ports);
-			memcpy(new_peer, rcu_dereference(old_peer),
-			       TORUS_ALEN * priv->ports);
-			new_port[i] = NULL;
-			memset(new_peer + (i * TORUS_ALEN), 0, TORUS_ALEN);
-			rcu_assign_pointer(priv->port, new_port);
-			rcu_assign_pointer(priv->peer, new_peer);
-			synchronize_rcu();
-			kfree(old_port);
-			kfree(old_peer);
+	/*
+	 * readers that still have dev may finish with it, the caller has
+	 * its reference until after the synchronize of its unregister
+	 */
+	mutex_lock(&priv->port_mutex);
+	ports = torus_ports_locked(priv);
+	for (i = 1; i < ports->n; i++)
+		if (ports->port[i].dev == dev) {
+			ACCESS_ONCE(ports->port[i].dev) = NULL;
+			memset(ports->port[i].peer, 0, TORUS_ALEN);
+			ports->port[i].down = false;
 			err = 0;
-			break;
-		}
-	spin_unlock(&priv->lock);
+		} else if (ports->port[i].dev)
+			last = i;
+	/* shrink by whole chunks past the last port in use */
+	if (!err && ports->n - (last + 1) >= TORUS_PORT_CHUNK)
+		resize_torus_ports(priv, round_up(last + 1, TORUS_PORT_CHUNK));
+	mutex_unlock(&priv->port_mutex);
 	return err;
 }
 
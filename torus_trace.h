@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#undef	TRACE_SYSTEM
+#define	TRACE_SYSTEM	torus
+
+#if !defined(__TORUS_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __TORUS_TRACE_H__
+
+#include <linux/netdevice.h>
+#include <linux/tracepoint.h>
+#include <counters.h>
+#include <addr.h>
+#include <latency.h>
+
+#define	show_torus_drop(reason)						\
+	__print_symbolic(reason,					\
+			 { TORUS_DROP_NO_ROUTE,	"no_route" },		\
+			 { TORUS_DROP_TTL,	"ttl" },		\
+			 { TORUS_DROP_CLONE,	"clone" },		\
+			 { TORUS_DROP_XMIT,	"xmit" },		\
+			 { TORUS_DROP_BACKLOG,	"backlog" })
+
+DECLARE_EVENT_CLASS(torus_frame,
+
+	TP_PROTO(const struct net_device *dev, const struct net_device *port,
+		 const u8 *dest, uint len),
+
+	TP_ARGS(dev, port, dest, len),
+
+	TP_STRUCT__entry(
+		__string(	dev,	dev->name		)
+		__field(	int,	port			)
+		__array(	u8,	dest,	TORUS_ALEN	)
+		__field(	u8,	ttl			)
+		__field(	uint,	len			)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev->name);
+		__entry->port = torus_port_index(dev, port);
+		memcpy(__entry->dest, dest, TORUS_ALEN);
+		__entry->ttl = get_torus_ttl(dest);
+		__entry->len = len;
+	),
+
+	TP_printk("%s port %d dest %pM ttl %u len %u", __get_str(dev),
+		  __entry->port, __entry->dest, __entry->ttl, __entry->len)
+);
+
+/*
+ * torus_rx: a frame received by port of torus dev
+ */
+DEFINE_EVENT(torus_frame, torus_rx,
+	TP_PROTO(const struct net_device *dev, const struct net_device *port,
+		 const u8 *dest, uint len),
+	TP_ARGS(dev, port, dest, len)
+);
+
+/*
+ * torus_forward: a frame sent by torus dev through port
+ */
+DEFINE_EVENT(torus_frame, torus_forward,
+	TP_PROTO(const struct net_device *dev, const struct net_device *port,
+		 const u8 *dest, uint len),
+	TP_ARGS(dev, port, dest, len)
+);
+
+/*
+ * torus_local: a frame delivered to the stack by torus dev
+ */
+DEFINE_EVENT(torus_frame, torus_local,
+	TP_PROTO(const struct net_device *dev, const struct net_device *port,
+		 const u8 *dest, uint len),
+	TP_ARGS(dev, port, dest, len)
+);
+
+/*
+ * torus_drop: a frame dropped by torus dev; dest is NULL if the frame was
+ * already freed, as with a failed dev_queue_xmit()
+ */
+TRACE_EVENT(torus_drop,
+
+	TP_PROTO(const struct net_device *dev, uint reason, const u8 *dest,
+		 uint len),
+
+	TP_ARGS(dev, reason, dest, len),
+
+	TP_STRUCT__entry(
+		__string(	dev,	dev->name		)
+		__field(	uint,	reason			)
+		__array(	u8,	dest,	TORUS_ALEN	)
+		__field(	u8,	ttl			)
+		__field(	uint,	len			)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev->name);
+		__entry->reason = reason;
+		if (dest)
+			memcpy(__entry->dest, dest, TORUS_ALEN);
+		else
+			memset(__entry->dest, 0, TORUS_ALEN);
+		__entry->ttl = dest ? get_torus_ttl(dest) : 0;
+		__entry->len = len;
+	),
+
+	TP_printk("%s %s dest %pM ttl %u len %u", __get_str(dev),
+		  show_torus_drop(__entry->reason), __entry->dest,
+		  __entry->ttl, __entry->len)
+);
+
+/*
+ * torus_lu_update: a new generation of the lookup tables of torus dev
+ */
+TRACE_EVENT(torus_lu_update,
+
+	TP_PROTO(const struct net_device *dev, u64 gen),
+
+	TP_ARGS(dev, gen),
+
+	TP_STRUCT__entry(
+		__string(	dev,	dev->name		)
+		__field(	u64,	gen			)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev->name);
+		__entry->gen = gen;
+	),
+
+	TP_printk("%s gen %llu", __get_str(dev), __entry->gen)
+);
+
+#endif	/* __TORUS_TRACE_H__ */
+
+/*
+ * This is outside of the kernel's include/trace/events
+ */
+#undef	TRACE_INCLUDE_PATH
+#define	TRACE_INCLUDE_PATH	.
+#undef	TRACE_INCLUDE_FILE
+#define	TRACE_INCLUDE_FILE	torus_trace
+#include <trace/define_trace.h>
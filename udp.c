@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <linux/etherdevice.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <net/udp.h>
+#include <torus.h>
+
+struct rtnl_link_ops torus_udp_rtnl;
+
+static LIST_HEAD(torus_udp_socks);
+
+static const struct nla_policy torus_udp_policy[] = {
+	[TORUS_UDP_LOCAL_ATTR]	= { .type = NLA_U32 },
+	[TORUS_UDP_REMOTE_ATTR]	= { .type = NLA_U32 },
+	[TORUS_UDP_PORT_ATTR]	= { .type = NLA_U16 },
+	[TORUS_UDP_TTL_ATTR]	= { .type = NLA_U8 },
+};
+
+/*
+ * Pass the inner frame to the device of its peer, where the rx_handler of
+ * its torus master takes it like that of any other port.  The encap hook
+ * runs ahead of the UDP checksum so it's verified here.
+ */
+static int torus_udp_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct	torus_udp_sock *us = sk->sk_user_data;
+	struct	torus_udp *p;
+	__be32	saddr = ip_hdr(skb)->saddr;
+
+	if (!us || udp_lib_checksum_complete(skb) ||
+	    !pskb_may_pull(skb, sizeof(struct udphdr) + ETH_HLEN))
+		goto drop;
+	list_for_each_entry_rcu(p, &us->devs, list)
+		if (p->remote == saddr)
+			goto found;
+drop:
+	kfree_skb(skb);
+	return 0;
+found:
+	__skb_pull(skb, sizeof(struct udphdr));
+	__skb_tunnel_rx(skb, p->dev);
+	skb_reset_mac_header(skb);
+	skb->protocol = eth_type_trans(skb, p->dev);
+	/* a peer on this host may leave the inner checksum to the egress */
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		skb->ip_summed = CHECKSUM_NONE;
+	count_packet(&p->rx, skb->len + ETH_HLEN);
+	if (netif_rx(skb) != NET_RX_SUCCESS)
+		count_drop(&p->rx);
+	return 0;
+}
+
+static struct torus_udp_sock *get_torus_udp_sock(struct net *net,
+						 __be16 port)
+{
+	struct	torus_udp_sock *us;
+	struct	sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+		.sin_port = port,
+	};
+	int	err;
+
+	list_for_each_entry(us, &torus_udp_socks, list)
+		if (net_eq(us->net, net) && us->port == port) {
+			us->refs++;
+			return us;
+		}
+	us = kzalloc(sizeof(*us), GFP_KERNEL);
+	if (!us)
+		return ERR_PTR(-ENOMEM);
+	err = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, &us->sock);
+	if (err < 0) {
+		kfree(us);
+		return ERR_PTR(err);
+	}
+	sk_change_net(us->sock->sk, net);
+	err = kernel_bind(us->sock, (struct sockaddr *)&sin, sizeof(sin));
+	if (err < 0) {
+		sk_release_kernel(us->sock->sk);
+		kfree(us);
+		return ERR_PTR(err);
+	}
+	INIT_LIST_HEAD(&us->devs);
+	us->net = net;
+	us->port = port;
+	us->refs = 1;
+	us->sock->sk->sk_user_data = us;
+	udp_sk(us->sock->sk)->encap_type = 1;
+	udp_sk(us->sock->sk)->encap_rcv = torus_udp_rcv;
+	udp_encap_enable();
+	list_add(&us->list, &torus_udp_socks);
+	return us;
+}
+
+static void put_torus_udp_sock(struct torus_udp_sock *us)
+{
+	if (--us->refs)
+		return;
+	list_del(&us->list);
+	us->sock->sk->sk_user_data = NULL;
+	sk_release_kernel(us->sock->sk);
+	kfree_rcu(us, rcu);
+}
+
+/*
+ * The torus master reserves the headroom of its ports so the outer headers
+ * fit in front of the frames from its host without reallocating them;
+ * skb_cow_head still copies the transit frames of other ports, with their
+ * own headroom, and the shared clones of a flood.
+ */
+static netdev_tx_t torus_udp_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct	torus_udp *p = netdev_priv(dev);
+	struct	torus_udp_hdr *hdr;
+	struct	rtable *rt;
+	struct	flowi4 fl4;
+	__be16	sport = torus_udp_sport(skb);
+	uint	len = skb->len;
+
+	memset(&fl4, 0, sizeof(fl4));
+	fl4.daddr = p->remote;
+	fl4.saddr = p->local;
+	fl4.flowi4_proto = IPPROTO_UDP;
+	rt = ip_route_output_key(dev_net(dev), &fl4);
+	if (IS_ERR(rt))
+		goto drop;
+	if (rt->dst.dev == dev) {
+		ip_rt_put(rt);
+		goto drop;
+	}
+	if (skb_cow_head(skb, LL_RESERVED_SPACE(rt->dst.dev) + sizeof(*hdr))) {
+		ip_rt_put(rt);
+		goto drop;
+	}
+	hdr = (struct torus_udp_hdr *)__skb_push(skb, sizeof(*hdr));
+	*hdr = p->hdr;
+	hdr->ip.saddr = fl4.saddr;
+	hdr->udp.source = sport;
+	hdr->udp.len = htons(skb->len - sizeof(hdr->ip));
+	ip_select_ident(&hdr->ip, &rt->dst, NULL);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(hdr->ip));
+	skb->protocol = htons(ETH_P_IP);
+	skb->local_df = 1;
+	memset(IPCB(skb), 0, sizeof(*IPCB(skb)));
+	nf_reset(skb);
+	skb_dst_drop(skb);
+	skb_dst_set(skb, &rt->dst);
+	if (net_xmit_eval(ip_local_out(skb)) == 0)
+		count_packet(&p->tx, len);
+	else
+		count_drop(&p->tx);
+	return NETDEV_TX_OK;
+drop:
+	count_drop(&p->tx);
+	dev_kfree_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+static struct rtnl_link_stats64 *
+torus_udp_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *cnt)
+{
+	struct	torus_udp *p = netdev_priv(dev);
+
+	accumulate_counters(&p->rx);
+	accumulate_counters(&p->tx);
+	cnt->rx_packets	+= p->rx.packets;
+	cnt->tx_packets	+= p->tx.packets;
+	cnt->rx_bytes	+= p->rx.bytes;
+	cnt->tx_bytes	+= p->tx.bytes;
+	cnt->rx_dropped	+= p->rx.drops;
+	cnt->tx_dropped	+= p->tx.drops;
+	return cnt;
+}
+
+static int torus_udp_change_mtu(struct net_device *dev, int mtu)
+{
+	if (mtu < TORUS_MIN_MTU || mtu > TORUS_MAX_MTU)
+		return -EINVAL;
+	dev->mtu = mtu;
+	return 0;
+}
+
+static const struct net_device_ops torus_udp_netdev = {
+	.ndo_start_xmit      = torus_udp_xmit,
+	.ndo_get_stats64     = torus_udp_get_stats64,
+	.ndo_change_mtu      = torus_udp_change_mtu,
+	.ndo_set_mac_address = eth_mac_addr,
+};
+
+static void torus_udp_destructor(struct net_device *dev)
+{
+	struct	torus_udp *p = netdev_priv(dev);
+
+	free_percpu_counters(&p->rx);
+	free_percpu_counters(&p->tx);
+	free_netdev(dev);
+}
+
+static void torus_udp_setup(struct net_device *dev)
+{
+	struct	torus_udp *p = netdev_priv(dev);
+
+	p->dev = dev;
+	alloc_percpu_counters(&p->rx);
+	alloc_percpu_counters(&p->tx);
+	ether_setup(dev);
+	eth_hw_addr_random(dev);
+	dev->priv_flags &= ~IFF_TX_SKB_SHARING;
+	dev->netdev_ops = &torus_udp_netdev;
+	dev->destructor = torus_udp_destructor;
+	/* the socket stays in its creator's name-space, so does the port */
+	dev->features |= NETIF_F_LLTX | NETIF_F_SG | NETIF_F_HW_CSUM |
+		NETIF_F_NETNS_LOCAL;
+	dev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM;
+	dev->needed_headroom = TORUS_UDP_HEADROOM;
+	dev->mtu = TORUS_UDP_MTU;
+}
+
+static int torus_udp_validate(struct nlattr *tb[], struct nlattr *data[])
+{
+	__be32	remote;
+
+	if (tb[IFLA_MTU])
+		retonerange(nla_get_u32(tb[IFLA_MTU]),
+			    TORUS_MIN_MTU, TORUS_MAX_MTU, "MTU");
+	if (tb[IFLA_ADDRESS])
+		retonerange(nla_len(tb[IFLA_ADDRESS]),
+			    ETH_ALEN, ETH_ALEN, "ADDR LEN");
+	retonerr(data && data[TORUS_UDP_REMOTE_ATTR] ? 0 : -EINVAL,
+		 "no REMOTE");
+	remote = nla_get_be32(data[TORUS_UDP_REMOTE_ATTR]);
+	retonerr(ipv4_is_zeronet(remote) || ipv4_is_multicast(remote) ||
+		 ipv4_is_lbcast(remote) ? -EINVAL : 0,
+		 "invalid REMOTE, %pI4", &remote);
+	if (data[TORUS_UDP_PORT_ATTR])
+		retonerr(nla_get_u16(data[TORUS_UDP_PORT_ATTR]) ? 0 : -EINVAL,
+			 "no PORT");
+	return 0;
+}
+
+static int torus_udp_newlink(struct net *net, struct net_device *dev,
+			     struct nlattr *tb[], struct nlattr *data[])
+{
+	struct	torus_udp *p = netdev_priv(dev), *q;
+	struct	torus_udp_hdr *hdr = &p->hdr;
+	int	err;
+
+	p->remote = nla_get_be32(data[TORUS_UDP_REMOTE_ATTR]);
+	if (data[TORUS_UDP_LOCAL_ATTR])
+		p->local = nla_get_be32(data[TORUS_UDP_LOCAL_ATTR]);
+	p->port = htons(data[TORUS_UDP_PORT_ATTR]
+			? nla_get_u16(data[TORUS_UDP_PORT_ATTR])
+			: TORUS_UDP_PORT);
+	if (data[TORUS_UDP_TTL_ATTR])
+		p->ttl = nla_get_u8(data[TORUS_UDP_TTL_ATTR]);
+	hdr->ip.version = 4;
+	hdr->ip.ihl = sizeof(hdr->ip) >> 2;
+	hdr->ip.protocol = IPPROTO_UDP;
+	hdr->ip.ttl = p->ttl ? : sysctl_ip_default_ttl;
+	hdr->ip.daddr = p->remote;
+	hdr->udp.dest = p->port;
+	if (tb[IFLA_ADDRESS])
+		memcpy(dev->dev_addr, nla_data(tb[IFLA_ADDRESS]), ETH_ALEN);
+	if (!tb[IFLA_MTU])
+		dev->mtu = TORUS_UDP_MTU;
+	p->us = get_torus_udp_sock(net, p->port);
+	retonerr(IS_ERR(p->us) ? PTR_ERR(p->us) : 0,
+		 "bind %s port %u", dev->name, ntohs(p->port));
+	list_for_each_entry(q, &p->us->devs, list)
+		if (q->remote == p->remote) {
+			put_torus_udp_sock(p->us);
+			pr_torus_err("%pI4 has %s", &p->remote, q->dev->name);
+			return -EEXIST;
+		}
+	err = register_netdevice(dev);
+	if (err < 0) {
+		put_torus_udp_sock(p->us);
+		return err;
+	}
+	list_add_rcu(&p->list, &p->us->devs);
+	return 0;
+}
+
+static void torus_udp_dellink(struct net_device *dev, struct list_head *head)
+{
+	struct	torus_udp *p = netdev_priv(dev);
+
+	list_del_rcu(&p->list);
+	put_torus_udp_sock(p->us);
+	unregister_netdevice_queue(dev, head);
+}
+
+static size_t torus_udp_get_size(const struct net_device UNUSED *dev)
+{
+	return 2 * nla_total_size(sizeof(__be32)) +
+		nla_total_size(sizeof(u16)) + nla_total_size(sizeof(u8));
+}
+
+static int torus_udp_fill_info(struct sk_buff *skb,
+			       const struct net_device *dev)
+{
+	const	struct torus_udp *p = netdev_priv(dev);
+
+	if (nla_put_be32(skb, TORUS_UDP_LOCAL_ATTR, p->local) ||
+	    nla_put_be32(skb, TORUS_UDP_REMOTE_ATTR, p->remote) ||
+	    nla_put_u16(skb, TORUS_UDP_PORT_ATTR, ntohs(p->port)) ||
+	    nla_put_u8(skb, TORUS_UDP_TTL_ATTR, p->ttl))
+		return -EMSGSIZE;
+	return 0;
+}
+
+struct rtnl_link_ops torus_udp_rtnl = {
+	.kind		= TORUS_UDP,
+	.maxtype	= TORUS_UDP_LAST_ATTR,
+	.policy		= torus_udp_policy,
+	.validate	= torus_udp_validate,
+	.priv_size	= sizeof(struct torus_udp),
+	.setup		= torus_udp_setup,
+	.newlink	= torus_udp_newlink,
+	.dellink	= torus_udp_dellink,
+	.get_size	= torus_udp_get_size,
+	.fill_info	= torus_udp_fill_info,
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __TORUS_UDP_H__
+#define __TORUS_UDP_H__
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/torus.h>
+#include <counters.h>
+
+/*
+ * the outer headers of each frame, prebuilt but for the source port and
+ * those that ip_local_out() fills
+ */
+struct	torus_udp_hdr {
+	struct	iphdr	ip;
+	struct	udphdr	udp;
+} PACKED;
+
+#define	TORUS_UDP_HEADROOM	(LL_MAX_HEADER + sizeof(struct torus_udp_hdr))
+#define	TORUS_UDP_MTU		(ETH_DATA_LEN - ETH_HLEN - \
+				 sizeof(struct torus_udp_hdr))
+/*
+ * the source ports of the flows are within this ephemeral range
+ */
+#define	TORUS_UDP_SPORT_MIN	49152
+#define	TORUS_UDP_SPORT_BITS	14
+
+/*
+ * Every torus_udp device of a name-space with the same port shares one
+ * kernel socket that demultiplexes the received frames by their source
+ * address; socks and each devs are changed with rtnl held.
+ */
+struct	torus_udp_sock {
+	struct	list_head	list;
+	struct	rcu_head	rcu;
+	struct	socket		*sock;
+	struct	net		*net;
+	__be16			port;
+	uint			refs;
+	struct	list_head	devs;
+};
+
+struct	torus_udp {
+	struct	list_head	list;
+	struct	net_device	*dev;
+	struct	torus_udp_sock	*us;
+	__be32			local;
+	__be32			remote;
+	__be16			port;
+	u8			ttl;
+	struct	torus_udp_hdr	hdr;
+	struct	counters	rx, tx;
+};
+
+static inline __be16 torus_udp_sport(struct sk_buff *skb)
+{
+	return htons(TORUS_UDP_SPORT_MIN +
+		     (skb_get_rxhash(skb) >> (32 - TORUS_UDP_SPORT_BITS)));
+}
+
+#endif	/* __TORUS_UDP_H__ */
@@ -0,0 +1,121 @@
+/*
+ * xdp_torus.c	XDP transit forwarding for torus ports
+ *
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * This repeats the single next hop lookup of lookup_torus_port() in
+ * torus.h and the TTL handling of addr.h on each port of a torus node so
+ * that transit frames are redirected port to port without an skb.  Frames
+ * for this node, multicast, multipath entries, coordinate routing and
+ * frames to ports that are down or without XDP are passed to the stack,
+ * or the torus rx_handler, as before.  xdp_torus_load fills the maps from
+ * sysfs or from files of the same format.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <bpf/bpf_helpers.h>
+#include <xdp_torus.h>
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct xdp_torus_lu);
+} torus_lu SEC(".maps");
+
+/*
+ * torus_port[i] is non-zero if the i'th torus port is in torus_tx
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, XDP_TORUS_PORT_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} torus_port SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_DEVMAP);
+	__uint(max_entries, XDP_TORUS_PORT_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} torus_tx SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, XDP_TORUS_COUNTERS);
+	__type(key, __u32);
+	__type(value, __u64);
+} torus_counters SEC(".maps");
+
+static __always_inline int count(__u32 i, int action)
+{
+	__u64 *p = bpf_map_lookup_elem(&torus_counters, &i);
+
+	if (p)
+		*p += 1;
+	return action;
+}
+
+SEC("xdp")
+int xdp_torus(struct xdp_md *ctx)
+{
+	void	*data = (void *)(long)ctx->data;
+	void	*data_end = (void *)(long)ctx->data_end;
+	struct	ethhdr *e = data;
+	struct	xdp_torus_lu *lu;
+	__u32	zero = 0, i, p = 0, *tx;
+	__u8	ttl, b0, mp = 0;
+
+	if ((void *)(e + 1) > data_end)
+		return count(XDP_TORUS_PASS, XDP_PASS);
+	/* multicast and non-torus destinations are left to the rx_handler */
+	if ((e->h_dest[0] & 0x03) != 0x02)
+		return count(XDP_TORUS_PASS, XDP_PASS);
+	lu = bpf_map_lookup_elem(&torus_lu, &zero);
+	if (!lu || lu->coord)
+		return count(XDP_TORUS_PASS, XDP_PASS);
+#pragma unroll
+	for (i = 0; i < XDP_TORUS_LU_TBLS; i++) {
+		p = lu->lu[i][e->h_dest[i + 1]];
+		if (p != 0) {
+			mp = lu->pass[i][e->h_dest[i + 1]];
+			break;
+		}
+	}
+	if (p == 0) {
+		/* as reset_torus_ttl() and set_torus_vc() of local delivery */
+		e->h_dest[0] &= 0x0b;
+		return count(XDP_TORUS_PASS, XDP_PASS);
+	}
+	if (mp)
+		return count(XDP_TORUS_PASS, XDP_PASS);
+	tx = bpf_map_lookup_elem(&torus_port, &p);
+	if (!tx || *tx == 0)
+		return count(XDP_TORUS_PASS, XDP_PASS);
+	/* as dec_torus_ttl(), drop rather than send a frame with zero TTL */
+	b0 = e->h_dest[0];
+	ttl = b0 >> 4;
+	if (ttl <= 1)
+		return count(XDP_TORUS_TTL, XDP_DROP);
+	e->h_dest[0] = (b0 & 0x0f) | ((ttl - 1) << 4);
+	if (bpf_redirect_map(&torus_tx, p, 0) == XDP_REDIRECT)
+		return count(XDP_TORUS_REDIRECT, XDP_REDIRECT);
+	e->h_dest[0] = b0;
+	return count(XDP_TORUS_PASS, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
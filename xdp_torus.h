@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __XDP_TORUS_H__
+#define __XDP_TORUS_H__
+
+#include <linux/types.h>
+
+/*
+ * These match TORUS_LU_TBLS, TORUS_LU_TBL_ENTRIES and TORUS_PORT_MAX of
+ * the module's torus.h
+ */
+#define	XDP_TORUS_LU_TBLS		5
+#define	XDP_TORUS_LU_TBL_ENTRIES	256
+#define	XDP_TORUS_PORT_MAX		256
+
+#define	XDP_TORUS_PIN_PATH		"/sys/fs/bpf/torus"
+
+/*
+ * A non-zero pass[t][e] is an entry of the node's multipath table; those,
+ * and every unicast frame of a node with coord, are left to the rx_handler
+ * for its flow hash, adaptive choice and virtual channels.
+ */
+struct	xdp_torus_lu {
+	__u8	lu[XDP_TORUS_LU_TBLS][XDP_TORUS_LU_TBL_ENTRIES];
+	__u8	pass[XDP_TORUS_LU_TBLS][XDP_TORUS_LU_TBL_ENTRIES];
+	__u8	coord;
+};
+
+enum {
+	XDP_TORUS_PASS,
+	XDP_TORUS_REDIRECT,
+	XDP_TORUS_TTL,
+	XDP_TORUS_COUNTERS
+};
+
+#endif	/* __XDP_TORUS_H__ */
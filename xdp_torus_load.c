@@ -0,0 +1,348 @@
+/*
+ * xdp_torus_load.c	load, sync and unload xdp_torus.o on torus ports
+ *
+ * Copyright (C) 2012, 2013 Tom Grennan and Eliot Dresselhaus
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program; if not, write to the Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <net/if.h>
+#include <linux/types.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp_torus.h>
+
+#define	USAGE								\
+	"Usage:	xdp_torus_load [ -S ] [ -o OBJECT ] [ -d DIR ] load TORUS\n" \
+	"	xdp_torus_load [ -d DIR ] sync TORUS\n"			\
+	"	xdp_torus_load [ -d DIR ] unload TORUS\n"		\
+	"	xdp_torus_load show TORUS\n"				\
+	"\n"								\
+	"-S	attach in generic (skb) mode\n"				\
+	"-d	read ports, lu1...lu5, multipath and coord from DIR\n"	\
+	"	rather than the sysfs attributes of TORUS\n"		\
+	"OBJECT	default: xdp_torus.o\n"
+
+#define	SYSFS	"/sys/class/net"
+
+static const char *map_name[] = {
+	"torus_lu", "torus_port", "torus_tx", "torus_counters"
+};
+
+enum { LU_MAP, PORT_MAP, TX_MAP, COUNTERS_MAP, MAPS };
+
+/*
+ * dir has the files of the torus attributes, by default its sysfs directory
+ */
+struct	torus {
+	const	char *name;
+	char	dir[128];
+	char	port[XDP_TORUS_PORT_MAX][IF_NAMESIZE];
+	int	ports;
+	int	fd[MAPS];
+};
+
+static int err_out(const char *what, const char *name)
+{
+	fprintf(stderr, "xdp_torus_load: %s %s: %s\n", what, name,
+		strerror(errno));
+	return -1;
+}
+
+static void pin_path(char *path, size_t sz, const char *torus,
+		     const char *map)
+{
+	if (map)
+		snprintf(path, sz, "%s/%s/%s", XDP_TORUS_PIN_PATH, torus, map);
+	else
+		snprintf(path, sz, "%s/%s", XDP_TORUS_PIN_PATH, torus);
+}
+
+static int is_torus_dev(const char *name)
+{
+	char	path[128];
+	struct	stat st;
+
+	snprintf(path, sizeof(path), SYSFS "/%s/ports", name);
+	return stat(path, &st) == 0;
+}
+
+/*
+ * read port[] from the torus "ports" sysfs attribute, an empty line is an
+ * unused port
+ */
+static int read_ports(struct torus *t)
+{
+	char	path[128], line[64];
+	FILE	*f;
+	size_t	n;
+
+	snprintf(path, sizeof(path), "%s/ports", t->dir);
+	if (f = fopen(path, "r"), !f)
+		return err_out("open", path);
+	for (t->ports = 0; t->ports < XDP_TORUS_PORT_MAX &&
+		     fgets(line, sizeof(line), f); t->ports++) {
+		n = strcspn(line, "\n");
+		line[n] = '\0';
+		if (!strcmp(line, "..."))
+			break;
+		strncpy(t->port[t->ports], line, IF_NAMESIZE - 1);
+	}
+	fclose(f);
+	return 0;
+}
+
+/*
+ * mark the entries of "N ENTRY PORT..." lines of multipath to be passed and
+ * all of a node with coord, a first line other than "0"; these files are
+ * optional
+ */
+static int read_mp(struct torus *t, struct xdp_torus_lu *lu)
+{
+	char	path[160], line[256];
+	FILE	*f;
+	unsigned tbl, e;
+
+	memset(lu->pass, 0, sizeof(lu->pass));
+	lu->coord = 0;
+	snprintf(path, sizeof(path), "%s/multipath", t->dir);
+	if (f = fopen(path, "r"), f) {
+		while (fgets(line, sizeof(line), f))
+			if (sscanf(line, "%u %u", &tbl, &e) == 2 &&
+			    tbl >= 1 && tbl <= XDP_TORUS_LU_TBLS &&
+			    e < XDP_TORUS_LU_TBL_ENTRIES)
+				lu->pass[tbl - 1][e] = 1;
+		fclose(f);
+	}
+	snprintf(path, sizeof(path), "%s/coord", t->dir);
+	if (f = fopen(path, "r"), f) {
+		if (fgets(line, sizeof(line), f) && strcmp(line, "0\n"))
+			lu->coord = 1;
+		fclose(f);
+	}
+	return 0;
+}
+
+/*
+ * is_port_up is false for a port that's down so that its frames go to the
+ * rx_handler and its loop-free alternate
+ */
+static int is_port_up(const char *name)
+{
+	char	path[128], state[32] = "";
+	FILE	*f;
+
+	snprintf(path, sizeof(path), SYSFS "/%s/operstate", name);
+	if (f = fopen(path, "r"), !f)
+		return 0;
+	if (!fgets(state, sizeof(state), f))
+		state[0] = '\0';
+	fclose(f);
+	return !strncmp(state, "up", 2) || !strncmp(state, "unknown", 7);
+}
+
+static int read_lu(struct torus *t, struct xdp_torus_lu *lu)
+{
+	char	path[128];
+	FILE	*f;
+	int	tbl, i;
+	unsigned u;
+
+	for (tbl = 0; tbl < XDP_TORUS_LU_TBLS; tbl++) {
+		snprintf(path, sizeof(path), "%s/lu%d", t->dir, tbl + 1);
+		if (f = fopen(path, "r"), !f)
+			return err_out("open", path);
+		for (i = 0; i < XDP_TORUS_LU_TBL_ENTRIES; i++)
+			if (fscanf(f, "%u", &u) != 1) {
+				fclose(f);
+				errno = EINVAL;
+				return err_out("read", path);
+			} else
+				lu->lu[tbl][i] = u;
+		fclose(f);
+	}
+	return read_mp(t, lu);
+}
+
+static int open_maps(struct torus *t)
+{
+	char	path[256];
+	int	i;
+
+	for (i = 0; i < MAPS; i++) {
+		pin_path(path, sizeof(path), t->name, map_name[i]);
+		if (t->fd[i] = bpf_obj_get(path), t->fd[i] < 0)
+			return err_out("open", path);
+	}
+	return 0;
+}
+
+/*
+ * copy the lookup tables and ports of the torus device to the maps
+ */
+static int sync_maps(struct torus *t)
+{
+	struct	xdp_torus_lu lu;
+	__u32	i, zero = 0, on, ifindex;
+
+	if (read_ports(t) || read_lu(t, &lu))
+		return -1;
+	if (bpf_map_update_elem(t->fd[LU_MAP], &zero, &lu, BPF_ANY))
+		return err_out("update", map_name[LU_MAP]);
+	for (i = 0; i < XDP_TORUS_PORT_MAX; i++) {
+		ifindex = 0;
+		/* port[0] is the torus device itself */
+		if (i > 0 && i < t->ports && t->port[i][0] &&
+		    !is_torus_dev(t->port[i]) && is_port_up(t->port[i]))
+			ifindex = if_nametoindex(t->port[i]);
+		on = ifindex != 0;
+		if (bpf_map_update_elem(t->fd[PORT_MAP], &i, &on, BPF_ANY))
+			return err_out("update", map_name[PORT_MAP]);
+		if (ifindex) {
+			if (bpf_map_update_elem(t->fd[TX_MAP], &i, &ifindex,
+						BPF_ANY))
+				return err_out("update", t->port[i]);
+		} else
+			bpf_map_delete_elem(t->fd[TX_MAP], &i);
+	}
+	return 0;
+}
+
+static int load(struct torus *t, const char *file, __u32 flags)
+{
+	struct	bpf_object *obj;
+	struct	bpf_program *prog;
+	char	path[256];
+	int	i, fd, ifindex;
+
+	obj = bpf_object__open_file(file, NULL);
+	if (libbpf_get_error(obj))
+		return err_out("open", file);
+	if (bpf_object__load(obj))
+		return err_out("load", file);
+	prog = bpf_object__find_program_by_name(obj, "xdp_torus");
+	if (!prog)
+		return err_out("find xdp_torus in", file);
+	fd = bpf_program__fd(prog);
+	pin_path(path, sizeof(path), t->name, NULL);
+	if (bpf_object__pin_maps(obj, path))
+		return err_out("pin", path);
+	if (open_maps(t) || sync_maps(t))
+		return -1;
+	for (i = 1; i < t->ports; i++) {
+		if (!t->port[i][0] || is_torus_dev(t->port[i]))
+			continue;
+		ifindex = if_nametoindex(t->port[i]);
+		if (bpf_xdp_attach(ifindex, fd, flags, NULL))
+			return err_out("attach", t->port[i]);
+	}
+	return 0;
+}
+
+static int unload(struct torus *t)
+{
+	char	path[256];
+	int	i;
+
+	if (read_ports(t))
+		return -1;
+	for (i = 1; i < t->ports; i++)
+		if (t->port[i][0] && !is_torus_dev(t->port[i]))
+			bpf_xdp_detach(if_nametoindex(t->port[i]), 0, NULL);
+	for (i = 0; i < MAPS; i++) {
+		pin_path(path, sizeof(path), t->name, map_name[i]);
+		unlink(path);
+	}
+	pin_path(path, sizeof(path), t->name, NULL);
+	rmdir(path);
+	return 0;
+}
+
+static int show(struct torus *t)
+{
+	static const char *counter_name[] = {
+		[XDP_TORUS_PASS]	= "pass",
+		[XDP_TORUS_REDIRECT]	= "redirect",
+		[XDP_TORUS_TTL]		= "ttl-drop",
+	};
+	int	cpus = libbpf_num_possible_cpus();
+	__u64	*v, sum;
+	__u32	i;
+	int	cpu;
+
+	if (cpus < 0 || open_maps(t))
+		return -1;
+	v = calloc(cpus, sizeof(*v));
+	if (!v)
+		return err_out("alloc", "counters");
+	for (i = 0; i < XDP_TORUS_COUNTERS; i++) {
+		if (bpf_map_lookup_elem(t->fd[COUNTERS_MAP], &i, v))
+			continue;
+		for (sum = 0, cpu = 0; cpu < cpus; cpu++)
+			sum += v[cpu];
+		printf("%s %llu\n", counter_name[i], (unsigned long long)sum);
+	}
+	free(v);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct	torus t = { 0 };
+	const	char *file = "xdp_torus.o", *dir = NULL;
+	__u32	flags = XDP_FLAGS_DRV_MODE;
+	int	opt;
+
+	while (opt = getopt(argc, argv, "So:d:h"), opt != -1)
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'S':
+			flags = XDP_FLAGS_SKB_MODE;
+			break;
+		case 'o':
+			file = optarg;
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return 1;
+		}
+	if (argc - optind != 2) {
+		fputs(USAGE, stderr);
+		return 1;
+	}
+	t.name = argv[optind + 1];
+	if (dir)
+		snprintf(t.dir, sizeof(t.dir), "%s", dir);
+	else
+		snprintf(t.dir, sizeof(t.dir), SYSFS "/%s", t.name);
+	if (!strcmp(argv[optind], "load"))
+		return load(&t, file, flags) ? 1 : 0;
+	if (!strcmp(argv[optind], "sync"))
+		return open_maps(&t) || sync_maps(&t) ? 1 : 0;
+	if (!strcmp(argv[optind], "unload"))
+		return unload(&t) ? 1 : 0;
+	if (!strcmp(argv[optind], "show"))
+		return show(&t) ? 1 : 0;
+	fputs(USAGE, stderr);
+	return 1;
+}